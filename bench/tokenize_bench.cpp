@@ -0,0 +1,736 @@
+
+#include <algorithm>
+#include <chrono>
+#include <filesystem>
+#include <iomanip>
+#include <iostream>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <vector>
+
+#include "scan.hpp"
+#include "source_buffer.hpp"
+#include "char_utils.hpp"
+#include "assembler.hpp"
+#include "incremental_parser.hpp"
+#include "parser.hpp"
+#include "tokenizer.hpp"
+
+/*
+ * Tokenizer throughput benchmark. Every input is tokenized once per scanning
+ * instruction set supported by this CPU. The scalar run steps through the
+ * input one character at a time like the original state machine did, so it
+ * is the baseline the vectorized runs are compared against.
+ *
+ * The table-driven lexer is also compared against a copy of the state machine
+ * it replaced, which branches on every character it inspects.
+ *
+ * Editing a large source with the IncrementalParser is compared against
+ * tokenizing and parsing it again from scratch.
+ *
+ * Assembler::evaluate, which dispatches on a NodeRef with std::visit and
+ * folds in place, is compared against a copy of an older evaluator, which
+ * switched on id(), used dynamic_cast and copied the whole tree. Evaluating
+ * a tree which is already evaluated is timed too.
+ *
+ * Evaluating the operands of a source which repeats the same few label
+ * expressions, once its labels are known, is timed one operand at a time and
+ * with a single ExpressionEvaluator, which evaluates each distinct
+ * subexpression once.
+ *
+ * Assembling an instruction-dense source with Parser::parseInto, which hands
+ * most lines to the encoder without building a tree, is compared against
+ * parsing the whole tree and then assembling it.
+ *
+ * The synthetic input is then tokenized with 1 to N threads to measure how
+ * the multi-threaded tokenizer scales.
+ *
+ * Usage: gbas_bench [corpus directory] [N]
+ *
+ * The corpus directory defaults to test/data; every .asm file in it is used.
+ * N defaults to the number of hardware threads.
+ */
+
+namespace {
+
+using Clock = std::chrono::steady_clock;
+
+const size_t SYNTHETIC_SIZE = 50 * 1024 * 1024;
+
+const int EDITED_LINES = 20000;
+
+/**
+ * Something like the data tables which dominate large sources: long runs of
+ * spaces, commas and digits, a few comments and the occasional instruction.
+ */
+std::string syntheticSource(size_t size) {
+  std::string text{};
+  text.reserve(size + 128);
+  unsigned seed = 1;
+  int row = 0;
+  while (text.size() < size) {
+    if (row % 64 == 0) {
+      text += "    ld hl, table_";
+      text += std::to_string(row);
+      text += "          ; start of block\n";
+    }
+    text += "    .byte   ";
+    for (int i = 0; i < 16; i++) {
+      seed = seed * 1103515245 + 12345;
+      if (i > 0) {
+        text += ",  ";
+      }
+      text += std::to_string((seed >> 16) % 256);
+    }
+    if (row % 8 == 0) {
+      text += "        ; row ";
+      text += std::to_string(row);
+    }
+    text += '\n';
+    row++;
+  }
+  return text;
+}
+
+/**
+ * Best wall time over a few runs of tokenizing source, in seconds.
+ */
+double timeTokenize(const SourceBuffer& source, size_t& tokenCount) {
+  Tokenizer tokenizer{};
+  double best = 1e9;
+  for (int run = 0; run < 5; run++) {
+    auto start = Clock::now();
+    auto tokens = tokenizer.tokenize(source);
+    std::chrono::duration<double> elapsed = Clock::now() - start;
+    best = std::min(best, elapsed.count());
+    tokenCount = tokens.size();
+  }
+  return best;
+}
+
+/**
+ * The branching state machine the tokenizer used before it was table-driven,
+ * kept as the baseline for the lexer comparison. Input errors are not
+ * reported, since the benchmark inputs are all valid.
+ */
+void referenceTokenizeLine(std::string_view line, uint32_t offset,
+                           TokenRecordList& tokens) {
+  using GBAS::isAlphaNumeric;
+  using GBAS::isNumericOp;
+
+  enum class State {
+    START_LINE,
+    START_TOKEN,
+    STRING_TOKEN,
+    TOKEN,
+    END_TOKEN,
+    END_LINE,
+  };
+
+  auto emit = [&](size_t pos, size_t len) {
+    tokens.push_back(Tokenizer::classify(line.substr(pos, len),
+                                         offset + static_cast<uint32_t>(pos)));
+  };
+
+  auto state = State::START_LINE;
+  size_t pos = 0;
+  size_t start = 0;
+  while (state != State::END_LINE) {
+    char curr = pos < line.size() ? line[pos] : '\0';
+    switch (state) {
+      case State::START_LINE:
+        if (pos >= line.size()) {
+          state = State::END_LINE;
+        } else if (curr == ' ') {
+          pos = Scan::skipSpaces(line.data(), pos, line.size());
+        } else {
+          state = State::START_TOKEN;
+        }
+        break;
+      case State::START_TOKEN:
+        start = pos;
+        if (pos >= line.size() || curr == ';') {
+          state = State::END_LINE;
+        } else if (curr == ' ') {
+          pos = Scan::skipSpaces(line.data(), pos, line.size());
+        } else if (isAlphaNumeric(curr) || curr == '.' || curr == '_' ||
+                   curr == '\\') {
+          state = State::TOKEN;
+        } else if (curr == '"') {
+          pos++;
+          state = State::STRING_TOKEN;
+        } else if (curr == '(' || curr == ')' || curr == ',' ||
+                   isNumericOp(curr)) {
+          pos++;
+          state = State::END_TOKEN;
+        } else {
+          throw TokenizerException("Invalid token", 0, pos);
+        }
+        break;
+      case State::STRING_TOKEN:
+        if (pos >= line.size()) {
+          throw TokenizerException("Unterminated string", 0, pos);
+        } else if (curr == '"') {
+          pos++;
+          state = State::END_TOKEN;
+        } else {
+          pos = Scan::stringEnd(line.data(), pos, line.size());
+        }
+        break;
+      case State::TOKEN:
+        if (pos >= line.size()) {
+          emit(start, pos - start);
+          state = State::START_TOKEN;
+        } else if (curr == ' ') {
+          emit(start, pos - start);
+          pos++;
+          state = State::START_TOKEN;
+        } else if (isNumericOp(curr) || curr == ',' || curr == ')') {
+          state = State::END_TOKEN;
+        } else if (isAlphaNumeric(curr) || curr == '.' || curr == '_' ||
+                   curr == '\\') {
+          pos = Scan::identifierEnd(line.data(), pos, line.size());
+        } else {
+          throw TokenizerException("Invalid token", 0, pos);
+        }
+        break;
+      case State::END_TOKEN:
+        emit(start, pos - start);
+        state = State::START_TOKEN;
+        break;
+      case State::END_LINE:
+        break;
+    }
+  }
+  tokens.push_back(TokenRecord{
+      TokenKind::NEWLINE, offset + static_cast<uint32_t>(line.size()), 0, 0});
+}
+
+TokenRecordList referenceTokenize(const SourceBuffer& source) {
+  TokenRecordList tokens{};
+  const char* data = source.data();
+  size_t size = source.size();
+  for (size_t pos = 0; pos < size;) {
+    size_t lineEnd = Scan::findNewline(data, pos, size);
+    referenceTokenizeLine(std::string_view{data + pos, lineEnd - pos},
+                          static_cast<uint32_t>(pos), tokens);
+    pos = lineEnd + 1;
+  }
+  tokens.push_back(
+      TokenRecord{TokenKind::END, static_cast<uint32_t>(size), 0, 0});
+  return tokens;
+}
+
+/**
+ * Best wall time over a few runs of tokenizing source with the reference
+ * state machine, in seconds.
+ */
+double timeReferenceTokenize(const SourceBuffer& source, size_t& tokenCount) {
+  double best = 1e9;
+  for (int run = 0; run < 5; run++) {
+    auto start = Clock::now();
+    auto tokens = referenceTokenize(source);
+    std::chrono::duration<double> elapsed = Clock::now() - start;
+    best = std::min(best, elapsed.count());
+    tokenCount = tokens.size();
+  }
+  return best;
+}
+
+/**
+ * Best wall time over a few runs of tokenizing source on threads threads, in
+ * seconds.
+ */
+double timeTokenizeParallel(const SourceBuffer& source, unsigned threads) {
+  Tokenizer tokenizer{};
+  double best = 1e9;
+  for (int run = 0; run < 5; run++) {
+    auto start = Clock::now();
+    auto tokens = tokenizer.tokenize(source, threads);
+    std::chrono::duration<double> elapsed = Clock::now() - start;
+    best = std::min(best, elapsed.count());
+  }
+  return best;
+}
+
+std::vector<Scan::Isa> supportedIsas() {
+  std::vector<Scan::Isa> isas{Scan::Isa::SCALAR};
+  auto best = Scan::detect();
+  if (best == Scan::Isa::SSE2 || best == Scan::Isa::AVX2) {
+    isas.push_back(Scan::Isa::SSE2);
+  }
+  if (best == Scan::Isa::AVX2) {
+    isas.push_back(Scan::Isa::AVX2);
+  }
+  return isas;
+}
+
+void report(const std::string& name,
+            const std::vector<const SourceBuffer*>& sources) {
+  size_t bytes = 0;
+  for (auto source : sources) {
+    bytes += source->size();
+  }
+
+  double baseline = 0;
+  for (auto isa : supportedIsas()) {
+    Scan::select(isa);
+    double seconds = 0;
+    size_t tokens = 0;
+    for (auto source : sources) {
+      size_t count = 0;
+      seconds += timeTokenize(*source, count);
+      tokens += count;
+    }
+    if (isa == Scan::Isa::SCALAR) {
+      baseline = seconds;
+    }
+    std::cout << std::left << std::setw(12) << name << std::setw(8)
+              << Scan::name(isa) << std::right << std::setw(12) << bytes
+              << " B " << std::setw(10) << tokens << " tokens "
+              << std::fixed << std::setprecision(3) << std::setw(10)
+              << seconds * 1e3 << " ms " << std::setw(9)
+              << bytes / seconds / (1024 * 1024) << " MiB/s "
+              << std::setprecision(2) << baseline / seconds << "x"
+              << std::endl;
+  }
+  Scan::select(Scan::detect());
+}
+
+void reportLexers(const std::string& name,
+                  const std::vector<const SourceBuffer*>& sources) {
+  size_t bytes = 0;
+  for (auto source : sources) {
+    bytes += source->size();
+  }
+
+  double baseline = 0;
+  for (bool table : {false, true}) {
+    double seconds = 0;
+    size_t tokens = 0;
+    for (auto source : sources) {
+      size_t count = 0;
+      seconds += table ? timeTokenize(*source, count)
+                       : timeReferenceTokenize(*source, count);
+      tokens += count;
+    }
+    if (!table) {
+      baseline = seconds;
+    }
+    std::cout << std::left << std::setw(12) << name << std::setw(8)
+              << (table ? "table" : "branch") << std::right << std::setw(12)
+              << bytes << " B " << std::setw(10) << tokens << " tokens "
+              << std::fixed << std::setprecision(3) << std::setw(10)
+              << seconds * 1e3 << " ms " << std::setw(9)
+              << bytes / seconds / (1024 * 1024) << " MiB/s "
+              << std::setprecision(2) << baseline / seconds << "x"
+              << std::endl;
+  }
+}
+
+/**
+ * A program of lines instructions.
+ */
+std::string programSource(int lines) {
+  std::string text{};
+  for (int i = 0; i < lines; i++) {
+    switch (i % 4) {
+      case 0:
+        text += "    ld a, b\n";
+        break;
+      case 1:
+        text += "    add a, " + std::to_string(i % 100) + " * 2\n";
+        break;
+      case 2:
+        text += "    inc hl\n";
+        break;
+      case 3:
+        text += "    sub a, c\n";
+        break;
+    }
+  }
+  return text;
+}
+
+void reportIncremental() {
+  std::string text = programSource(EDITED_LINES);
+
+  double full = 1e9;
+  for (int run = 0; run < 5; run++) {
+    auto start = Clock::now();
+    SourceBuffer source{text};
+    SourceTokenStream tokens{source};
+    Parser{tokens}.parse();
+    std::chrono::duration<double> elapsed = Clock::now() - start;
+    full = std::min(full, elapsed.count());
+  }
+
+  // Retype a digit, then add and remove a line, all around the middle
+  IncrementalParser parser{text};
+  uint32_t middle = static_cast<uint32_t>(text.find("add a, 1", text.size() / 2));
+  const int N_EDITS = 1000;
+  auto start = Clock::now();
+  for (int i = 0; i < N_EDITS; i++) {
+    parser.apply(Edit{middle + 7, 1, std::to_string(i % 10)});
+    parser.apply(Edit{middle, 0, "    nop\n"});
+    parser.apply(Edit{middle, 8, ""});
+  }
+  std::chrono::duration<double> elapsed = Clock::now() - start;
+  double incremental = elapsed.count() / (3 * N_EDITS);
+
+  std::cout << std::left << std::setw(12) << "edit" << std::setw(8) << "full"
+            << std::right << std::setw(12) << text.size() << " B "
+            << std::fixed << std::setprecision(3) << std::setw(10)
+            << full * 1e3 << " ms" << std::endl;
+  std::cout << std::left << std::setw(12) << "edit" << std::setw(8)
+            << "incr" << std::right << std::setw(12) << text.size() << " B "
+            << std::fixed << std::setprecision(3) << std::setw(10)
+            << incremental * 1e3 << " ms " << std::setprecision(2)
+            << full / incremental << "x" << std::endl;
+}
+
+/*
+ * Copy of Assembler::evaluate as it was before it used NodeRef: switch on
+ * id(), then dynamic_cast, with one arm per BinaryOpType.
+ */
+AST::BaseNode* referenceEvaluate(AST::BaseNode* node, AST::Arena& arena);
+
+template <typename Op>
+AST::BaseNode* referenceEvaluateBinaryOp(AST::BaseNode* node,
+                                         AST::Arena& arena,
+                                         uint8_t (*fold)(uint8_t, uint8_t)) {
+  using namespace AST;
+  auto op = dynamic_cast<Op*>(node);
+  auto vLeft = referenceEvaluate(op->left(), arena);
+  auto vRight = referenceEvaluate(op->right(), arena);
+  if (vLeft->id() == NodeType::NUMBER && vRight->id() == NodeType::NUMBER) {
+    auto lnum = dynamic_cast<Number*>(vLeft);
+    auto rnum = dynamic_cast<Number*>(vRight);
+    return arena.make<Number>(fold(lnum->value(), rnum->value()));
+  } else {
+    return arena.make<Op>(vLeft, vRight);
+  }
+}
+
+AST::BaseNode* referenceEvaluate(AST::BaseNode* node, AST::Arena& arena) {
+  using namespace AST;
+  switch (node->id()) {
+    case NodeType::INSTRUCTION: {
+      auto instr = dynamic_cast<BaseInstruction*>(node);
+      switch (instr->nOperands()) {
+        case 0:
+          return arena.make<Instruction0>(instr->type());
+        case 1: {
+          auto instr1 = dynamic_cast<Instruction1*>(instr);
+          return arena.make<Instruction1>(
+              instr1->type(), referenceEvaluate(instr1->operand(), arena));
+        }
+        default: {
+          auto instr2 = dynamic_cast<Instruction2*>(instr);
+          return arena.make<Instruction2>(
+              instr2->type(), referenceEvaluate(instr2->left(), arena),
+              referenceEvaluate(instr2->right(), arena));
+        }
+      }
+    }
+    case NodeType::REGISTER:
+      return arena.make<BaseRegister>(
+          dynamic_cast<BaseRegister*>(node)->reg());
+    case NodeType::DREGISTER: {
+      auto reg = dynamic_cast<BaseDRegister*>(node);
+      return arena.make<BaseDRegister>(reg->reg1(), reg->reg2());
+    }
+    case NodeType::LABEL:
+      return arena.make<Label>(dynamic_cast<Label*>(node)->name());
+    case NodeType::NUMBER:
+      return arena.make<Number>(dynamic_cast<Number*>(node)->value());
+    case NodeType::BINARY_OP:
+      switch (dynamic_cast<BaseBinaryOp*>(node)->opType()) {
+        case BinaryOpType::ADD:
+          return referenceEvaluateBinaryOp<AddOp>(
+              node, arena,
+              [](uint8_t l, uint8_t r) -> uint8_t { return l + r; });
+        case BinaryOpType::SUB:
+          return referenceEvaluateBinaryOp<SubOp>(
+              node, arena,
+              [](uint8_t l, uint8_t r) -> uint8_t { return l - r; });
+        case BinaryOpType::MULT:
+          return referenceEvaluateBinaryOp<MultOp>(
+              node, arena,
+              [](uint8_t l, uint8_t r) -> uint8_t { return l * r; });
+        default:
+          return referenceEvaluateBinaryOp<DivOp>(
+              node, arena,
+              [](uint8_t l, uint8_t r) -> uint8_t { return l / r; });
+      }
+    case NodeType::UNARY_OP: {
+      auto op = dynamic_cast<NegOp*>(node);
+      auto vRand = referenceEvaluate(op->operand(), arena);
+      if (vRand->id() == NodeType::NUMBER) {
+        return arena.make<Number>(-dynamic_cast<Number*>(vRand)->value());
+      }
+      return arena.make<NegOp>(vRand);
+    }
+    default:
+      throw AssemblerException("Unrecognized AST node type");
+  }
+}
+
+std::shared_ptr<AST::Root> referenceEvaluate(AST::Root& root) {
+  auto newRoot = std::make_shared<AST::Root>();
+  for (auto node : root) {
+    newRoot->add(referenceEvaluate(node, newRoot->arena()));
+  }
+  return newRoot;
+}
+
+/**
+ * Time evaluating each of roots with evaluate, in lines per second.
+ */
+template <typename Evaluate>
+double timeEvaluate(std::vector<std::shared_ptr<AST::Root>>& roots,
+                    Evaluate evaluate) {
+  size_t lines = 0;
+  auto start = Clock::now();
+  for (auto& root : roots) {
+    evaluate(*root);
+    lines += root->size();
+  }
+  std::chrono::duration<double> elapsed = Clock::now() - start;
+  return lines / elapsed.count();
+}
+
+void reportEvaluate() {
+  std::string text{};
+  for (int i = 0; i < EDITED_LINES; i++) {
+    switch (i % 3) {
+      case 0:
+        text += "    add a, 1 + " + std::to_string(i % 50) + " * 3 - -4 / 2\n";
+        break;
+      case 1:
+        text += "    ld hl, table + 2 * " + std::to_string(i % 50) + "\n";
+        break;
+      case 2:
+        text += "    ld bc, -8 * -1\n";
+        break;
+    }
+  }
+  SourceBuffer source{text};
+  // Evaluating in place changes the tree, so each run gets one of its own
+  const int RUNS = 20;
+  std::vector<std::shared_ptr<AST::Root>> roots;
+  for (int run = 0; run < RUNS; run++) {
+    SourceTokenStream tokens{source};
+    roots.push_back(Parser{tokens}.parse());
+  }
+
+  double baseline = 0;
+  for (auto variant : {"copy", "inplace", "again"}) {
+    double rate = std::string{variant} == "copy"
+                      ? timeEvaluate(roots, [](AST::Root& r) {
+                          return referenceEvaluate(r);
+                        })
+                      : timeEvaluate(roots, [](AST::Root& r) {
+                          return Assembler::evaluate(r);
+                        });
+    if (baseline == 0) {
+      baseline = rate;
+    }
+    std::cout << std::left << std::setw(12) << "evaluate" << std::setw(8)
+              << variant << std::right << std::fixed << std::setprecision(3)
+              << std::setw(12) << rate / 1e6 << " Mlines/s "
+              << std::setprecision(2) << rate / baseline << "x" << std::endl;
+  }
+}
+
+/**
+ * Time assembling source, the best of several runs.
+ */
+template <typename Assemble>
+double timeAssemble(const SourceBuffer& source, Assemble assemble) {
+  double best = 1e9;
+  for (int run = 0; run < 10; run++) {
+    auto start = Clock::now();
+    SourceTokenStream tokens{source};
+    GBAS::ELF elf{};
+    assemble(tokens, elf);
+    std::chrono::duration<double> elapsed = Clock::now() - start;
+    best = std::min(best, elapsed.count());
+  }
+  return best;
+}
+
+void reportAssemble() {
+  std::string text{".section text\n"};
+  for (int i = 0; i < 10 * EDITED_LINES; i++) {
+    switch (i % 6) {
+      case 0:
+        text += "    inc a\n";
+        break;
+      case 1:
+        text += "    dec bc\n";
+        break;
+      case 2:
+        text += "    push hl\n";
+        break;
+      case 3:
+        text += "    cp b\n";
+        break;
+      case 4:
+        text += "    nop\n";
+        break;
+      case 5:
+        text += "    pop de\n";
+        break;
+    }
+  }
+  SourceBuffer source{text};
+
+  double tree = timeAssemble(source, [](TokenStream& tokens, GBAS::ELF& elf) {
+    Assembler{}.assemble(Parser{tokens}.parse(), elf);
+  });
+  double fused = timeAssemble(source, [](TokenStream& tokens, GBAS::ELF& elf) {
+    Assembler assembler{};
+    Parser{tokens}.parseInto(assembler, elf);
+  });
+
+  for (auto [variant, seconds] : {std::pair{"tree", tree}, std::pair{"fused", fused}}) {
+    std::cout << std::left << std::setw(12) << "assemble" << std::setw(8)
+              << variant << std::right << std::setw(12) << text.size()
+              << " B " << std::fixed << std::setprecision(3) << std::setw(10)
+              << seconds * 1e3 << " ms " << std::setprecision(2)
+              << tree / seconds << "x" << std::endl;
+  }
+}
+
+void reportExpressions() {
+  std::string text{};
+  for (int i = 0; i < 10 * EDITED_LINES; i++) {
+    switch (i % 3) {
+      case 0:
+        text += "    ld hl, table + 2 * " + std::to_string(i % 64) + "\n";
+        break;
+      case 1:
+        text += "    ld bc, end - start\n";
+        break;
+      case 2:
+        text += "    ld de, (end - start) * 2 + table\n";
+        break;
+    }
+  }
+  SourceBuffer source{text};
+  SourceTokenStream tokens{source};
+  auto root = Parser{tokens}.parse();
+  auto program = Assembler::lower(root);
+
+  auto resolve = [&](uint32_t name) -> std::optional<int32_t> {
+    return static_cast<int32_t>(0x100 * (name + 1));
+  };
+  std::vector<uint32_t> expressions{};
+  for (size_t i = 0; i < program.size(); i++) {
+    expressions.push_back(program.operands[1][i]);
+  }
+
+  double baseline = 0;
+  for (auto variant : {"each", "shared"}) {
+    double best = 1e9;
+    for (int run = 0; run < 10; run++) {
+      auto start = Clock::now();
+      if (std::string{variant} == "each") {
+        for (auto expression : expressions) {
+          Assembler::evaluateExpression(program, expression, resolve);
+        }
+      } else {
+        ExpressionEvaluator evaluator{program, resolve};
+        for (auto expression : expressions) {
+          evaluator.value(expression);
+        }
+      }
+      std::chrono::duration<double> elapsed = Clock::now() - start;
+      best = std::min(best, elapsed.count());
+    }
+    if (baseline == 0) {
+      baseline = best;
+    }
+    std::cout << std::left << std::setw(12) << "expression" << std::setw(8)
+              << variant << std::right << std::setw(12) << expressions.size()
+              << " ops " << std::fixed << std::setprecision(3)
+              << std::setw(10) << best * 1e3 << " ms "
+              << std::setprecision(2) << baseline / best << "x" << std::endl;
+  }
+  std::cout << std::left << std::setw(20) << "expression nodes" << std::right
+            << std::setw(12) << root->arena().size() << " ast "
+            << std::setw(10) << program.expressions.size() << " dag"
+            << std::endl;
+}
+
+void reportScaling(const SourceBuffer& source, unsigned maxThreads) {
+  double baseline = 0;
+  for (unsigned threads = 1; threads <= maxThreads; threads++) {
+    double seconds = timeTokenizeParallel(source, threads);
+    if (threads == 1) {
+      baseline = seconds;
+    }
+    std::cout << std::left << std::setw(12) << "threads" << std::setw(8)
+              << threads << std::right << std::setw(12) << source.size()
+              << " B " << std::fixed << std::setprecision(3) << std::setw(10)
+              << seconds * 1e3 << " ms " << std::setw(9)
+              << source.size() / seconds / (1024 * 1024) << " MiB/s "
+              << std::setprecision(2) << baseline / seconds << "x"
+              << std::endl;
+  }
+}
+
+}  // namespace
+
+int main(int argc, char* argv[]) {
+  std::string corpusDir = argc > 1 ? argv[1] : "test/data";
+  unsigned maxThreads = argc > 2 ? std::stoul(argv[2])
+                                 : std::thread::hardware_concurrency();
+  maxThreads = std::max(1u, maxThreads);
+
+  std::vector<SourceBuffer> corpus{};
+  try {
+    for (auto& entry : std::filesystem::directory_iterator{corpusDir}) {
+      if (entry.path().extension() == ".asm") {
+        corpus.push_back(SourceBuffer::map(entry.path().string()));
+      }
+    }
+  } catch (std::filesystem::filesystem_error& e) {
+    std::cerr << e.what() << std::endl;
+    return -1;
+  } catch (SourceBufferException& e) {
+    std::cerr << e.what() << std::endl;
+    return -1;
+  }
+
+  std::vector<const SourceBuffer*> corpusSources{};
+  for (auto& source : corpus) {
+    corpusSources.push_back(&source);
+  }
+
+  try {
+    report("corpus", corpusSources);
+    SourceBuffer synthetic{syntheticSource(SYNTHETIC_SIZE)};
+    report("synthetic", {&synthetic});
+    reportLexers("corpus", corpusSources);
+    reportLexers("synthetic", {&synthetic});
+    reportIncremental();
+    reportEvaluate();
+    reportExpressions();
+    reportAssemble();
+    reportScaling(synthetic, maxThreads);
+  } catch (TokenizerException& e) {
+    std::cerr << e.what() << std::endl;
+    return -1;
+  } catch (ParserException& e) {
+    std::cerr << e.what() << std::endl;
+    return -1;
+  } catch (AssemblerException& e) {
+    std::cerr << e.what() << std::endl;
+    return -1;
+  }
+
+  return 0;
+}
@@ -1,82 +1,131 @@
 
 
+#include <array>
 #include <fstream>
+#include <functional>
+#include <optional>
 
 #include "parser.hpp"
 #include "elf.hpp"
+#include "ir.hpp"
+#include "opcodes.hpp"
 
 class AssemblerException : std::exception {
  public:
-  AssemblerException(const char* msg) { mMsg = msg; }
+  AssemblerException(const char* msg)
+      : mMsg{msg}, mOffset{SourceBuffer::NO_OFFSET} {}
 
-  AssemblerException(const std::string& msg) { mMsg = msg; }
+  AssemblerException(const std::string& msg)
+      : mMsg{msg}, mOffset{SourceBuffer::NO_OFFSET} {}
+
+  AssemblerException(const std::string& msg, uint32_t offset)
+      : mMsg{msg}, mOffset{offset} {}
 
   virtual const char* what() const noexcept { return mMsg.c_str(); }
 
+  /**
+   * Source offset of the offending node, or SourceBuffer::NO_OFFSET if it is
+   * not known.
+   */
+  uint32_t offset() const { return mOffset; }
+
  private:
   std::string mMsg;
+  uint32_t mOffset;
+};
+
+/**
+ * Machine code of a single instruction. No SM83 instruction is longer than
+ * three bytes, so the bytes are kept inline and encoding allocates nothing.
+ */
+struct EncodedInstruction {
+  static constexpr size_t MAX_LENGTH = 3;
+
+  std::array<uint8_t, MAX_LENGTH> bytes{};
+  uint8_t length = 0;
+  /**
+   * Offset in bytes of the operand whose value is not known yet, which is
+   * left as zeros, or 0 if every operand is encoded.
+   */
+  uint8_t pendingAt = 0;
+  /**
+   * Which operand of its line the pending operand is.
+   */
+  uint8_t pendingOperand = 0;
+  /**
+   * How the pending operand is encoded, like Operand::IMM16.
+   */
+  GBAS::Operand pendingField = GBAS::Operand::NONE;
+
+  void push_back(uint8_t byte) { bytes[length++] = byte; }
+
+  uint8_t& back() { return bytes[length - 1]; }
+
+  const uint8_t* data() const { return bytes.data(); }
+
+  size_t size() const { return length; }
 };
 
-struct InstructionNone {
-  InstructionNone(AST::InstructionType typ) : typ{typ} { }
-
-  constexpr uint8_t encode() {
-    using namespace AST;
-    uint8_t opcode = 0;
-    switch (typ) {
-      case InstructionType::NOP:
-        opcode = 0x00;
-        break;
-      case InstructionType::STOP:
-        opcode = 0x10;
-        break;
-      case InstructionType::RLCA:
-        opcode = 0x07;
-        break;
-      case InstructionType::RLA:
-        opcode = 0x17;
-        break;
-      case InstructionType::DAA:
-        opcode = 0x27;
-        break;
-      case InstructionType::SCF:
-        opcode = 0x37;
-        break;
-      case InstructionType::RRCA:
-        opcode = 0x0f;
-        break;
-      case InstructionType::RRA:
-        opcode = 0x1f;
-        break;
-      case InstructionType::CPL:
-        opcode = 0x2f;
-        break;
-      case InstructionType::CCF:
-        opcode = 0x3f;
-        break;
-      case InstructionType::HALT:
-        opcode = 0x76;
-        break;
-      case InstructionType::DI:
-        opcode = 0xf3;
-        break;
-      case InstructionType::RET:
-        opcode = 0xc9;
-        break;
-      case InstructionType::RETI:
-        opcode = 0xd9;
-        break;
-      case InstructionType::EI:
-        opcode = 0xfb;
-        break;
-      default:
-        throw AssemblerException{"Unrecognized instruction"};
-        break;
-    }
-    return opcode;
-  }
-
-  AST::InstructionType typ;
+/**
+ * An operand which was encoded as zeros because it depends on a label which
+ * may not be defined yet. Fixups are patched once the whole unit is
+ * assembled; see Assembler::resolve().
+ */
+struct Fixup {
+  /**
+   * Index of the section of the operand in the ELF.
+   */
+  uint32_t section;
+  /**
+   * Offset of the operand in its section.
+   */
+  uint32_t offset;
+  /**
+   * Index of the name of a LABEL operand, or else the id of the node of its
+   * expression.
+   */
+  uint32_t value;
+  /**
+   * Source offset of the instruction, where errors are reported.
+   */
+  uint32_t line;
+  IR::OperandKind kind;
+  /**
+   * How the value is encoded, like Operand::IMM16 or Operand::REL8.
+   */
+  GBAS::Operand field;
+};
+
+/**
+ * Evaluates the expressions of an IR::Program. Each node of their DAG is
+ * evaluated at most once: its value is kept as soon as the labels which it
+ * depends on are resolved, and is shared by every expression containing it.
+ */
+class ExpressionEvaluator {
+ public:
+  /**
+   * Value of the label whose name has the given index in names, or
+   * std::nullopt if it is not known yet.
+   */
+  using Resolver = std::function<std::optional<int32_t>(uint32_t)>;
+
+  explicit ExpressionEvaluator(const IR::Program& program,
+                               Resolver resolve = {});
+
+  /**
+   * Value of the expression whose node has the given id.
+   *
+   * @returns the value, or std::nullopt if it depends on a label which is not
+   *   known.
+   * @throws AssemblerException upon division by zero.
+   */
+  std::optional<int32_t> value(uint32_t node);
+
+ private:
+  const IR::Program& mProgram;
+  Resolver mResolve;
+  std::vector<int32_t> mValues;
+  std::vector<bool> mKnown;
 };
 
 /**
@@ -88,10 +137,11 @@ class Assembler {
   explicit Assembler();
 
   /**
-   * Parse the AST and put the generated code and symbols into the provided ELF.
-   * This function does not write the ELF object to a file.
+   * Lower the AST and put the generated code and symbols into the provided
+   * ELF, then resolve every fixup. This function does not write the ELF
+   * object to a file.
    *
-   * @param ast: AST root node that will be walked.
+   * @param ast: AST root node that will be lowered.
    * @param elf: ELF object that will be modified to store generated code and
    *   symbols.
    *
@@ -100,101 +150,147 @@ class Assembler {
   void assemble(std::shared_ptr<AST::Root> ast, GBAS::ELF& elf);
 
   /**
-   * Helper function to dispatch and generate code for Instruction nodes.
+   * Put the generated code and symbols of program into the provided ELF.
+   * Operands which depend on labels are recorded as fixups, to be patched by
+   * resolve().
    *
-   * @param elf: ELF object containing the "text" section where generated code
-   *   will be added.
-   * @param instr: BaseInstruction that this function will dispatch and
-   *   generate code for.
+   * @throws AssemblerException upon invalid input, with the offset of the
+   *   offending line.
+   */
+  void assemble(const IR::Program& program, GBAS::ELF& elf);
+
+  /**
+   * Patch every operand which was left for a fixup by assemble(), once the
+   * labels of the whole unit are defined. The fixups are sorted by position,
+   * so that each section is patched in one sweep from front to back.
    *
-   * @throws AssemblerException upon invalid instruction input.
+   * @param program: The program, or the last lines of it, that was
+   *   assembled; its expressions must still hold those of every fixup.
+   *
+   * @throws AssemblerException upon an undefined label, or a value which does
+   *   not fit its operand, with the offset of the offending line.
    */
-  void assembleInstruction(GBAS::ELF& elf, AST::BaseInstruction& instr);
+  void resolve(const IR::Program& program, GBAS::ELF& elf);
 
   /**
-   * Helper function for assembling instructions with no arguments.
-   * 
-   * @param instr0: Instruction0 node.
-   * 
-   * @returns Vector of bytes representing encoded instruction.
+   * Lower the AST to a flat IR::Program. Registers, numbers and labels become
+   * operand values of their instruction; any other operand is kept as an
+   * expression.
    *
-   * @throws AssemblerException upon invalid instruction parameter.
+   * @throws AssemblerException upon a node which has no place in a program.
    */
-  static std::vector<uint8_t> instructionNone(AST::Instruction0& instr0);
+  static IR::Program lower(std::shared_ptr<AST::Root> ast);
 
   /**
-   * Helper function for assembling instructions with one argument, a register.
-   * 
-   * @param instr1: Instruction1 node.
-   * @param reg: Register node--the operand.
-   * 
-   * @returns Vector of bytes representing encoded instruction.
+   * Lower a single line of a program, appending it to program. The nodes of
+   * any expression operands must outlive program.
    *
-   * @throws AssemblerException upon invalid instruction parameter.
+   * @throws AssemblerException upon a node which has no place in a program,
+   *   with the offset of node.
    */
-  static std::vector<uint8_t> instructionR(AST::Instruction1& instr1, const AST::BaseRegister& reg);
+  static void lower(IR::Program& program, AST::BaseNode* node);
 
   /**
-   * Helper function for assembling instructions with one argument, a register.
-   * Instructions dispatched to this function operate on the provided register
-   * as well as the accumulator register.
-   * 
-   * @param instr1: Instruction1 node.
-   * @param reg: Register node--the operand.
-   * 
-   * @returns Vector of bytes representing encoded instruction.
+   * Evaluate an expression of program once; see ExpressionEvaluator, which
+   * keeps the values of the expressions which it evaluates.
    *
-   * @throws AssemblerException upon invalid instruction parameter.
+   * @param expression: Id of the node of the expression.
+   *
+   * @returns the value, or std::nullopt if it depends on a label which is not
+   *   known.
+   * @throws AssemblerException upon division by zero.
    */
-  static std::vector<uint8_t> instructionRA(AST::Instruction1& instr1, const AST::BaseRegister& reg);
+  static std::optional<int32_t> evaluateExpression(
+      const IR::Program& program, uint32_t expression,
+      const ExpressionEvaluator::Resolver& resolve = {});
 
   /**
-   * Helper function for assembling instructions with one argument, a
-   * double-register.
-   * 
-   * @param instr1: Instruction1 node.
-   * @param reg: DRegister node--the operand.
-   * 
-   * @returns Vector of bytes representing encoded instruction.
+   * Helper function to dispatch and generate code for the instruction on line
+   * i of program.
+   *
+   * @param elf: ELF object containing the "text" section where generated code
+   *   will be added.
    *
-   * @throws AssemblerException upon invalid instruction parameter.
+   * @throws AssemblerException upon invalid instruction input.
+   */
+  void assembleInstruction(GBAS::ELF& elf, const IR::Program& program,
+                           size_t i);
+
+  /**
+   * Encode the instruction on line i of program. An immediate which is not a
+   * constant is left as zeros, and marked pending in the result.
+   *
+   * @throws AssemblerException upon invalid operands, or a bit index or
+   *   restart vector which is not a constant.
+   */
+  static EncodedInstruction encodeInstruction(const IR::Program& program,
+                                              size_t i);
+
+  /**
+   * Evaluate every node below root, recursively, replacing the children of
+   * root with their evaluated nodes. Evaluating a tree which is already
+   * evaluated allocates nothing.
+   *
+   * @throws AssemblerException if any child is invalid.
    */
-  static std::vector<uint8_t> instructionD(AST::Instruction1& instr1, const AST::BaseDRegister& reg);
+  static void evaluate(AST::Root& root);
 
   /**
-   * Given any type of node, evaluate it and its descendents, recursively.
+   * Given any type of node below a Root, evaluate it and its descendents,
+   * recursively. Nodes are never modified: a node whose descendents change is
+   * copied, and any other node is kept as it is. The result is marked
+   * folded(), so that it is not walked again.
    *
-   * @returns a deep copy of the optimized node.
+   * @returns the optimized node, either node itself or one made in arena.
    * @throws AssemblerException if any child is invalid.
    */
-  static std::shared_ptr<AST::BaseNode> evaluate(
-      std::shared_ptr<AST::BaseNode>);
+  static AST::BaseNode* evaluate(AST::BaseNode* node, AST::Arena& arena);
 
   /**
    * Given a BaseInstruction node, evaluate its operands.
    *
-   * @returns a deep copy with child nodes optimized.
+   * @returns node if no operand changed, or else a copy with the optimized
+   *   operands, made in arena.
    * @throws AssemblerException if any child is invalid.
    */
-  static std::shared_ptr<AST::BaseInstruction> evaluateInstruction(
-      std::shared_ptr<AST::BaseInstruction> node);
+  static AST::BaseInstruction* evaluateInstruction(AST::BaseInstruction* node,
+                                                   AST::Arena& arena);
 
   /**
    * Given a BaseBinaryOp node, evaluate it and its children where possible.
    *
-   * @returns a deep copy of the optimized node.
+   * @returns node if nothing could be evaluated, or else the optimized node,
+   *   made in arena.
    * @throws AssemblerException if any child is invalid.
    */
-  static std::shared_ptr<AST::BaseNode> evaluateBinaryOp(
-      std::shared_ptr<AST::BaseBinaryOp> node);
+  static AST::BaseNode* evaluateBinaryOp(AST::BaseBinaryOp* node,
+                                         AST::Arena& arena);
 
   /**
    * Given a BaseUnaryOp node, evaluate it and its children where possible.
    *
-   * @returns a deep copy of the optimized node.
+   * @returns node if nothing could be evaluated, or else the optimized node,
+   *   made in arena.
    * @throws AssemblerException if any child is invalid.
    */
-  static std::shared_ptr<AST::BaseNode> evaluateUnaryOp(
-      std::shared_ptr<AST::BaseUnaryOp> node);
+  static AST::BaseNode* evaluateUnaryOp(AST::BaseUnaryOp* node,
+                                        AST::Arena& arena);
+
+ private:
+  static constexpr uint32_t NO_SECTION = UINT32_MAX;
+
+  /**
+   * Where a label was defined.
+   */
+  struct LabelLocation {
+    uint32_t section = NO_SECTION;
+    uint32_t value = 0;
+  };
+
+  /**
+   * Location of each label, by the index of its name.
+   */
+  std::vector<LabelLocation> mLabels;
+  std::vector<Fixup> mFixups;
 };
 
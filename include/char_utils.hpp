@@ -3,6 +3,8 @@
 #define CHAR_UTILS_HPP
 
 #include <algorithm>
+#include <cstdint>
+#include <string>
 
 namespace GBAS {
 
@@ -18,6 +20,24 @@ constexpr bool isAlphaNumeric(char c) {
   return isAlpha(c) || isDigit(c);
 }
 
+constexpr bool isHexDigit(char c) {
+  return isDigit(c) || ((c >= 'A') && (c <= 'F')) || ((c >= 'a') && (c <= 'f'));
+}
+
+/**
+ * Value of the hexadecimal digit c, which also covers decimal and binary
+ * digits.
+ */
+constexpr uint32_t digitValue(char c) {
+  if (isDigit(c)) {
+    return c - '0';
+  } else if (c >= 'a') {
+    return c - 'a' + 10;
+  } else {
+    return c - 'A' + 10;
+  }
+}
+
 static inline bool isNumber(const std::string tok) {
   if (tok.size() == 0) {
     return false;
@@ -35,6 +55,15 @@ constexpr bool isNumericOp(char c) {
   return c == '+' || c == '-' || c == '*' || c == '/';
 }
 
+/**
+ * True for the characters of the other operators, except %, which also
+ * starts binary numbers.
+ */
+constexpr bool isOperatorChar(char c) {
+  return c == '<' || c == '>' || c == '=' || c == '!' || c == '&' ||
+         c == '|' || c == '^' || c == '~';
+}
+
 static inline bool isMaybeSection(const std::string& tok) {
   if (tok.size() == 0) {
     return false;
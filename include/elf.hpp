@@ -318,7 +318,7 @@ class ELF {
   /**
    * Add some data to a PROGBITS section.
    */
-  void add_progbits(std::vector<uint8_t> data);
+  void add_progbits(const std::vector<uint8_t>& data);
 
   /**
    * Add some data to a PROGBITS section.
@@ -326,7 +326,31 @@ class ELF {
    * @param pData: Pointer to bytes that will be copied.
    * @param n: How many bytes will be copied.
    */
-  void add_progbits(uint8_t* pData, size_t n);
+  void add_progbits(const uint8_t* pData, size_t n);
+
+  /**
+   * Offset in the current PROGBITS section at which the next data will be
+   * added: the location counter. It is the size of the section, so it costs
+   * the same however large the section is.
+   */
+  uint32_t location();
+
+  /**
+   * Whether the current section holds code rather than data.
+   */
+  bool executable();
+
+  /**
+   * Index of the current section.
+   */
+  uint32_t section_index() const { return curr_section_; }
+
+  /**
+   * Data of the PROGBITS section at index, to patch in place.
+   *
+   * @throws ELFException if it is not a PROGBITS section.
+   */
+  std::vector<uint8_t>& progbits(uint32_t index);
 
   /**
    * Change the current section.
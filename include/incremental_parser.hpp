@@ -0,0 +1,140 @@
+
+#ifndef INCREMENTAL_PARSER_HPP
+#define INCREMENTAL_PARSER_HPP
+
+#include <memory>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include "parser.hpp"
+#include "tokenizer.hpp"
+
+/**
+ * A change to a source: the length bytes at offset are replaced by
+ * replacement.
+ */
+struct Edit {
+  uint32_t offset;
+  uint32_t length;
+  std::string replacement;
+};
+
+/**
+ * Tokens and AST of a source which is edited in place, as in an editor.
+ *
+ * Tokens never cross lines, so an edit only needs the lines it touches to be
+ * tokenized and parsed again. The nodes parsed from them are spliced into the
+ * Root in place of the old ones; everything else is kept as it is, apart from
+ * moving the offsets of later nodes by the change in length.
+ *
+ * Replaced nodes stay in the Arena of the Root until they outnumber the live
+ * ones. Then every line is parsed again, from its tokens, into a fresh arena,
+ * and so the nodes of all lines are replaced.
+ *
+ * After every edit, tokens() and root() are the same as tokenizing and
+ * parsing text() from scratch would give.
+ */
+class IncrementalParser {
+ public:
+  /**
+   * Tokenize and parse text.
+   *
+   * @throws TokenizerException or ParserException upon invalid input.
+   */
+  explicit IncrementalParser(std::string text);
+
+  /**
+   * Apply edit to the text, and bring the tokens and AST up to date.
+   *
+   * @throws TokenizerException or ParserException if the edited text is
+   *   invalid, or ParserException if the edit is out of range. The offsets
+   *   and line numbers of errors refer to the edited text. Nothing is changed
+   *   when an exception is thrown.
+   */
+  void apply(const Edit& edit);
+
+  const std::string& text() const { return mText; }
+
+  /**
+   * AST of text(). The same Root is updated by every edit.
+   */
+  std::shared_ptr<AST::Root> root() const { return mRoot; }
+
+  /**
+   * Tokens of text(), as Tokenizer::tokenize would produce them. These are
+   * assembled from the tokens of each line, so this takes time proportional
+   * to the length of the text.
+   */
+  TokenRecordList tokens() const;
+
+  size_t lines() const { return mLines.size(); }
+
+ private:
+  /**
+   * Tokens of a line, with offsets relative to the start of the line, the
+   * number of top-level nodes parsed from it, and the number of nodes made for them.
+   */
+  struct Line {
+    TokenRecordList tokens;
+    size_t nNodes;
+    size_t nMade;
+  };
+
+  /**
+   * Fewest dead nodes worth compacting the arena for.
+   */
+  static constexpr size_t MIN_COMPACT = 1024;
+
+  /**
+   * Tokenize and parse the lines of text, which starts at offset in the
+   * source and is line lineno, into the arena of root. Each newline in text
+   * starts a new line, so an empty text is one empty line.
+   */
+  void parseLines(std::string_view text, uint32_t offset, int lineno,
+                  const std::shared_ptr<AST::Root>& root,
+                  std::vector<Line>& lines,
+                  std::vector<uint32_t>& starts,
+                  std::vector<AST::BaseNode*>& nodes);
+
+  /**
+   * Parse the tokens of line, whose text is at offset in the source, making
+   * its nodes in the arena of root. The nodes are added to nodes, not to
+   * root.
+   */
+  void parseLine(std::string_view text, uint32_t offset,
+                 const std::shared_ptr<AST::Root>& root, Line& line,
+                 std::vector<AST::BaseNode*>& nodes);
+
+  /**
+   * Parse all lines again into a fresh arena, dropping the nodes of replaced
+   * lines.
+   */
+  void compact();
+
+  /**
+   * Index of the line which contains offset.
+   */
+  size_t lineAt(uint32_t offset) const;
+
+  /**
+   * Offset of the end of line i, not including its newline.
+   */
+  uint32_t lineEnd(size_t i) const;
+
+  Tokenizer mTokenizer;
+  std::string mText;
+  /**
+   * Lines of mText, split at every newline. When the text ends with a newline
+   * (or is empty) the last line is empty.
+   */
+  std::vector<Line> mLines;
+  std::vector<uint32_t> mLineStarts;
+  std::shared_ptr<AST::Root> mRoot;
+  /**
+   * Number of nodes in the arena of mRoot which are part of the tree.
+   */
+  size_t mLive;
+};
+
+#endif  // INCREMENTAL_PARSER_HPP
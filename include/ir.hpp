@@ -0,0 +1,270 @@
+
+#ifndef IR_HPP
+#define IR_HPP
+
+#include <array>
+#include <memory>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "parser.hpp"
+
+namespace IR {
+
+enum class LineKind : uint8_t {
+  INSTRUCTION,
+  LABEL,
+  SECTION,
+};
+
+/**
+ * What the operand value of an instruction holds.
+ */
+enum class OperandKind : uint8_t {
+  /** No operand. */
+  NONE,
+  /** The name of a register, like 'a'. */
+  REGISTER,
+  /** The names of both halves of a double register, first << 8 | second. */
+  DREGISTER,
+  /** The value of a number, an int32_t. */
+  NUMBER,
+  /** Index of the name of a label in names. */
+  LABEL,
+  /** Id of the node of an expression in expressions. */
+  EXPRESSION,
+  /** The index of a condition, an AST::ConditionType. */
+  CONDITION,
+  /**
+   * A register in parentheses, as for REGISTER or DREGISTER, with '+' or '-'
+   * << 16 for (hl+) and (hl-).
+   */
+  POINTER,
+  /** Id of the node of an address in parentheses in expressions. */
+  ADDRESS,
+  /** Id of the node of the offset of sp+e8 in expressions. */
+  STACK_OFFSET,
+};
+
+/**
+ * Operation of a node of an ExpressionDag.
+ */
+enum class Op : uint8_t {
+  /** A constant, whose first operand is the bits of an int32_t. */
+  NUMBER,
+  /**
+   * The value of the label whose name has the index in names given by the
+   * first operand.
+   */
+  LABEL,
+
+  // One per AST::UnaryOpType, in the same order
+  NEG,
+  NOT,
+  LNOT,
+
+  // One per AST::BinaryOpType, in the same order
+  ADD,
+  SUB,
+  MULT,
+  DIV,
+  MOD,
+  SHL,
+  SHR,
+  AND,
+  OR,
+  XOR,
+  EQ,
+  NE,
+  LT,
+  GT,
+  LE,
+  GE,
+  LAND,
+  LOR,
+};
+
+constexpr Op unaryOp(AST::UnaryOpType type) {
+  return static_cast<Op>(static_cast<uint8_t>(Op::NEG) +
+                         static_cast<uint8_t>(type));
+}
+
+constexpr Op binaryOp(AST::BinaryOpType type) {
+  return static_cast<Op>(static_cast<uint8_t>(Op::ADD) +
+                         static_cast<uint8_t>(type));
+}
+
+/**
+ * Operator of a unary operation, from NEG to LNOT.
+ */
+constexpr AST::UnaryOpType unaryOpType(Op op) {
+  return static_cast<AST::UnaryOpType>(static_cast<uint8_t>(op) -
+                                       static_cast<uint8_t>(Op::NEG));
+}
+
+/**
+ * Operator of a binary operation, from ADD to LOR.
+ */
+constexpr AST::BinaryOpType binaryOpType(Op op) {
+  return static_cast<AST::BinaryOpType>(static_cast<uint8_t>(op) -
+                                        static_cast<uint8_t>(Op::ADD));
+}
+
+static_assert(unaryOp(AST::UnaryOpType::LNOT) == Op::LNOT);
+static_assert(binaryOp(AST::BinaryOpType::LOR) == Op::LOR);
+static_assert(binaryOpType(Op::SHL) == AST::BinaryOpType::SHL);
+
+/**
+ * Expressions of a program, hash-consed into a DAG: there is a single node
+ * per distinct subexpression, which every expression containing it shares.
+ * The operands of an operation are ids of other nodes, which are always
+ * smaller than its own.
+ */
+class ExpressionDag {
+ public:
+  /**
+   * Id of the node op(left, right), adding it if there is none yet. Operands
+   * which op does not use must be 0.
+   */
+  uint32_t add(Op op, uint32_t left, uint32_t right = 0) {
+    auto [it, added] = mIds.try_emplace(Key{op, left, right},
+                                        static_cast<uint32_t>(mOps.size()));
+    if (added) {
+      mOps.push_back(op);
+      mOperands[0].push_back(left);
+      mOperands[1].push_back(right);
+    }
+    return it->second;
+  }
+
+  Op op(uint32_t node) const { return mOps[node]; }
+
+  uint32_t left(uint32_t node) const { return mOperands[0][node]; }
+
+  uint32_t right(uint32_t node) const { return mOperands[1][node]; }
+
+  size_t size() const { return mOps.size(); }
+
+ private:
+  struct Key {
+    Op op;
+    uint32_t left, right;
+
+    bool operator==(const Key& other) const {
+      return op == other.op && left == other.left && right == other.right;
+    }
+  };
+
+  struct KeyHash {
+    size_t operator()(const Key& key) const {
+      uint64_t bits = static_cast<uint64_t>(key.left) << 32 | key.right;
+      return std::hash<uint64_t>{}(bits * 31 + static_cast<uint8_t>(key.op));
+    }
+  };
+
+  std::vector<Op> mOps;
+  std::array<std::vector<uint32_t>, 2> mOperands;
+  std::unordered_map<Key, uint32_t, KeyHash> mIds;
+};
+
+/**
+ * A program lowered from its AST into flat, parallel arrays, with one entry
+ * per line. Passes over the program, like the encoder, loop over the arrays
+ * instead of walking the tree, and need neither virtual calls nor RTTI to
+ * tell what an entry is.
+ */
+struct Program {
+  static constexpr size_t MAX_OPERANDS = 2;
+
+  std::vector<LineKind> kinds;
+  /**
+   * Instruction of each INSTRUCTION line. Other lines have
+   * InstructionType::INVALID.
+   */
+  std::vector<AST::InstructionType> types;
+  /**
+   * Kinds of the first and second operands of each line.
+   */
+  std::array<std::vector<OperandKind>, MAX_OPERANDS> operandKinds;
+  /**
+   * Values of the first and second operands of each line, as described by
+   * operandKinds. The first operand of a LABEL or SECTION line is the index
+   * of its name.
+   */
+  std::array<std::vector<uint32_t>, MAX_OPERANDS> operands;
+  /**
+   * Source offset of each line, or SourceBuffer::NO_OFFSET.
+   */
+  std::vector<uint32_t> offsets;
+
+  /**
+   * Names of labels and sections, each only once; see name().
+   */
+  std::vector<std::string> names;
+  /**
+   * Index of each name in names.
+   */
+  std::unordered_map<std::string, uint32_t> nameIds;
+  /**
+   * Operands which are not known until they are evaluated. Constant
+   * subexpressions are folded before they are added, so only those which
+   * depend on a label are more than a NUMBER node.
+   */
+  ExpressionDag expressions;
+  /**
+   * Tree which the program was lowered from.
+   */
+  std::shared_ptr<AST::Root> root;
+
+  size_t size() const { return kinds.size(); }
+
+  int nOperands(size_t i) const {
+    return (operandKinds[0][i] != OperandKind::NONE) +
+           (operandKinds[1][i] != OperandKind::NONE);
+  }
+
+  /**
+   * Append a line, returning its index.
+   */
+  size_t add(LineKind kind, AST::InstructionType type, uint32_t offset) {
+    kinds.push_back(kind);
+    types.push_back(type);
+    for (size_t n = 0; n < MAX_OPERANDS; n++) {
+      operandKinds[n].push_back(OperandKind::NONE);
+      operands[n].push_back(0);
+    }
+    offsets.push_back(offset);
+    return kinds.size() - 1;
+  }
+
+  /**
+   * Index of name in names, adding it if it is not there yet.
+   */
+  uint32_t name(const std::string& name) {
+    auto [it, added] =
+        nameIds.try_emplace(name, static_cast<uint32_t>(names.size()));
+    if (added) {
+      names.push_back(name);
+    }
+    return it->second;
+  }
+
+  /**
+   * Remove every line. The names and expressions are kept, along with root,
+   * so that the lines added next share them.
+   */
+  void clear() {
+    kinds.clear();
+    types.clear();
+    for (size_t n = 0; n < MAX_OPERANDS; n++) {
+      operandKinds[n].clear();
+      operands[n].clear();
+    }
+    offsets.clear();
+  }
+};
+
+};  // namespace IR
+
+#endif  // IR_HPP
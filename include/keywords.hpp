@@ -0,0 +1,420 @@
+
+#ifndef KEYWORDS_HPP
+#define KEYWORDS_HPP
+
+#include <array>
+#include <cstdint>
+#include <string_view>
+
+/*
+ * Tables of the reserved words of the assembly language, and a perfect hash
+ * over all of them which is generated at compile time.
+ */
+
+namespace AST {
+
+enum class InstructionType {
+  ADD,
+  ADC,
+  INC,
+  SUB,
+  SBC,
+  AND,
+  XOR,
+  OR,
+  CP,
+  DEC,
+  RLC,
+  RLCA,
+  RL,
+  RLA,
+  RRC,
+  RRCA,
+  RR,
+  RRA,
+  DAA,
+  SCF,
+  CPL,
+  CCF,
+
+  LD,
+  LDI,
+  LDD,
+  LDH,
+  PUSH,
+  POP,
+
+  JR,
+  RET,
+  RETI,
+  JP,
+  CALL,
+  RST,
+
+  NOP,
+  STOP,
+  HALT,
+  DI,
+  EI,
+
+  SLA,
+  SRA,
+  SWAP,
+  SRL,
+  BIT,
+  RES,
+  SET,
+
+  INVALID,
+};
+
+/**
+ * Condition of a jump, call or return. The carry condition is written like
+ * register c, so it is parsed as that register.
+ */
+enum class ConditionType {
+  NZ,
+  Z,
+  NC,
+
+  INVALID,
+};
+
+enum class DirectiveType {
+  SECTION,
+
+  INVALID,
+};
+
+enum class BinaryOpType {
+  ADD,
+  SUB,
+  MULT,
+  DIV,
+  MOD,
+  SHL,
+  SHR,
+  AND,
+  OR,
+  XOR,
+  EQ,
+  NE,
+  LT,
+  GT,
+  LE,
+  GE,
+  LAND,
+  LOR,
+  INVALID,
+};
+
+enum class UnaryOpType {
+  NEG,
+  NOT,
+  LNOT,
+  INVALID,
+};
+
+}  // namespace AST
+
+struct InstructionProps {
+  const std::string_view lexeme;
+  AST::InstructionType type;
+  int args1;
+  int args2;
+};
+
+using InstructionPropsList =
+    const std::array<const InstructionProps, 22 + 6 + 6 + 5 + 7>;
+
+struct DirectiveProps {
+  const std::string_view lexeme;
+  AST::DirectiveType type;
+  // Only support 1 form for now
+  int args;
+};
+
+using DirectivePropsList = const std::array<const DirectiveProps, 1>;
+
+struct OperatorProps {
+  const std::string_view lexeme;
+  AST::BinaryOpType type;
+  // Operators of higher precedence bind more tightly
+  int precedence;
+};
+
+using OperatorPropsList = const std::array<const OperatorProps, 19>;
+
+enum class KeywordKind : uint8_t {
+  NONE,
+  INSTRUCTION,
+  DIRECTIVE,
+  REGISTER,
+  DREGISTER,
+  CONDITION,
+};
+
+/**
+ * Result of a keyword lookup: which table the keyword is in, and its index in
+ * that table.
+ */
+struct Keyword {
+  KeywordKind kind;
+  uint8_t index;
+};
+
+namespace GBAS {
+
+using AST::BinaryOpType;
+using AST::ConditionType;
+using AST::DirectiveType;
+using AST::InstructionType;
+
+constexpr std::array<std::string_view, 8> registers = {
+    "a", "f", "b", "c", "d", "e", "h", "l",
+};
+
+constexpr std::array<std::string_view, 6> doubleRegisters = {
+    "af", "bc", "de", "hl", "sp", "pc",
+};
+
+/**
+ * Names of the conditions, in the order of ConditionType.
+ */
+constexpr std::array<std::string_view, 3> conditions = {
+    "nz", "z", "nc",
+};
+
+constexpr DirectivePropsList directives{{
+    {".section", DirectiveType::SECTION, 1},
+}};
+
+constexpr InstructionPropsList instructions{{
+    {"add", InstructionType::ADD, 2, 2},
+    {"adc", InstructionType::ADC, 2, 2},
+    {"inc", InstructionType::INC, 1, 1},
+    {"sub", InstructionType::SUB, 1, 2},
+    {"sbc", InstructionType::SBC, 2, 2},
+    {"and", InstructionType::AND, 1, 2},
+    {"xor", InstructionType::XOR, 1, 2},
+    {"or", InstructionType::OR, 1, 2},
+    {"cp", InstructionType::CP, 1, 2},
+    {"dec", InstructionType::DEC, 1, 1},
+    {"rlc", InstructionType::RLC, 1, 1},
+    {"rlca", InstructionType::RLCA, 0, 0},
+    {"rl", InstructionType::RL, 1, 1},
+    {"rla", InstructionType::RLA, 0, 0},
+    {"rrc", InstructionType::RRC, 1, 1},
+    {"rrca", InstructionType::RRCA, 0, 0},
+    {"rr", InstructionType::RR, 1, 1},
+    {"rra", InstructionType::RRA, 0, 0},
+    {"daa", InstructionType::DAA, 0, 0},
+    {"scf", InstructionType::SCF, 0, 0},
+    {"cpl", InstructionType::CPL, 0, 0},
+    {"ccf", InstructionType::CCF, 0, 0},
+
+    {"ld", InstructionType::LD, 2, 2},
+    {"ldi", InstructionType::LDI, 2, 2},
+    {"ldd", InstructionType::LDD, 2, 2},
+    {"ldh", InstructionType::LDH, 2, 2},
+    {"push", InstructionType::PUSH, 1, 1},
+    {"pop", InstructionType::POP, 1, 1},
+
+    {"jr", InstructionType::JR, 1, 2},
+    {"ret", InstructionType::RET, 0, 1},
+    {"reti", InstructionType::RETI, 0, 0},
+    {"jp", InstructionType::JP, 1, 2},
+    {"call", InstructionType::CALL, 1, 2},
+    {"rst", InstructionType::RST, 1, 1},
+
+    {"nop", InstructionType::NOP, 0, 0},
+    {"stop", InstructionType::STOP, 0, 0},
+    {"halt", InstructionType::HALT, 0, 0},
+    {"di", InstructionType::DI, 0, 0},
+    {"ei", InstructionType::EI, 0, 0},
+
+    {"sla", InstructionType::SLA, 1, 1},
+    {"sra", InstructionType::SRA, 1, 1},
+    {"swap", InstructionType::SWAP, 1, 1},
+    {"srl", InstructionType::SRL, 1, 1},
+    {"bit", InstructionType::BIT, 2, 2},
+    {"res", InstructionType::RES, 2, 2},
+    {"set", InstructionType::SET, 2, 2},
+}};
+
+/**
+ * Binary operators, with the precedence GNU as gives them. Comparisons bind as
+ * loosely as addition, and the bitwise operators more tightly.
+ */
+constexpr OperatorPropsList binaryOperators{{
+    {"*", BinaryOpType::MULT, 4},
+    {"/", BinaryOpType::DIV, 4},
+    {"%", BinaryOpType::MOD, 4},
+    {"<<", BinaryOpType::SHL, 4},
+    {">>", BinaryOpType::SHR, 4},
+
+    {"|", BinaryOpType::OR, 3},
+    {"&", BinaryOpType::AND, 3},
+    {"^", BinaryOpType::XOR, 3},
+
+    {"+", BinaryOpType::ADD, 2},
+    {"-", BinaryOpType::SUB, 2},
+    {"==", BinaryOpType::EQ, 2},
+    {"!=", BinaryOpType::NE, 2},
+    {"<>", BinaryOpType::NE, 2},
+    {"<", BinaryOpType::LT, 2},
+    {">", BinaryOpType::GT, 2},
+    {"<=", BinaryOpType::LE, 2},
+    {">=", BinaryOpType::GE, 2},
+
+    {"&&", BinaryOpType::LAND, 1},
+    {"||", BinaryOpType::LOR, 1},
+}};
+
+/**
+ * The binary operator tok, or nullptr if it is not one.
+ */
+constexpr const OperatorProps* findOperator(std::string_view tok) {
+  for (auto& op : binaryOperators) {
+    if (op.lexeme == tok) {
+      return &op;
+    }
+  }
+  return nullptr;
+}
+
+struct KeywordEntry {
+  std::string_view lexeme;
+  Keyword keyword;
+};
+
+constexpr size_t N_KEYWORDS = instructions.size() + directives.size() +
+                              registers.size() + doubleRegisters.size() +
+                              conditions.size();
+
+/**
+ * Every keyword from all of the tables above.
+ */
+constexpr std::array<KeywordEntry, N_KEYWORDS> makeKeywords() {
+  std::array<KeywordEntry, N_KEYWORDS> all{};
+  size_t n = 0;
+  for (size_t i = 0; i < instructions.size(); i++) {
+    all[n++] = {instructions[i].lexeme,
+                {KeywordKind::INSTRUCTION, static_cast<uint8_t>(i)}};
+  }
+  for (size_t i = 0; i < directives.size(); i++) {
+    all[n++] = {directives[i].lexeme,
+                {KeywordKind::DIRECTIVE, static_cast<uint8_t>(i)}};
+  }
+  for (size_t i = 0; i < registers.size(); i++) {
+    all[n++] = {registers[i], {KeywordKind::REGISTER, static_cast<uint8_t>(i)}};
+  }
+  for (size_t i = 0; i < doubleRegisters.size(); i++) {
+    all[n++] = {doubleRegisters[i],
+                {KeywordKind::DREGISTER, static_cast<uint8_t>(i)}};
+  }
+  for (size_t i = 0; i < conditions.size(); i++) {
+    all[n++] = {conditions[i],
+                {KeywordKind::CONDITION, static_cast<uint8_t>(i)}};
+  }
+  return all;
+}
+
+constexpr auto keywords = makeKeywords();
+
+constexpr size_t KEYWORD_HASH_BITS = 9;
+constexpr size_t KEYWORD_SLOTS = size_t{1} << KEYWORD_HASH_BITS;
+constexpr uint8_t NO_KEYWORD = 0xff;
+
+static_assert(N_KEYWORDS < NO_KEYWORD, "Too many keywords for the hash table");
+
+/**
+ * Hash of the length, first two and last characters of a non-empty token.
+ * Those are enough to tell every keyword apart, and cost the same for any
+ * token.
+ */
+constexpr size_t keywordHash(std::string_view tok, uint32_t seed) {
+  uint32_t h = seed;
+  const uint32_t bytes[] = {
+      static_cast<uint32_t>(tok.size()),
+      static_cast<uint8_t>(tok[0]),
+      static_cast<uint8_t>(tok[tok.size() > 1 ? 1 : 0]),
+      static_cast<uint8_t>(tok[tok.size() - 1]),
+  };
+  for (auto b : bytes) {
+    h = (h ^ b) * 0x01000193u;
+  }
+  h ^= h >> 16;
+  h *= 0x7feb352du;
+  h ^= h >> 15;
+  return h & (KEYWORD_SLOTS - 1);
+}
+
+/**
+ * Smallest seed for which every keyword hashes to a different slot, or 0 if
+ * there is none.
+ */
+constexpr uint32_t findKeywordSeed() {
+  for (uint32_t seed = 1; seed < 100000; seed++) {
+    std::array<bool, KEYWORD_SLOTS> used{};
+    bool collision = false;
+    for (size_t i = 0; i < keywords.size() && !collision; i++) {
+      auto slot = keywordHash(keywords[i].lexeme, seed);
+      collision = used[slot];
+      used[slot] = true;
+    }
+    if (!collision) {
+      return seed;
+    }
+  }
+  return 0;
+}
+
+constexpr uint32_t keywordSeed = findKeywordSeed();
+
+static_assert(keywordSeed != 0, "No perfect hash for the keywords");
+
+constexpr std::array<uint8_t, KEYWORD_SLOTS> makeKeywordSlots() {
+  std::array<uint8_t, KEYWORD_SLOTS> slots{};
+  for (auto& slot : slots) {
+    slot = NO_KEYWORD;
+  }
+  for (size_t i = 0; i < keywords.size(); i++) {
+    slots[keywordHash(keywords[i].lexeme, keywordSeed)] =
+        static_cast<uint8_t>(i);
+  }
+  return slots;
+}
+
+/**
+ * Index into keywords for each hash value.
+ */
+constexpr auto keywordSlots = makeKeywordSlots();
+
+/**
+ * Look up tok in every keyword table at once: one hash and at most one string
+ * comparison.
+ */
+constexpr Keyword findKeyword(std::string_view tok) {
+  if (tok.empty()) {
+    return Keyword{KeywordKind::NONE, 0};
+  }
+  auto i = keywordSlots[keywordHash(tok, keywordSeed)];
+  if (i == NO_KEYWORD || keywords[i].lexeme != tok) {
+    return Keyword{KeywordKind::NONE, 0};
+  }
+  return keywords[i].keyword;
+}
+
+static_assert(findKeyword("add").kind == KeywordKind::INSTRUCTION &&
+                  instructions[findKeyword("add").index].type ==
+                      InstructionType::ADD,
+              "Keyword lookup is broken");
+static_assert(findKeyword("hl").kind == KeywordKind::DREGISTER,
+              "Keyword lookup is broken");
+static_assert(findKeyword("label").kind == KeywordKind::NONE,
+              "Keyword lookup is broken");
+
+};  // namespace GBAS
+
+#endif  // KEYWORDS_HPP
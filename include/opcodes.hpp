@@ -0,0 +1,574 @@
+
+#ifndef OPCODES_HPP
+#define OPCODES_HPP
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+
+#include "keywords.hpp"
+
+/*
+ * Table of every SM83 opcode, and an index from an instruction and the form
+ * of its operands to its opcode, both generated at compile time from the
+ * fields of the opcodes.
+ */
+
+namespace GBAS {
+
+/**
+ * Operand of an opcode. Operands up to IMM_IND can be told apart as they are
+ * written, so an instruction is looked up by those; the rest are the
+ * encodings of an IMM or IMM_IND operand.
+ */
+enum class Operand : uint8_t {
+  NONE,
+
+  // 8-bit registers, in the order of their 3-bit field. HL_IND is (hl), the
+  // byte which hl points to.
+  B,
+  C,
+  D,
+  E,
+  H,
+  L,
+  HL_IND,
+  A,
+
+  BC,
+  DE,
+  HL,
+  SP,
+  AF,
+
+  // Bytes which a register points to. hl is incremented after (hl+) and
+  // decremented after (hl-); (c) is the byte at $ff00 + c.
+  BC_IND,
+  DE_IND,
+  HLI_IND,
+  HLD_IND,
+  C_IND,
+
+  // Conditions. The carry condition is written c, so it is the register C.
+  NZ,
+  Z,
+  NC,
+
+  /** sp plus a signed 8-bit immediate. */
+  SP_IMM,
+  /** Any immediate. */
+  IMM,
+  /** The memory at an immediate address. */
+  IMM_IND,
+
+  /** An 8-bit immediate, signed or not. */
+  IMM8,
+  /** A 16-bit immediate, little-endian. */
+  IMM16,
+  /** The 8-bit offset of a relative jump. */
+  REL8,
+  /** A bit index from 0 to 7, in bits 3-5 of the opcode. */
+  BIT,
+  /** A restart address from $00 to $38, in bits 3-5 of the opcode. */
+  VECTOR,
+  /** An address from $ff00 to $ffff, encoded as its low byte. */
+  IND8,
+  /** A 16-bit address, little-endian. */
+  IND16,
+};
+
+/**
+ * Number of operands which can be told apart as they are written.
+ */
+constexpr size_t N_WRITTEN_OPERANDS =
+    static_cast<size_t>(Operand::IMM_IND) + 1;
+
+/**
+ * How operand is written: every encoding of an immediate is IMM, and every
+ * encoding of memory at an immediate address is IMM_IND.
+ */
+constexpr Operand writtenForm(Operand operand) {
+  switch (operand) {
+    case Operand::IMM8:
+    case Operand::IMM16:
+    case Operand::REL8:
+    case Operand::BIT:
+    case Operand::VECTOR:
+      return Operand::IMM;
+    case Operand::IND8:
+    case Operand::IND16:
+      return Operand::IMM_IND;
+    default:
+      return operand;
+  }
+}
+
+/**
+ * An instruction and its operands, which an opcode encodes.
+ */
+struct Opcode {
+  AST::InstructionType type;
+  Operand left = Operand::NONE;
+  Operand right = Operand::NONE;
+};
+
+/**
+ * Opcodes are indexed by their byte, and those after the prefix byte
+ * CB_PREFIX by 256 more than theirs.
+ */
+constexpr size_t N_OPCODES = 512;
+constexpr uint8_t CB_PREFIX = 0xcb;
+constexpr uint16_t NO_OPCODE = 0xffff;
+
+namespace Fields {
+
+using AST::InstructionType;
+
+// Operands and instructions in the order of the fields which select them
+
+constexpr std::array<Operand, 8> registers = {
+    Operand::B, Operand::C, Operand::D,      Operand::E,
+    Operand::H, Operand::L, Operand::HL_IND, Operand::A,
+};
+
+constexpr std::array<Operand, 4> pairs = {
+    Operand::BC, Operand::DE, Operand::HL, Operand::SP,
+};
+
+constexpr std::array<Operand, 4> stackPairs = {
+    Operand::BC, Operand::DE, Operand::HL, Operand::AF,
+};
+
+constexpr std::array<Operand, 4> pointers = {
+    Operand::BC_IND, Operand::DE_IND, Operand::HLI_IND, Operand::HLD_IND,
+};
+
+constexpr std::array<Operand, 4> conditions = {
+    Operand::NZ, Operand::Z, Operand::NC, Operand::C,
+};
+
+constexpr std::array<InstructionType, 8> arithmetic = {
+    InstructionType::ADD, InstructionType::ADC, InstructionType::SUB,
+    InstructionType::SBC, InstructionType::AND, InstructionType::XOR,
+    InstructionType::OR,  InstructionType::CP,
+};
+
+constexpr std::array<InstructionType, 8> accumulator = {
+    InstructionType::RLCA, InstructionType::RRCA, InstructionType::RLA,
+    InstructionType::RRA,  InstructionType::DAA,  InstructionType::CPL,
+    InstructionType::SCF,  InstructionType::CCF,
+};
+
+constexpr std::array<InstructionType, 8> rotations = {
+    InstructionType::RLC, InstructionType::RRC, InstructionType::RL,
+    InstructionType::RR,  InstructionType::SLA, InstructionType::SRA,
+    InstructionType::SWAP, InstructionType::SRL,
+};
+
+constexpr std::array<InstructionType, 3> bitOperations = {
+    InstructionType::BIT, InstructionType::RES, InstructionType::SET,
+};
+
+/**
+ * Whether type is arithmetic on a which is written without it, as in sub b.
+ */
+constexpr bool impliesA(InstructionType type) {
+  return type == InstructionType::SUB || type == InstructionType::AND ||
+         type == InstructionType::XOR || type == InstructionType::OR ||
+         type == InstructionType::CP;
+}
+
+/**
+ * Arithmetic of type on a and operand.
+ */
+constexpr Opcode arithmeticOn(InstructionType type, Operand operand) {
+  return impliesA(type) ? Opcode{type, operand}
+                        : Opcode{type, Operand::A, operand};
+}
+
+/**
+ * Decode one of the first 256 opcodes, from its fields xxyyyzzz. p is the
+ * top two bits of y and q the bottom one.
+ */
+constexpr Opcode decode(size_t op) {
+  using T = InstructionType;
+  using O = Operand;
+  size_t x = op >> 6, y = (op >> 3) & 7, z = op & 7, p = y >> 1, q = y & 1;
+  if (x == 1) {
+    // ld (hl), (hl) would be in the place of halt
+    return y == 6 && z == 6 ? Opcode{T::HALT}
+                            : Opcode{T::LD, registers[y], registers[z]};
+  } else if (x == 2) {
+    return arithmeticOn(arithmetic[y], registers[z]);
+  } else if (x == 0) {
+    switch (z) {
+      case 0:
+        switch (y) {
+          case 0:
+            return Opcode{T::NOP};
+          case 1:
+            return Opcode{T::LD, O::IND16, O::SP};
+          case 2:
+            return Opcode{T::STOP};
+          case 3:
+            return Opcode{T::JR, O::REL8};
+          default:
+            return Opcode{T::JR, conditions[y - 4], O::REL8};
+        }
+      case 1:
+        return q == 0 ? Opcode{T::LD, pairs[p], O::IMM16}
+                      : Opcode{T::ADD, O::HL, pairs[p]};
+      case 2:
+        return q == 0 ? Opcode{T::LD, pointers[p], O::A}
+                      : Opcode{T::LD, O::A, pointers[p]};
+      case 3:
+        return Opcode{q == 0 ? T::INC : T::DEC, pairs[p]};
+      case 4:
+        return Opcode{T::INC, registers[y]};
+      case 5:
+        return Opcode{T::DEC, registers[y]};
+      case 6:
+        return Opcode{T::LD, registers[y], O::IMM8};
+      default:
+        return Opcode{accumulator[y]};
+    }
+  }
+
+  switch (z) {
+    case 0:
+      switch (y) {
+        case 4:
+          return Opcode{T::LDH, O::IND8, O::A};
+        case 5:
+          return Opcode{T::ADD, O::SP, O::IMM8};
+        case 6:
+          return Opcode{T::LDH, O::A, O::IND8};
+        case 7:
+          return Opcode{T::LD, O::HL, O::SP_IMM};
+        default:
+          return Opcode{T::RET, conditions[y]};
+      }
+    case 1:
+      if (q == 0) {
+        return Opcode{T::POP, stackPairs[p]};
+      }
+      switch (p) {
+        case 0:
+          return Opcode{T::RET};
+        case 1:
+          return Opcode{T::RETI};
+        case 2:
+          return Opcode{T::JP, O::HL};
+        default:
+          return Opcode{T::LD, O::SP, O::HL};
+      }
+    case 2:
+      switch (y) {
+        case 4:
+          return Opcode{T::LD, O::C_IND, O::A};
+        case 5:
+          return Opcode{T::LD, O::IND16, O::A};
+        case 6:
+          return Opcode{T::LD, O::A, O::C_IND};
+        case 7:
+          return Opcode{T::LD, O::A, O::IND16};
+        default:
+          return Opcode{T::JP, conditions[y], O::IMM16};
+      }
+    case 3:
+      // $cb is the prefix; the rest are not instructions
+      switch (y) {
+        case 0:
+          return Opcode{T::JP, O::IMM16};
+        case 6:
+          return Opcode{T::DI};
+        case 7:
+          return Opcode{T::EI};
+        default:
+          return Opcode{T::INVALID};
+      }
+    case 4:
+      return y < 4 ? Opcode{T::CALL, conditions[y], O::IMM16}
+                   : Opcode{T::INVALID};
+    case 5:
+      if (q == 0) {
+        return Opcode{T::PUSH, stackPairs[p]};
+      }
+      return p == 0 ? Opcode{T::CALL, O::IMM16} : Opcode{T::INVALID};
+    case 6:
+      return arithmeticOn(arithmetic[y], O::IMM8);
+    default:
+      return Opcode{T::RST, O::VECTOR};
+  }
+}
+
+/**
+ * Decode one of the 256 opcodes which follow CB_PREFIX.
+ */
+constexpr Opcode decodePrefixed(size_t op) {
+  size_t x = op >> 6, y = (op >> 3) & 7, z = op & 7;
+  if (x == 0) {
+    return Opcode{rotations[y], registers[z]};
+  }
+  return Opcode{bitOperations[x - 1], Operand::BIT, registers[z]};
+}
+
+}  // namespace Fields
+
+constexpr std::array<Opcode, N_OPCODES> makeOpcodes() {
+  std::array<Opcode, N_OPCODES> opcodes{};
+  for (size_t op = 0; op < 256; op++) {
+    opcodes[op] = Fields::decode(op);
+    opcodes[256 + op] = Fields::decodePrefixed(op);
+  }
+  return opcodes;
+}
+
+/**
+ * What each opcode encodes, by its index.
+ */
+constexpr auto opcodes = makeOpcodes();
+
+/**
+ * An instruction as it is written, and the index of its opcode.
+ */
+struct Encoding {
+  Opcode written;
+  uint16_t opcode;
+};
+
+/**
+ * Ways of writing an opcode other than the operands it decodes to.
+ */
+constexpr std::array<Encoding, 7> aliases{{
+    {{AST::InstructionType::LDI, Operand::HL_IND, Operand::A}, 0x22},
+    {{AST::InstructionType::LDI, Operand::A, Operand::HL_IND}, 0x2a},
+    {{AST::InstructionType::LDD, Operand::HL_IND, Operand::A}, 0x32},
+    {{AST::InstructionType::LDD, Operand::A, Operand::HL_IND}, 0x3a},
+    {{AST::InstructionType::LDH, Operand::C_IND, Operand::A}, 0xe2},
+    {{AST::InstructionType::LDH, Operand::A, Operand::C_IND}, 0xf2},
+    {{AST::InstructionType::JP, Operand::HL_IND}, 0xe9},
+}};
+
+/**
+ * Every way of writing an instruction: each opcode with its written
+ * operands, then the aliases.
+ */
+struct EncodingList {
+  std::array<Encoding, 2 * N_OPCODES> entries;
+  size_t size;
+};
+
+constexpr void addEncoding(EncodingList& list, Opcode written, size_t opcode) {
+  written.left = writtenForm(written.left);
+  written.right = writtenForm(written.right);
+  list.entries[list.size++] = Encoding{written, static_cast<uint16_t>(opcode)};
+}
+
+constexpr EncodingList makeEncodingList() {
+  EncodingList list{};
+  for (size_t i = 0; i < N_OPCODES; i++) {
+    auto& opcode = opcodes[i];
+    if (opcode.type == AST::InstructionType::INVALID) {
+      continue;
+    }
+    addEncoding(list, opcode, i);
+    // Arithmetic which leaves a out may also name it, as in sub a, b
+    if (Fields::impliesA(opcode.type)) {
+      addEncoding(list, Opcode{opcode.type, Operand::A, opcode.left}, i);
+    }
+  }
+  for (auto& alias : aliases) {
+    addEncoding(list, alias.written, alias.opcode);
+  }
+  return list;
+}
+
+constexpr auto encodingList = makeEncodingList();
+
+constexpr uint8_t NO_FORM = 0xff;
+
+using FormTable =
+    std::array<std::array<uint8_t, N_WRITTEN_OPERANDS>, N_WRITTEN_OPERANDS>;
+
+/**
+ * Number every pair of written operands which some instruction takes, in the
+ * order they first appear.
+ */
+constexpr FormTable makeForms() {
+  FormTable forms{};
+  for (auto& row : forms) {
+    for (auto& form : row) {
+      form = NO_FORM;
+    }
+  }
+  uint8_t n = 0;
+  for (size_t i = 0; i < encodingList.size; i++) {
+    auto& written = encodingList.entries[i].written;
+    auto& form = forms[static_cast<size_t>(written.left)]
+                      [static_cast<size_t>(written.right)];
+    if (form == NO_FORM) {
+      form = n++;
+    }
+  }
+  return forms;
+}
+
+/**
+ * Operand form of each pair of written operands, or NO_FORM.
+ */
+constexpr FormTable operandForms = makeForms();
+
+constexpr size_t countForms() {
+  size_t n = 0;
+  for (auto& row : operandForms) {
+    for (auto form : row) {
+      n += form != NO_FORM;
+    }
+  }
+  return n;
+}
+
+constexpr size_t N_FORMS = countForms();
+
+static_assert(N_FORMS < NO_FORM, "Too many operand forms");
+
+constexpr size_t N_INSTRUCTION_TYPES =
+    static_cast<size_t>(AST::InstructionType::INVALID);
+
+using EncodingTable =
+    std::array<std::array<uint16_t, N_FORMS>, N_INSTRUCTION_TYPES>;
+
+/**
+ * Index of the opcode of each instruction and operand form. Where several
+ * opcodes differ only by a bit index or a restart address, this is the first,
+ * which encodes 0.
+ */
+constexpr EncodingTable makeEncodings() {
+  EncodingTable encodings{};
+  for (auto& row : encodings) {
+    for (auto& opcode : row) {
+      opcode = NO_OPCODE;
+    }
+  }
+  for (size_t i = 0; i < encodingList.size; i++) {
+    auto& encoding = encodingList.entries[i];
+    auto& written = encoding.written;
+    auto form = operandForms[static_cast<size_t>(written.left)]
+                            [static_cast<size_t>(written.right)];
+    auto& opcode = encodings[static_cast<size_t>(written.type)][form];
+    if (opcode == NO_OPCODE) {
+      opcode = encoding.opcode;
+    }
+  }
+  return encodings;
+}
+
+constexpr EncodingTable encodings = makeEncodings();
+
+/**
+ * Whether every instruction and operand form has a single opcode, other than
+ * those which differ in a field of the opcode.
+ */
+constexpr bool encodingsAreUnique() {
+  for (size_t i = 0; i < encodingList.size; i++) {
+    auto& encoding = encodingList.entries[i];
+    auto& written = encoding.written;
+    auto form = operandForms[static_cast<size_t>(written.left)]
+                            [static_cast<size_t>(written.right)];
+    auto first = encodings[static_cast<size_t>(written.type)][form];
+    auto& opcode = opcodes[encoding.opcode];
+    if (first != encoding.opcode && opcode.left != Operand::BIT &&
+        opcode.left != Operand::VECTOR) {
+      return false;
+    }
+  }
+  return true;
+}
+
+static_assert(encodingsAreUnique(), "Two opcodes are written the same way");
+
+/**
+ * Index in opcodes of the opcode of the instruction type with the written
+ * operands left and right: two indexed loads.
+ *
+ * @returns the index, or NO_OPCODE if there is no such instruction.
+ */
+constexpr uint16_t findOpcode(AST::InstructionType type, Operand left,
+                              Operand right = Operand::NONE) {
+  auto l = static_cast<size_t>(left), r = static_cast<size_t>(right);
+  auto t = static_cast<size_t>(type);
+  if (l >= N_WRITTEN_OPERANDS || r >= N_WRITTEN_OPERANDS ||
+      t >= N_INSTRUCTION_TYPES || operandForms[l][r] == NO_FORM) {
+    return NO_OPCODE;
+  }
+  return encodings[t][operandForms[l][r]];
+}
+
+constexpr size_t countInvalidOpcodes() {
+  size_t n = 0;
+  for (auto& opcode : opcodes) {
+    n += opcode.type == AST::InstructionType::INVALID;
+  }
+  return n;
+}
+
+// The prefix and the 11 unused opcodes
+static_assert(countInvalidOpcodes() == 12, "Opcode table is broken");
+
+namespace Check {
+
+using AST::InstructionType;
+using O = Operand;
+
+static_assert(findOpcode(InstructionType::NOP, O::NONE) == 0x00);
+static_assert(findOpcode(InstructionType::STOP, O::NONE) == 0x10);
+static_assert(findOpcode(InstructionType::HALT, O::NONE) == 0x76);
+static_assert(findOpcode(InstructionType::RETI, O::NONE) == 0xd9);
+static_assert(findOpcode(InstructionType::RST, O::NONE) == NO_OPCODE);
+static_assert(findOpcode(InstructionType::CP, O::IMM) == 0xfe);
+static_assert(findOpcode(InstructionType::CP, O::A, O::IMM) == 0xfe);
+static_assert(findOpcode(InstructionType::SUB, O::B) == 0x90);
+static_assert(findOpcode(InstructionType::SBC, O::A, O::HL_IND) == 0x9e);
+static_assert(findOpcode(InstructionType::ADD, O::A, O::IMM) == 0xc6);
+static_assert(findOpcode(InstructionType::ADD, O::HL, O::SP) == 0x39);
+static_assert(findOpcode(InstructionType::ADD, O::SP, O::IMM) == 0xe8);
+static_assert(findOpcode(InstructionType::LD, O::B, O::C) == 0x41);
+static_assert(findOpcode(InstructionType::LD, O::HL_IND, O::HL_IND) ==
+              NO_OPCODE);
+static_assert(findOpcode(InstructionType::LD, O::A, O::IMM) == 0x3e);
+static_assert(findOpcode(InstructionType::LD, O::SP, O::IMM) == 0x31);
+static_assert(findOpcode(InstructionType::LD, O::IMM_IND, O::SP) == 0x08);
+static_assert(findOpcode(InstructionType::LD, O::A, O::IMM_IND) == 0xfa);
+static_assert(findOpcode(InstructionType::LD, O::HLI_IND, O::A) == 0x22);
+static_assert(findOpcode(InstructionType::LDI, O::HL_IND, O::A) == 0x22);
+static_assert(findOpcode(InstructionType::LDD, O::A, O::HL_IND) == 0x3a);
+static_assert(findOpcode(InstructionType::LD, O::HL, O::SP_IMM) == 0xf8);
+static_assert(findOpcode(InstructionType::LD, O::SP, O::HL) == 0xf9);
+static_assert(findOpcode(InstructionType::LDH, O::IMM_IND, O::A) == 0xe0);
+static_assert(findOpcode(InstructionType::LDH, O::A, O::C_IND) == 0xf2);
+static_assert(findOpcode(InstructionType::INC, O::HL_IND) == 0x34);
+static_assert(findOpcode(InstructionType::DEC, O::SP) == 0x3b);
+static_assert(findOpcode(InstructionType::PUSH, O::AF) == 0xf5);
+static_assert(findOpcode(InstructionType::POP, O::SP) == NO_OPCODE);
+static_assert(findOpcode(InstructionType::JR, O::IMM) == 0x18);
+static_assert(findOpcode(InstructionType::JR, O::NZ, O::IMM) == 0x20);
+static_assert(findOpcode(InstructionType::JP, O::HL) == 0xe9);
+static_assert(findOpcode(InstructionType::JP, O::HL_IND) == 0xe9);
+static_assert(findOpcode(InstructionType::JP, O::Z, O::IMM) == 0xca);
+static_assert(findOpcode(InstructionType::CALL, O::C, O::IMM) == 0xdc);
+static_assert(findOpcode(InstructionType::RET, O::NC) == 0xd0);
+static_assert(findOpcode(InstructionType::RST, O::IMM) == 0xc7);
+static_assert(findOpcode(InstructionType::RLC, O::B) == 256 + 0x00);
+static_assert(findOpcode(InstructionType::SWAP, O::A) == 256 + 0x37);
+static_assert(findOpcode(InstructionType::BIT, O::IMM, O::H) == 256 + 0x44);
+static_assert(findOpcode(InstructionType::SET, O::IMM, O::HL_IND) ==
+              256 + 0xc6);
+static_assert(opcodes[0xd3].type == InstructionType::INVALID);
+static_assert(opcodes[256 + 0x7c].type == InstructionType::BIT);
+
+}  // namespace Check
+
+}  // namespace GBAS
+
+#endif  // OPCODES_HPP
@@ -2,77 +2,28 @@
 #ifndef PARSER_H
 #define PARSER_H
 
+#include <algorithm>
+#include <cstddef>
 #include <iostream>
+#include <iterator>
 #include <memory>
+#include <new>
+#include <type_traits>
+#include <utility>
+#include <variant>
+#include <vector>
 
+#include "token_stream.hpp"
 #include "tokenizer.hpp"
 
 namespace AST {
 
-enum class InstructionType {
-  ADD,
-  ADC,
-  INC,
-  SUB,
-  SBC,
-  AND,
-  XOR,
-  OR,
-  CP,
-  DEC,
-  RLC,
-  RLCA,
-  RL,
-  RLA,
-  RRC,
-  RRCA,
-  RR,
-  RRA,
-  DAA,
-  SCF,
-  CPL,
-  CCF,
-
-  LD,
-  LDI,
-  LDD,
-  PUSH,
-  POP,
-
-  JR,
-  RET,
-  RETI,
-  JP,
-  CALL,
-  RST,
-
-  NOP,
-  STOP,
-  HALT,
-  DI,
-  EI,
-
-  SLA,
-  SRA,
-  SWAP,
-  SRL,
-  BIT,
-  RES,
-  SET,
-
-  INVALID,
-};
-
-enum class DirectiveType {
-  SECTION,
-
-  INVALID,
-};
-
 /* Types of Node:
  * - Node<Instruction<args>>
  * - Node<Register<reg>>
  * - Node<DRegister<reg>>
+ * - Node<Condition>
+ * - Node<Indirect>
  * - Node<Label>
  * - Node<Number>
  * - Node<NumericOp<op, T>>
@@ -83,6 +34,8 @@ enum class NodeType {
   INSTRUCTION,
   REGISTER,
   DREGISTER,
+  CONDITION,
+  INDIRECT,
   LABEL,
   DIRECTIVE,
   NUMBER,
@@ -94,16 +47,117 @@ enum class NodeType {
 struct AbstractNodeVisitor;
 
 struct BaseNode {
-  virtual ~BaseNode() {}
+  BaseNode() : mOffset{SourceBuffer::NO_OFFSET}, mFolded{false} {}
   //virtual NodeType id() const { return NodeType::INVALID; };
   virtual NodeType id() const = 0;
   virtual void accept(AbstractNodeVisitor& visitor) = 0;
+
+  /**
+   * Position in the source of the first token of this node, or
+   * SourceBuffer::NO_OFFSET if it was not parsed from a source.
+   */
+  uint32_t offset() const { return mOffset; }
+
+  void setOffset(uint32_t offset) { mOffset = offset; }
+
+  /**
+   * Whether the node is already evaluated as far as it goes: either a
+   * constant, or something which depends on a register or a label. Evaluating
+   * it again would give the node itself.
+   */
+  bool folded() const { return mFolded; }
+
+  void setFolded() { mFolded = true; }
+
+ protected:
+  /**
+   * Nodes belong to an Arena, which destroys them as what they are, so they
+   * are never deleted through a BaseNode pointer.
+   */
+  ~BaseNode() = default;
+
+ private:
+  uint32_t mOffset;
+  bool mFolded;
+};
+
+/**
+ * Owner of all nodes of a tree. Nodes are bump-allocated from large blocks,
+ * link to each other with plain pointers, and are released all at once with
+ * the arena. Building a tree takes a handful of allocations rather than one
+ * per node, and the nodes of a program end up next to each other in memory.
+ */
+class Arena {
+ public:
+  Arena();
+
+  Arena(Arena&& other) noexcept;
+
+  Arena& operator=(Arena&& other) noexcept;
+
+  Arena(const Arena&) = delete;
+
+  Arena& operator=(const Arena&) = delete;
+
+  ~Arena();
+
+  /**
+   * Construct a T from args in the arena. It lives as long as the arena.
+   */
+  template <typename T, typename... Args>
+  T* make(Args&&... args) {
+    void* memory = allocate(sizeof(T), alignof(T));
+    if constexpr (std::is_trivially_destructible_v<T>) {
+      T* object = new (memory) T(std::forward<Args>(args)...);
+      mSize++;
+      return object;
+    } else {
+      // Most nodes are trivially destructible. Only the few which own
+      // memory, like Label with its name, are destroyed one by one.
+      mDestructors.push_back(
+          Destructor{memory, [](void* o) { static_cast<T*>(o)->~T(); }});
+      T* object;
+      try {
+        object = new (memory) T(std::forward<Args>(args)...);
+      } catch (...) {
+        mDestructors.pop_back();
+        throw;
+      }
+      mSize++;
+      return object;
+    }
+  }
+
+  /**
+   * Number of objects made in the arena.
+   */
+  size_t size() const { return mSize; }
+
+ private:
+  struct Destructor {
+    void* object;
+    void (*destroy)(void*);
+  };
+
+  void* allocate(size_t size, size_t align);
+
+  void release();
+
+  static constexpr size_t BLOCK_SIZE = 32 * 1024;
+
+  std::vector<std::unique_ptr<char[]>> mBlocks;
+  char* mNext;
+  char* mEnd;
+  size_t mSize;
+  std::vector<Destructor> mDestructors;
 };
 
 class Root;
 class BaseInstruction;
 class BaseRegister;
 class BaseDRegister;
+class Condition;
+class Indirect;
 class Label;
 class Directive;
 struct Number;
@@ -115,6 +169,8 @@ struct AbstractNodeVisitor {
   virtual void visit(BaseInstruction& node) = 0;
   virtual void visit(BaseRegister& node) = 0;
   virtual void visit(BaseDRegister& node) = 0;
+  virtual void visit(Condition& node) = 0;
+  virtual void visit(Indirect& node) = 0;
   virtual void visit(Label& node) = 0;
   virtual void visit(Directive& node) = 0;
   virtual void visit(Number& node) = 0;
@@ -127,42 +183,54 @@ struct Node : BaseNode {
   virtual NodeType id() const override { return Tnode; }
 };
 
+/**
+ * Top of the tree. The Root owns the Arena which every node below it is made
+ * in.
+ */
 class Root : public Node<NodeType::ROOT> {
  public:
-  Root() : mChildren{} {}
-
-  Root(std::vector<std::shared_ptr<BaseNode>> children) : mChildren{children} {}
+  Root() : mChildren{}, mArena{} {}
 
-  virtual ~Root() override {}
+  void add(BaseNode* child) { mChildren.push_back(child); }
 
-  void add(std::shared_ptr<BaseNode> child) { mChildren.push_back(child); }
+  /**
+   * Replace the count children starting at pos with children.
+   */
+  void splice(size_t pos, size_t count, std::vector<BaseNode*> children) {
+    auto first = mChildren.begin() + pos;
+    size_t common = std::min(count, children.size());
+    std::copy(children.begin(), children.begin() + common, first);
+    if (count > common) {
+      mChildren.erase(first + common, first + count);
+    } else {
+      mChildren.insert(first + common, children.begin() + common,
+                       children.end());
+    }
+  }
 
   BaseNode& child(size_t i) { return *mChildren.at(i); }
 
-  std::vector<std::shared_ptr<BaseNode>>::iterator begin() {
-    return mChildren.begin();
-  }
+  std::vector<BaseNode*>::iterator begin() { return mChildren.begin(); }
 
-  std::vector<std::shared_ptr<BaseNode>>::iterator end() {
-    return mChildren.end();
-  }
+  std::vector<BaseNode*>::iterator end() { return mChildren.end(); }
 
   size_t size() const { return mChildren.size(); }
 
+  Arena& arena() { return mArena; }
+
   virtual void accept(AbstractNodeVisitor& visitor) override {
     visitor.visit(*this);
   }
 
  private:
-  std::vector<std::shared_ptr<BaseNode>> mChildren;
+  std::vector<BaseNode*> mChildren;
+  Arena mArena;
 };
 
 class BaseRegister : public Node<NodeType::REGISTER> {
  public:
   explicit BaseRegister(char regc) : mReg{regc} { }
 
-  virtual ~BaseRegister() override {}
-
   constexpr char reg() const {
     return mReg;
   };
@@ -185,8 +253,6 @@ class BaseDRegister : public Node<NodeType::DREGISTER> {
  public:
   explicit BaseDRegister(char r1, char r2) : mReg1{r1}, mReg2{r2} { }
 
-  virtual ~BaseDRegister() override {}
-
   const std::string reg() const {
     return std::string{reg1(), reg2()};
   };
@@ -213,11 +279,46 @@ class DRegister : public BaseDRegister {
   DRegister() : BaseDRegister{r1, r2} { }
 };
 
-class Label : public Node<NodeType::LABEL> {
+class Condition : public Node<NodeType::CONDITION> {
  public:
-  Label(const std::string& name) : mName{name} {}
+  explicit Condition(ConditionType type) : mType{type} {}
+
+  ConditionType type() const { return mType; }
+
+  virtual void accept(AbstractNodeVisitor& visitor) override {
+    visitor.visit(*this);
+  }
+
+ private:
+  ConditionType mType;
+};
+
+/**
+ * An operand in parentheses: the memory at the address which is the value of
+ * the node inside them, either a register or an expression. The address in
+ * (hl+) and (hl-) also steps by 1 or -1 after it is used.
+ */
+class Indirect : public Node<NodeType::INDIRECT> {
+ public:
+  explicit Indirect(BaseNode* address, int step = 0)
+      : mAddress{address}, mStep{step} {}
+
+  BaseNode* address() const { return mAddress; }
 
-  virtual ~Label() override {}
+  int step() const { return mStep; }
+
+  virtual void accept(AbstractNodeVisitor& visitor) override {
+    visitor.visit(*this);
+  }
+
+ private:
+  BaseNode* mAddress;
+  int mStep;
+};
+
+class Label : public Node<NodeType::LABEL> {
+ public:
+  Label(std::string name) : mName{std::move(name)} {}
 
   const std::string& name() const { return mName; }
 
@@ -238,16 +339,14 @@ class Directive : public Node<NodeType::DIRECTIVE> {
 
   Directive(DirectiveType type, OperandList operands)
     : mType{type}
-    , mOperands{operands}
+    , mOperands{std::move(operands)}
     {}
 
-  virtual ~Directive() override {}
-
   DirectiveType type() const {
     return mType;
   }
 
-  OperandList operands() const {
+  const OperandList& operands() const {
     return mOperands;
   }
 
@@ -261,56 +360,50 @@ class Directive : public Node<NodeType::DIRECTIVE> {
 };
 
 
+/**
+ * An integer constant. Values are 32 bits wide, so that expressions like
+ * addresses fold without wrapping; they are only checked to fit a field when
+ * they are encoded.
+ */
 struct Number : public Node<NodeType::NUMBER> {
-  explicit Number(uint8_t value) : mValue{value} {}
+  explicit Number(int32_t value) : mValue{value} {}
 
-  virtual ~Number() {}
+  int32_t value() const { return mValue; }
 
-  uint8_t value() const { return mValue; }
+  void setValue(int32_t value) { mValue = value; }
 
   virtual void accept(AbstractNodeVisitor& visitor) override {
     visitor.visit(*this);
   }
 
  private:
-  uint8_t mValue;
-};
-
-enum class BinaryOpType {
-  ADD,
-  SUB,
-  MULT,
-  DIV,
-  INVALID,
+  int32_t mValue;
 };
 
 class BaseBinaryOp : public Node<NodeType::BINARY_OP> {
  public:
   virtual BinaryOpType opType() const { return BinaryOpType::INVALID; }
 
-  virtual ~BaseBinaryOp() override {}
-
-  std::shared_ptr<BaseNode> left() { return mL; }
+  BaseNode* left() const { return mL; }
 
-  std::shared_ptr<BaseNode> right() { return mR; }
+  BaseNode* right() const { return mR; }
 
   virtual void accept(AbstractNodeVisitor& visitor) override {
     visitor.visit(*this);
   }
 
  protected:
-  explicit BaseBinaryOp(std::shared_ptr<BaseNode> l,
-                        std::shared_ptr<BaseNode> r)
+  explicit BaseBinaryOp(BaseNode* l, BaseNode* r)
       : mL{l}, mR{r} {}
 
  private:
-  std::shared_ptr<BaseNode> mL, mR;
+  BaseNode *mL, *mR;
 };
 
 template <BinaryOpType Top>
 class BinaryOp : public BaseBinaryOp {
  public:
-  explicit BinaryOp(std::shared_ptr<BaseNode> l, std::shared_ptr<BaseNode> r)
+  explicit BinaryOp(BaseNode* l, BaseNode* r)
       : BaseBinaryOp{l, r} {}
 
   virtual BinaryOpType opType() const { return Top; }
@@ -320,45 +413,63 @@ using AddOp = BinaryOp<BinaryOpType::ADD>;
 using SubOp = BinaryOp<BinaryOpType::SUB>;
 using MultOp = BinaryOp<BinaryOpType::MULT>;
 using DivOp = BinaryOp<BinaryOpType::DIV>;
-
-enum class UnaryOpType {
-  NEG,
-  INVALID,
-};
+using ModOp = BinaryOp<BinaryOpType::MOD>;
+using ShlOp = BinaryOp<BinaryOpType::SHL>;
+using ShrOp = BinaryOp<BinaryOpType::SHR>;
+using AndOp = BinaryOp<BinaryOpType::AND>;
+using OrOp = BinaryOp<BinaryOpType::OR>;
+using XorOp = BinaryOp<BinaryOpType::XOR>;
+using EqOp = BinaryOp<BinaryOpType::EQ>;
+using NeOp = BinaryOp<BinaryOpType::NE>;
+using LtOp = BinaryOp<BinaryOpType::LT>;
+using GtOp = BinaryOp<BinaryOpType::GT>;
+using LeOp = BinaryOp<BinaryOpType::LE>;
+using GeOp = BinaryOp<BinaryOpType::GE>;
+using LandOp = BinaryOp<BinaryOpType::LAND>;
+using LorOp = BinaryOp<BinaryOpType::LOR>;
+
+/**
+ * Make the BinaryOp of type in arena, when the type is only known at run time.
+ */
+BaseBinaryOp* makeBinaryOp(Arena& arena, BinaryOpType type, BaseNode* l,
+                           BaseNode* r);
 
 class BaseUnaryOp : public Node<NodeType::UNARY_OP> {
  public:
-  virtual ~BaseUnaryOp() override {}
-
   virtual UnaryOpType opType() const { return UnaryOpType::INVALID; }
 
-  std::shared_ptr<BaseNode> operand() { return mRand; }
+  BaseNode* operand() const { return mRand; }
 
   virtual void accept(AbstractNodeVisitor& visitor) override {
     visitor.visit(*this);
   }
 
  protected:
-  explicit BaseUnaryOp(std::shared_ptr<BaseNode> rand) : mRand{rand} {}
+  explicit BaseUnaryOp(BaseNode* rand) : mRand{rand} {}
 
  private:
-  std::shared_ptr<BaseNode> mRand;
+  BaseNode* mRand;
 };
 
 template <UnaryOpType Top>
 class UnaryOp : public BaseUnaryOp {
  public:
-  explicit UnaryOp(std::shared_ptr<BaseNode> rand) : BaseUnaryOp{rand} {}
+  explicit UnaryOp(BaseNode* rand) : BaseUnaryOp{rand} {}
 
   virtual UnaryOpType opType() const { return Top; }
 };
 
 using NegOp = UnaryOp<UnaryOpType::NEG>;
+using NotOp = UnaryOp<UnaryOpType::NOT>;
+using LnotOp = UnaryOp<UnaryOpType::LNOT>;
+
+/**
+ * Make the UnaryOp of type in arena, when the type is only known at run time.
+ */
+BaseUnaryOp* makeUnaryOp(Arena& arena, UnaryOpType type, BaseNode* rand);
 
 class BaseInstruction : public Node<NodeType::INSTRUCTION> {
  public:
-  virtual ~BaseInstruction() {}
-
   InstructionType type() const { return mType; }
 
   virtual int nOperands() const = 0;
@@ -391,51 +502,82 @@ class Instruction0 : public Instruction<0> {
 
 class Instruction1 : public Instruction<1> {
  public:
-  Instruction1(InstructionType type, std::shared_ptr<BaseNode> operand)
+  Instruction1(InstructionType type, BaseNode* operand)
       : Instruction<1>{type}, mOperand{operand} {}
 
-  std::shared_ptr<BaseNode> operand() { return mOperand; }
+  BaseNode* operand() const { return mOperand; }
 
  private:
-  std::shared_ptr<BaseNode> mOperand;
+  BaseNode* mOperand;
 };
 
 class Instruction2 : public Instruction<2> {
  public:
-  Instruction2(InstructionType type, std::shared_ptr<BaseNode> left,
-               std::shared_ptr<BaseNode> right)
+  Instruction2(InstructionType type, BaseNode* left, BaseNode* right)
       : Instruction<2>{type}, mLoperand{left}, mRoperand{right} {}
 
-  std::shared_ptr<BaseNode> left() { return mLoperand; }
+  BaseNode* left() const { return mLoperand; }
 
-  std::shared_ptr<BaseNode> right() { return mRoperand; }
+  BaseNode* right() const { return mRoperand; }
 
  private:
-  std::shared_ptr<BaseNode> mLoperand, mRoperand;
+  BaseNode *mLoperand, *mRoperand;
 };
 
-class Terminal;
-
-};  // namespace AST
+/**
+ * A node as the class it is, out of the closed set of node classes. Passes
+ * std::visit a NodeRef rather than switching on id() and casting, and every
+ * node which is none of them, like an invalid one, is a std::monostate.
+ */
+using NodeRef =
+    std::variant<std::monostate, Root*, BaseInstruction*, BaseRegister*,
+                 BaseDRegister*, Condition*, Indirect*, Label*, Directive*,
+                 Number*, BaseBinaryOp*, BaseUnaryOp*>;
+
+inline NodeRef ref(BaseNode* node) {
+  switch (node->id()) {
+    case NodeType::ROOT:
+      return static_cast<Root*>(node);
+    case NodeType::INSTRUCTION:
+      return static_cast<BaseInstruction*>(node);
+    case NodeType::REGISTER:
+      return static_cast<BaseRegister*>(node);
+    case NodeType::DREGISTER:
+      return static_cast<BaseDRegister*>(node);
+    case NodeType::CONDITION:
+      return static_cast<Condition*>(node);
+    case NodeType::INDIRECT:
+      return static_cast<Indirect*>(node);
+    case NodeType::LABEL:
+      return static_cast<Label*>(node);
+    case NodeType::DIRECTIVE:
+      return static_cast<Directive*>(node);
+    case NodeType::NUMBER:
+      return static_cast<Number*>(node);
+    case NodeType::BINARY_OP:
+      return static_cast<BaseBinaryOp*>(node);
+    case NodeType::UNARY_OP:
+      return static_cast<BaseUnaryOp*>(node);
+    default:
+      return std::monostate{};
+  }
+}
 
-struct InstructionProps {
-  const std::string lexeme;
-  AST::InstructionType type;
-  int args1;
-  int args2;
+/**
+ * Set of lambdas to std::visit a NodeRef with, one per alternative.
+ */
+template <typename... Ts>
+struct Overloaded : Ts... {
+  using Ts::operator()...;
 };
 
-using InstructionPropsList =
-    const std::array<const InstructionProps, 22 + 5 + 5 + 5 + 7>;
+template <typename... Ts>
+Overloaded(Ts...) -> Overloaded<Ts...>;
 
-struct DirectiveProps {
-  const std::string lexeme;
-  AST::DirectiveType type;
-  // Only support 1 form for now
-  int args;
-};
+class Terminal;
+
+};  // namespace AST
 
-using DirectivePropsList = const std::array<const DirectiveProps, 1>;
 
 /*
  * program → line* EOF ;
@@ -447,11 +589,19 @@ using DirectivePropsList = const std::array<const DirectiveProps, 1>;
  * instruction1 → INSTRUCTION operand newline ;
  * instruction2 → INSTRUCTION operand "," operand newline ;
  *
- * operand → REGISTER | DREGISTER | addition ;
- * addition → multiplication ( ( "+" | "-" ) multiplication )* ;
- * multiplication → unary ( ( "*" | "/" ) unary )* ;
- * unary → "-" unary | primary ;
- * primary → NUMBER | LABEL ;
+ * operand → REGISTER | DREGISTER | CONDITION | indirect | stackOffset
+ *   | expression ;
+ * indirect → "(" ( REGISTER | DREGISTER ( "+" | "-" )? | expression ) ")" ;
+ * stackOffset → "sp" ( "+" | "-" ) expression ;
+ * expression → unary ( BINARY_OPERATOR unary )* ;
+ * unary → ( "-" | "~" | "!" ) unary | primary ;
+ * primary → NUMBER | LABEL | "(" expression ")" ;
+ *
+ * An operand which is entirely in parentheses is an indirect one, and
+ * otherwise the parentheses only group an expression.
+ *
+ * Binary operators are listed in binaryOperators with their precedence, and
+ * each is left-associative.
  *
  *
  * label → LABEL ":" ;
@@ -461,9 +611,38 @@ using DirectivePropsList = const std::array<const DirectiveProps, 1>;
  * newline → "EOL"
  */
 
+class Assembler;
+
+namespace GBAS {
+class ELF;
+}
+
+namespace IR {
+struct Program;
+}
+
 class Parser {
  public:
-  Parser(TokenList& tokens);
+  /**
+   * Parse a list of token strings, as produced by the stream tokenizer. The
+   * tokens are borrowed, not copied, so they must outlive the Parser.
+   */
+  Parser(const TokenList& tokens);
+
+  Parser(TokenList&& tokens) = delete;
+
+  /**
+   * Parse tokens as they are pulled from tokens, which must outlive the
+   * Parser.
+   */
+  Parser(TokenStream& tokens);
+
+  /**
+   * Parse tokens into root: the nodes are made in its Arena, and each line
+   * parsed by parse() is added to it.
+   */
+  Parser(TokenStream& tokens, std::shared_ptr<AST::Root> root);
+
   ~Parser();
 
   /**
@@ -475,44 +654,123 @@ class Parser {
   std::shared_ptr<AST::Root> parse();
 
   /**
-   * Return the next Token in the list and increment the position counter.
-   * Throws an exception when there are no more Tokens.
+   * Recover from errors instead of throwing: each invalid line is skipped up
+   * to its NEWLINE, with an error appended to diagnostics, and parsing goes on
+   * with the next line. Errors in the tokens are recovered from the same way.
+   * Only the valid lines make it into the Root. nullptr goes back to
+   * throwing upon the first error.
    */
-  Token next();
+  void setDiagnostics(DiagnosticList* diagnostics);
 
   /**
-   * Return the next Token in the list without incrementing the position
-   * counter. Throws an exception when there are no more Tokens.
+   * Consume and return the next Token in the stream. Past the end of the
+   * stream, this is an END token.
    */
-  Token peek();
+  TokenRecord next() { return mTokens.next(); }
 
   /**
-   * Return the "next next" Token in the list without incrementing the
-   * position counter. Throws an exception when there are no more Tokens.
+   * Return the next Token in the stream without consuming it. Past the end
+   * of the stream, this is an END token.
    */
-  Token peekNext();
+  const TokenRecord& peek() { return mTokens.peek(); }
+
+  /**
+   * Return the "next next" Token in the stream without consuming anything.
+   * Past the end of the stream, this is an END token.
+   */
+  const TokenRecord& peekNext() { return mTokens.peekNext(); }
+
+  /**
+   * Source text of tok, which must be a Token on the current line.
+   */
+  std::string_view text(const TokenRecord& tok) const {
+    return mTokens.text(tok);
+  }
 
   std::shared_ptr<AST::Root> program();
 
-  std::shared_ptr<AST::BaseNode> line();
-  std::shared_ptr<AST::BaseNode> instruction();
-  std::shared_ptr<AST::BaseNode> operand();
-  std::shared_ptr<AST::BaseNode> register_();
-  std::shared_ptr<AST::BaseNode> dregister();
-  std::shared_ptr<AST::BaseNode> addition();
-  bool isAddition(const Token& tok);
-  std::shared_ptr<AST::BaseNode> multiplication();
-  bool isMultiplication(const Token& tok);
-  std::shared_ptr<AST::BaseNode> unary();
-  std::shared_ptr<AST::BaseNode> primary();
+  /**
+   * Parse the program and assemble each line into elf as soon as it has been
+   * parsed. An instruction whose operands are all registers and numbers is
+   * handed to the encoder straight from its tokens, without making any nodes.
+   * Other lines are parsed into nodes, which are added to the Root, and
+   * lowered from those. Operands which refer to labels are patched at the
+   * end, by Assembler::resolve().
+   *
+   * @returns the Root, holding only the lines which needed nodes.
+   * @throws ParserException upon invalid syntax, unless recovering; see
+   *   setDiagnostics().
+   * @throws AssemblerException upon a line which cannot be assembled.
+   */
+  std::shared_ptr<AST::Root> parseInto(Assembler& assembler, GBAS::ELF& elf);
+
+  /**
+   * Parse a single line and append it to program.
+   *
+   * @returns false if the line is invalid and the error was recorded, in
+   *   which case nothing is appended and the rest of the line is left
+   *   unconsumed.
+   */
+  bool line(IR::Program& program);
+
+  /**
+   * Parse a single line. Its nodes are made in the Arena of the Root the
+   * Parser was given, but the line itself is not added to it.
+   *
+   * @returns nullptr if the line is invalid and the error was recorded.
+   */
+  AST::BaseNode* line();
+  AST::BaseNode* instruction();
+
+  /**
+   * Parse an instruction and append it to program, as long as its operands
+   * are registers and numbers. Otherwise, the instruction is parsed into
+   * nodes instead, and nothing is appended.
+   *
+   * @returns nullptr if the instruction was appended to program, or else the
+   *   instruction node.
+   */
+  AST::BaseNode* instruction(IR::Program& program);
+  AST::BaseNode* operand();
+  AST::BaseNode* register_();
+  AST::BaseNode* dregister();
+  AST::BaseNode* condition();
+
+  /**
+   * Parse an operand which starts with "(": an Indirect node if the
+   * parentheses hold all of it, or else an expression.
+   */
+  AST::BaseNode* indirect();
+
+  /**
+   * Parse an expression by precedence climbing. Operands are joined by
+   * binary operators of at least minPrecedence, and the right operand of
+   * each operator takes every following operator which binds more tightly.
+   */
+  AST::BaseNode* expression(int minPrecedence = 1);
+
+  /**
+   * Parse the rest of an expression whose first operand, left, was already
+   * parsed.
+   */
+  AST::BaseNode* expression(AST::BaseNode* left, int minPrecedence);
+
+  /**
+   * The binary operator at the next token, or nullptr if there is none. An
+   * operator of two characters may also be two adjacent tokens, in which case
+   * nTokens is set to 2.
+   */
+  const OperatorProps* binaryOperator(int& nTokens);
+  AST::BaseNode* unary();
+  AST::BaseNode* primary();
 
   /**
    * Convert the next token into a Label node. Assumes that the parser has
    * already determined that the token *is* a valid label.
    */
-  std::shared_ptr<AST::BaseNode> label();
-  std::shared_ptr<AST::BaseNode> number();
-  std::shared_ptr<AST::BaseNode> directive();
+  AST::BaseNode* label();
+  AST::BaseNode* number();
+  AST::BaseNode* directive();
 
   /**
    * Read from tokens, starting at pos, until EOF is encountered.
@@ -523,142 +781,205 @@ class Parser {
    * Convert tok to a Register node, or raise an exception if this is not
    * possible.
    */
-  std::shared_ptr<AST::BaseRegister> parseRegister(const Token& tok);
+  AST::BaseRegister* parseRegister(const Token& tok);
 
   /**
    * Convert tok to a DRegister node, or raise an exception if this is not
    * possible.
    */
-  std::shared_ptr<AST::BaseDRegister> parseDRegister(const Token& tok);
+  AST::BaseDRegister* parseDRegister(const Token& tok);
 
   /**
    * Convert tok to a Number node, or raise an exception if this is not
    * possible.
    */
-  std::shared_ptr<AST::BaseNode> parseNumber(const Token& tok);
+  AST::BaseNode* parseNumber(std::string_view tok);
 
   /**
    * Convert tok to a NumericOp node, with lrand and rrand as its respective
    * operands.
    */
-  std::shared_ptr<AST::BaseNode> parseNumericOp(
-      std::shared_ptr<AST::BaseNode> lrand, const Token& tok,
-      std::shared_ptr<AST::BaseNode> rrand);
+  AST::BaseNode* parseNumericOp(
+      AST::BaseNode* lrand, const Token& tok,
+      AST::BaseNode* rrand);
 
   /**
    * Convert tok to an Instruction0. If this is not possible, raise an
    * exception.
    */
-  std::shared_ptr<AST::BaseNode> parseInstruction(const Token& tok);
+  AST::BaseNode* parseInstruction(const Token& tok);
 
   /**
    * Convert tok to an Instruction1, with rand as its parameter. If this is
    * not possible, raise an exception.
    */
-  std::shared_ptr<AST::BaseNode> parseInstruction(
-      const Token& tok, std::shared_ptr<AST::BaseNode> rand);
+  AST::BaseNode* parseInstruction(
+      const Token& tok, AST::BaseNode* rand);
   /**
    * Convert tok to an Instruction2, with rand1 and rand2 as its parameters.
    * If this is not possible, raise an exception.
    */
-  std::shared_ptr<AST::BaseNode> parseInstruction(
-      const Token& tok, std::shared_ptr<AST::BaseNode> rand1,
-      std::shared_ptr<AST::BaseNode> rand2);
+  AST::BaseNode* parseInstruction(
+      const Token& tok, AST::BaseNode* rand1,
+      AST::BaseNode* rand2);
 
-  std::shared_ptr<AST::BaseNode> parseInstruction(const Token& tok,
+  AST::BaseNode* parseInstruction(const Token& tok,
                                                   const TokenList& rands);
 
   /**
    * Convert tok to a Label node. If this is not possible, raise an exception.
    */
-  std::shared_ptr<AST::BaseNode> parseLabel(const Token& t);
+  AST::BaseNode* parseLabel(std::string_view t);
 
   /**
    * Convert tok to a Register, Number, or Label node. If this is not
    * possible, raise an exception.
    */
-  std::shared_ptr<AST::BaseNode> parseOperand(const Token& tok);
+  AST::BaseNode* parseOperand(const Token& tok);
 
   /**
    * True only if tok is one of +, -, *, or /.
    */
-  static bool isNumericOp(const Token& tok);
+  static bool isNumericOp(std::string_view tok);
 
   /**
    * Search the InstructionPropsList for properties associated with the
    * instruction tok.
    */
-  static InstructionPropsList::const_iterator findInstruction(const Token& tok);
+  static InstructionPropsList::const_iterator findInstruction(
+      std::string_view tok);
 
   /**
    * True only if tok is a valid instruction name.
    */
-  static bool isInstruction(const Token& tok);
+  static bool isInstruction(std::string_view tok);
 
   /**
    * Search the DirectivePropsList for properties matching the given token.
    */
-  static const DirectiveProps& findDirective(const Token& tok);
+  static const DirectiveProps& findDirective(std::string_view tok);
 
   /**
    * True only if tok starts with a period and a letter. Following that, the
    * directive must contain only letters, numbers, and underscores.
    */
-  static bool isDirective(const Token& tok);
+  static bool isDirective(std::string_view tok);
 
   /**
    * True only if tok starts with a letter and, following that, contains only
    * letters, numbers, and underscores.
    */
-  static bool isLabel(const Token& tok);
+  static bool isLabel(std::string_view tok);
 
   /**
    * True only if tok is one of a, f, b, c, d, e, h, l.
    */
-  static bool isRegister(const Token& tok);
+  static bool isRegister(std::string_view tok);
 
   /**
    * True only if tok is one of af, bc, de, hl, sp, or pc.
    */
-  static bool isDRegister(const Token& tok);
+  static bool isDRegister(std::string_view tok);
 
   /**
    * True only if tok is EOL.
    */
-  static bool isNewline(const Token& tok);
+  static bool isNewline(const TokenRecord& tok);
 
   /**
    * True only if tok is a comma.
    */
-  static bool isComma(const Token& tok);
+  static bool isComma(const TokenRecord& tok);
 
   /**
    * True only if tok is EOF.
    */
-  static bool isEof(const Token& tok);
+  static bool isEof(const TokenRecord& tok);
 
   /**
-   * Expect a newline in the provided TokenList in [start, start+max). If no
-   * newline is found in the provided range, return -1.
+   * True only if tok is the punctuation character c.
    */
-  static int expectNewline(const TokenList& list, int start, int max);
+  static bool isPunctuation(const TokenRecord& tok, char c);
+
+  /**
+   * Expect a newline in the provided TokenRecordList in [start, start+max). If
+   * no newline is found in the provided range, return -1.
+   */
+  static int expectNewline(const TokenRecordList& list, int start, int max);
 
  private:
-  TokenList mTokens;
-  AST::Root mRoot;
-  int mPos;
+  /**
+   * Parse the rest of the operands of inst, which follow operands, and make
+   * the instruction node.
+   */
+  AST::BaseNode* instruction(const TokenRecord& inst,
+                             std::vector<AST::BaseNode*> operands);
+
+  /**
+   * Find the instruction inst, checking that it takes nOperands operands.
+   *
+   * @returns nullptr if the error was recorded.
+   */
+  const InstructionProps* findInstruction(const TokenRecord& inst,
+                                          size_t nOperands);
+
+  /**
+   * Report an error at offset, or at the start of the current line if
+   * offset is SourceBuffer::NO_OFFSET. Without diagnostics this throws;
+   * otherwise the error is recorded and nullptr returned, which every parse
+   * function passes on to its caller.
+   */
+  std::nullptr_t fail(const char* msg, uint32_t offset);
+
+  /**
+   * Consume the rest of an invalid line, up to but not including its
+   * NEWLINE.
+   */
+  void skipLine();
+
+  /**
+   * Construct a node in the Arena of mRoot.
+   */
+  template <typename T, typename... Args>
+  T* make(Args&&... args) {
+    return mRoot->arena().make<T>(std::forward<Args>(args)...);
+  }
+
+  /**
+   * Stream owned by the Parser, when constructed from a TokenList.
+   */
+  std::unique_ptr<TokenStream> mOwnedTokens;
+  TokenStream& mTokens;
+  std::shared_ptr<AST::Root> mRoot;
+  DiagnosticList* mDiagnostics;
+  /**
+   * Offset of the first token of the line being parsed.
+   */
+  uint32_t mLineOffset;
 };
 
 class ParserException : std::exception {
  public:
-  ParserException(const char* msg) { mMsg = msg; }
+  ParserException(const char* msg)
+      : mMsg{msg}, mOffset{SourceBuffer::NO_OFFSET} {}
+
+  ParserException(const std::string& msg)
+      : mMsg{msg}, mOffset{SourceBuffer::NO_OFFSET} {}
 
-  ParserException(const std::string& msg) { mMsg = msg; }
+  ParserException(const std::string& msg, uint32_t offset)
+      : mMsg{msg}, mOffset{offset} {}
 
   virtual const char* what() const noexcept { return mMsg.c_str(); }
 
+  /**
+   * Source offset of the offending token, or SourceBuffer::NO_OFFSET if it
+   * is not known.
+   */
+  uint32_t offset() const { return mOffset; }
+
  private:
   std::string mMsg;
+  uint32_t mOffset;
 };
 
 #endif  // PARSER_H
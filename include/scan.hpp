@@ -0,0 +1,65 @@
+
+#ifndef SCAN_HPP
+#define SCAN_HPP
+
+#include <cstddef>
+
+/**
+ * Vectorized scanning primitives for the tokenizer. Each function looks for
+ * the end of a run of characters starting at pos and returns the position of
+ * the first character not in the run, or size if the run reaches the end of
+ * the input. Nothing at or past size is ever read.
+ *
+ * Wide loads are used when the CPU supports them (SSE2 on every x86-64 CPU,
+ * AVX2 when detected at startup); other targets use a scalar loop.
+ */
+namespace Scan {
+
+enum class Isa {
+  SCALAR,
+  SSE2,
+  AVX2,
+};
+
+/**
+ * Best instruction set supported by this CPU.
+ */
+Isa detect();
+
+/**
+ * Instruction set currently used by the scanning functions.
+ */
+Isa selected();
+
+/**
+ * Force the scanning functions to use isa. Intended for tests and benchmarks;
+ * selecting an instruction set the CPU does not support is undefined.
+ */
+void select(Isa isa);
+
+const char* name(Isa isa);
+
+/**
+ * Find the next '\n'.
+ */
+size_t findNewline(const char* data, size_t pos, size_t size);
+
+/**
+ * Skip a run of ' '.
+ */
+size_t skipSpaces(const char* data, size_t pos, size_t size);
+
+/**
+ * Skip a run of characters which may appear inside an identifier or number:
+ * letters, digits, '.', '_' and '\\'.
+ */
+size_t identifierEnd(const char* data, size_t pos, size_t size);
+
+/**
+ * Find the next '"'.
+ */
+size_t stringEnd(const char* data, size_t pos, size_t size);
+
+};  // namespace Scan
+
+#endif  // SCAN_HPP
@@ -0,0 +1,108 @@
+
+#ifndef SOURCE_BUFFER_HPP
+#define SOURCE_BUFFER_HPP
+
+#include <cstdint>
+#include <exception>
+#include <string>
+#include <string_view>
+#include <vector>
+
+/**
+ * Human-readable position in a source file. Lines and columns count from 1.
+ */
+struct SourceLocation {
+  uint32_t line;
+  uint32_t column;
+};
+
+/**
+ * An error in a source file which was recovered from, so that reading went
+ * on past it.
+ */
+struct Diagnostic {
+  /**
+   * Position in the source of the offending text.
+   */
+  uint32_t offset;
+  std::string message;
+};
+
+using DiagnosticList = std::vector<Diagnostic>;
+
+/**
+ * Read-only contents of an entire source file. Files are memory-mapped so that
+ * tokens can refer back into the buffer instead of owning a copy of their
+ * text. A SourceBuffer can also be built from a string (e.g. in tests), in
+ * which case it owns that string.
+ */
+class SourceBuffer {
+ public:
+  /**
+   * Offset of something which did not come from a source file.
+   */
+  static constexpr uint32_t NO_OFFSET = UINT32_MAX;
+
+  explicit SourceBuffer(std::string text);
+
+  SourceBuffer(SourceBuffer&& other) noexcept;
+
+  SourceBuffer& operator=(SourceBuffer&& other) noexcept;
+
+  SourceBuffer(const SourceBuffer&) = delete;
+
+  SourceBuffer& operator=(const SourceBuffer&) = delete;
+
+  ~SourceBuffer();
+
+  /**
+   * Memory-map the file at path.
+   *
+   * @throws SourceBufferException if the file cannot be opened or mapped.
+   */
+  static SourceBuffer map(const std::string& path);
+
+  const char* data() const { return mData; }
+
+  size_t size() const { return mSize; }
+
+  std::string_view text() const { return std::string_view{mData, mSize}; }
+
+  std::string_view text(uint32_t offset, uint32_t length) const {
+    return std::string_view{mData + offset, length};
+  }
+
+  /**
+   * Find the line and column of offset. The first lookup indexes the start
+   * of every line; lookups after that are a binary search.
+   */
+  SourceLocation locate(uint32_t offset) const;
+
+ private:
+  SourceBuffer(const char* data, size_t size);
+
+  void release();
+
+  const char* mData;
+  size_t mSize;
+  bool mMapped;
+  std::string mOwned;
+  /**
+   * Offset of the start of each line, built on first use by locate().
+   */
+  mutable std::vector<uint32_t> mLineStarts;
+};
+
+class SourceBufferException : std::exception {
+ public:
+  SourceBufferException(const char* msg) { mMsg = msg; }
+
+  SourceBufferException(const std::string& msg) { mMsg = msg; }
+
+  virtual const char* what() const noexcept { return mMsg.c_str(); }
+
+ private:
+  std::string mMsg;
+};
+
+#endif  // SOURCE_BUFFER_HPP
@@ -0,0 +1,207 @@
+
+#ifndef TOKEN_STREAM_HPP
+#define TOKEN_STREAM_HPP
+
+#include <istream>
+#include <string>
+#include <string_view>
+
+#include "source_buffer.hpp"
+#include "tokenizer.hpp"
+
+/**
+ * Pull-based source of TokenRecords. Tokens are produced a line at a time as
+ * they are consumed, so only a small window of records (and, for streams
+ * that read their input, of text) is alive at once.
+ *
+ * Every line ends with a NEWLINE record and the stream ends with a single END
+ * record. Reading past the end keeps returning END.
+ */
+class TokenStream {
+ public:
+  TokenStream();
+
+  virtual ~TokenStream() {}
+
+  TokenStream(const TokenStream&) = delete;
+
+  TokenStream& operator=(const TokenStream&) = delete;
+
+  /**
+   * Consume and return the next token.
+   */
+  TokenRecord next() {
+    if (mPos < mWindow.size() || ensure(1)) {
+      return mWindow[mPos++];
+    }
+    return mEnd;
+  }
+
+  /**
+   * Return the next token without consuming it.
+   */
+  const TokenRecord& peek() {
+    if (mPos < mWindow.size() || ensure(1)) {
+      return mWindow[mPos];
+    }
+    return mEnd;
+  }
+
+  /**
+   * Return the token after the next one without consuming anything.
+   */
+  const TokenRecord& peekNext() {
+    if (mPos + 1 < mWindow.size() || ensure(2)) {
+      return mWindow[mPos + 1];
+    }
+    return mEnd;
+  }
+
+  /**
+   * Source text of tok. This is only valid for tokens in the window, i.e. the
+   * ones which may still be peeked, and those on the line of the most
+   * recently consumed token.
+   */
+  std::string_view text(const TokenRecord& tok) const {
+    return mText.substr(tok.offset - mTextOffset, tok.length);
+  }
+
+  /**
+   * Have streams which tokenize their input recover from invalid lines,
+   * appending an error to diagnostics for each; see
+   * Tokenizer::setDiagnostics(). nullptr goes back to throwing.
+   */
+  void setDiagnostics(DiagnosticList* diagnostics) {
+    mDiagnostics = diagnostics;
+  }
+
+ protected:
+  /**
+   * Append the tokens of the next line, including its NEWLINE, to window. At
+   * the end of the input, append END instead and return false.
+   *
+   * When window is empty the text of every earlier line may be discarded.
+   *
+   * @throws TokenizerException upon invalid input, unless diagnostics() is
+   *   set.
+   */
+  virtual bool fill(TokenRecordList& window) = 0;
+
+  /**
+   * Where to record errors in the input, or nullptr to throw them.
+   */
+  DiagnosticList* diagnostics() const { return mDiagnostics; }
+
+  /**
+   * Make tokens refer into text, where text begins at offset in the input.
+   */
+  void setText(std::string_view text, uint32_t offset) {
+    mText = text;
+    mTextOffset = offset;
+  }
+
+ private:
+  /**
+   * Read lines until the window holds at least n unconsumed tokens or the
+   * input is exhausted. The checks in next() and the peeks skip the call
+   * while the window already holds enough.
+   */
+  bool ensure(size_t n);
+
+  TokenRecordList mWindow;
+  size_t mPos;
+  bool mDone;
+  TokenRecord mEnd;
+  std::string_view mText;
+  uint32_t mTextOffset;
+  DiagnosticList* mDiagnostics;
+};
+
+/**
+ * Tokenize a SourceBuffer on demand. The text stays in the buffer, so token
+ * text remains valid for as long as the buffer does.
+ */
+class SourceTokenStream : public TokenStream {
+ public:
+  SourceTokenStream(const SourceBuffer& source);
+
+ protected:
+  virtual bool fill(TokenRecordList& window) override;
+
+ private:
+  Tokenizer mTokenizer;
+  const SourceBuffer& mSource;
+  size_t mPos;
+  int mLineno;
+};
+
+/**
+ * Tokenize an input stream a line at a time, so that parsing can begin before
+ * the whole input has been read.
+ */
+class InputTokenStream : public TokenStream {
+ public:
+  InputTokenStream(std::istream& input);
+
+ protected:
+  virtual bool fill(TokenRecordList& window) override;
+
+ private:
+  Tokenizer mTokenizer;
+  std::istream& mInput;
+  /**
+   * Text of the lines with tokens in the window.
+   */
+  std::string mLines;
+  std::string mLine;
+  uint32_t mLinesOffset;
+  uint32_t mOffset;
+  int mLineno;
+};
+
+/**
+ * Adapter presenting TokenRecords which have already been read from a
+ * SourceBuffer, e.g. by the multi-threaded tokenizer, as a stream.
+ */
+class TokenRecordStream : public TokenStream {
+ public:
+  TokenRecordStream(const SourceBuffer& source, TokenRecordList tokens);
+
+ protected:
+  virtual bool fill(TokenRecordList& window) override;
+
+ private:
+  TokenRecordList mTokens;
+  size_t mPos;
+  uint32_t mSize;
+};
+
+/**
+ * Adapter presenting an already tokenized TokenList as a stream. The reserved
+ * tokens "EOL" and "EOF" become NEWLINE and END.
+ *
+ * The list is borrowed, not copied, and must outlive the stream. Its tokens
+ * are classified a line at a time as they are pulled, and only the text of
+ * the lines in the window is kept.
+ */
+class TokenListStream : public TokenStream {
+ public:
+  TokenListStream(const TokenList& tokens);
+
+  TokenListStream(TokenList&&) = delete;
+
+ protected:
+  virtual bool fill(TokenRecordList& window) override;
+
+ private:
+  const TokenList& mTokens;
+  size_t mPos;
+  /**
+   * Text of the lines with tokens in the window.
+   */
+  std::string mLines;
+  uint32_t mLinesOffset;
+  uint32_t mOffset;
+};
+
+#endif  // TOKEN_STREAM_HPP
@@ -6,8 +6,12 @@
 #include <iostream>
 #include <sstream>
 #include <string>
+#include <string_view>
 #include <vector>
 
+#include "keywords.hpp"
+#include "source_buffer.hpp"
+
 using Token = std::string;
 
 class TokenizerException : std::exception {
@@ -18,6 +22,10 @@ class TokenizerException : std::exception {
 
   virtual const char* what() const throw() { return mMsg.c_str(); };
 
+  int line() const { return mLine; }
+
+  int column() const { return mCol; }
+
  private:
   std::string mMsg;
   int mLine;
@@ -26,27 +34,165 @@ class TokenizerException : std::exception {
 
 using TokenList = std::vector<Token>;
 
+enum class TokenKind : uint8_t {
+  IDENTIFIER,
+  NUMBER,
+  STRING,
+  PUNCTUATION,
+  NEWLINE,
+  END,
+};
+
+/**
+ * Fixed-size token record. Rather than owning a copy of its text, a record
+ * refers to its span in the SourceBuffer it was read from, and carries its
+ * classification so that the parser can dispatch on an integer instead of
+ * comparing strings. NEWLINE and END have no text and a length of zero.
+ */
+struct TokenRecord {
+  TokenRecord() : TokenRecord{TokenKind::END, 0, 0, 0} {}
+
+  TokenRecord(TokenKind kind, uint32_t offset, uint32_t length, uint32_t value,
+              Keyword keyword = Keyword{KeywordKind::NONE, 0})
+      : kind{kind},
+        keyword{keyword},
+        offset{offset},
+        length{length},
+        value{value} {}
+
+  TokenKind kind;
+  /**
+   * For an IDENTIFIER, the keyword it spells, if any. This fits in what would
+   * otherwise be padding.
+   */
+  Keyword keyword;
+  uint32_t offset;
+  uint32_t length;
+  /**
+   * Pre-decoded payload: the value of a NUMBER, truncated to 32 bits, or the
+   * character of a PUNCTUATION token. Zero for every other kind.
+   */
+  uint32_t value;
+};
+
+static_assert(sizeof(TokenRecord) == 16, "TokenRecord should stay compact");
+
+using TokenRecordList = std::vector<TokenRecord>;
+
 const int MAX_LINE_LEN = 128;
 class Tokenizer {
  public:
+  Tokenizer();
+
+  /**
+   * Tokenizer which writes its error messages to log instead of std::cerr.
+   */
+  explicit Tokenizer(std::ostream& log);
+
+  /**
+   * Recover from invalid input instead of throwing: each error is appended to
+   * diagnostics, and the tokens of its line are dropped, leaving only the
+   * NEWLINE. Nothing is written to the log. nullptr goes back to throwing.
+   */
+  void setDiagnostics(DiagnosticList* diagnostics) {
+    mDiagnostics = diagnostics;
+  }
+
   TokenList tokenize(std::basic_istream<char>& lines);
+
+  /**
+   * Tokenize an entire SourceBuffer. No token text is copied: every token
+   * refers to its position in source, which must outlive the returned list.
+   *
+   * @throws TokenizerException upon invalid input.
+   */
+  TokenRecordList tokenize(const SourceBuffer& source);
+
+  /**
+   * Tokenize an entire SourceBuffer using up to threads threads. The input is
+   * split into chunks at line boundaries, which are tokenized independently
+   * and concatenated in order, so the result is exactly that of
+   * tokenize(source). Inputs too small to be worth splitting are tokenized on
+   * the calling thread.
+   *
+   * @param threads: Maximum number of threads, or 0 for one per hardware
+   *   thread.
+   * @throws TokenizerException upon invalid input. If several chunks are
+   *   invalid, the error is the one closest to the start of the input.
+   */
+  TokenRecordList tokenize(const SourceBuffer& source, unsigned threads);
+
+  /**
+   * Smallest chunk of input worth handing to a thread of its own.
+   */
+  static const size_t MIN_CHUNK_SIZE = 256 * 1024;
+
+  /**
+   * Tokenize a single line, which must not contain its terminating newline,
+   * and append its tokens followed by a NEWLINE to tokens.
+   *
+   * @param offset: Position of the start of the line in its source.
+   * @param lineno: Line number for error messages.
+   * @returns false if the line was invalid and its tokens were dropped.
+   * @throws TokenizerException upon invalid input, unless recovering.
+   */
+  bool tokenizeLine(std::string_view line, uint32_t offset, int lineno,
+                    TokenRecordList& tokens);
+
+  /**
+   * Classify the text of a single token and decode its payload. Numbers may
+   * be decimal (123), hexadecimal ($7f or 0x7f), binary (%1010) or a
+   * character literal ('A').
+   *
+   * @param text: Token text, which must not be a reserved word.
+   * @param offset: Position of the token in its source.
+   */
+  static TokenRecord classify(std::string_view text, uint32_t offset);
+
+  /**
+   * Text of a TokenRecord. NEWLINE and END map to the reserved spellings
+   * "EOL" and "EOF".
+   */
+  static std::string_view text(const SourceBuffer& source,
+                               const TokenRecord& tok);
+
+  /**
+   * Adapter from TokenRecords to a TokenList of strings. This copies the text
+   * of every token.
+   */
+  static TokenList toTokenList(const SourceBuffer& source,
+                               const TokenRecordList& tokens);
+
   static bool isReserved(Token tok);
   static bool isOperator(char c);
 
  private:
   static const std::array<Token, 2> reserved;
   static const std::array<char, 4> operators;
+  std::ostream* mLog;
+  DiagnosticList* mDiagnostics;
   void logError(std::ostream& out, const std::string& msg,
-                const std::string& line, int lineno, int col);
-
-  enum class State {
-    START_LINE,
-    START_TOKEN,
-    STRING_TOKEN,
-    TOKEN,
-    END_TOKEN,
-    END_LINE,
-  };
+                std::string_view line, int lineno, int col);
+
+  /**
+   * Run the tokenizer state machine over a single line, which must not
+   * contain the terminating newline. emit(pos, len) is called with the
+   * position of each token relative to the start of the line, which is at
+   * offset in its source.
+   *
+   * @returns false if the line is invalid and the error was recorded in
+   *   mDiagnostics. Tokens emitted before the error are the caller's to drop.
+   */
+  template <typename Emit>
+  bool tokenizeLine(std::string_view line, uint32_t offset, int lineno,
+                    Emit&& emit);
+
+  /**
+   * Tokenize the lines in [begin, end) of data, which must either be empty or
+   * start at the beginning of a line. lineno is the number of the first line.
+   */
+  void tokenizeLines(const char* data, size_t begin, size_t end, int lineno,
+                     TokenRecordList& tokens);
 };
 
 #endif  // TOKENIZER_H
@@ -1,10 +1,11 @@
 
 #include <algorithm>
-#include <map>
+#include <cstdint>
 #include <memory>
 
 #include "assembler.hpp"
 #include "char_utils.hpp"
+#include "opcodes.hpp"
 
 using namespace AST;
 using namespace GBAS;
@@ -12,808 +13,886 @@ using namespace GBAS;
 Assembler::Assembler() { }
 
 void Assembler::assemble(std::shared_ptr<AST::Root> ast, ELF& elf) {
-  // This could live on the stack
-  for (auto it = ast->begin(); it != ast->end(); it++) {
-    auto node = *it;
-    switch (node->id()) {
-      case NodeType::DIRECTIVE:
-        {
-          auto directive = std::dynamic_pointer_cast<Directive>(node);
-          switch (directive->type()) {
-            case DirectiveType::SECTION:
-              {
-                elf.set_section(directive->operands().at(0));
-              }
-              break;
-            default:
-              throw AssemblerException{"Invalid directive type"};
-          }
-        }
-        break;
-      case NodeType::INSTRUCTION:
-        assembleInstruction(elf,
-                            *std::dynamic_pointer_cast<BaseInstruction>(node));
-        break;
-      case NodeType::LABEL:
-        {
-          auto label = std::dynamic_pointer_cast<Label>(node);
-          size_t value = 0;
-          // uint8_t info = ELF32_ST_BIND(STB_GLOBAL);
-          // uint16_t other;
-          // TODO support bindings other than GLOBAL
-          // TODO add checks for info in ELF
-          //switch (mCurrSectionType) {
-          //  case SectionType::DATA:
-          //    value = elf.dataSize();
-          //    info |= ELF32_ST_TYPE(STT_OBJECT);
-          //    other = elf.dataIdx();
-          //    break;
-          //  case SectionType::RODATA:
-          //    value = elf.rodataSize();
-          //    info |= ELF32_ST_TYPE(STT_OBJECT);
-          //    other = elf.rodataIdx();
-          //    break;
-          //  case SectionType::BSS:
-          //    value = elf.bssSize();
-          //    info |= ELF32_ST_TYPE(STT_OBJECT);
-          //    other = elf.bssIdx();
-          //    break;
-          //  case SectionType::TEXT:
-          //    value = elf.textSize();
-          //    info |= ELF32_ST_TYPE(STT_FUNC);
-          //    other = elf.textIdx();
-          //    break;
-          //  case SectionType::INIT:
-          //    value = elf.initSize();
-          //    info |= ELF32_ST_TYPE(STT_FUNC);
-          //    other = elf.initIdx();
-          //    break;
-          //  default:
-          //    throw AssemblerException("Invalid section type");
-          //}
-          // TODO relocatable
-          //elf.add_symbol(label->name(), value, 0, info, STV_DEFAULT, other, true);
-          elf.add_symbol(label->name(), value, 0, ISection::Type{},
-              ISection::Binding{}.global(), ISection::Visibility{}, false);
-        }
-        break;
-      default:
-        throw AssemblerException("Invalid node");
-    }
+  auto program = lower(ast);
+  assemble(program, elf);
+  resolve(program, elf);
+}
+
+namespace {
+
+/**
+ * Deepest nesting of operations in an expression. Evaluating an expression
+ * recurses once per level.
+ */
+constexpr size_t MAX_EXPRESSION_DEPTH = 64;
+
+/**
+ * Value of l op r, wrapping around on overflow. Like GNU as, comparisons are
+ * -1 when true and 0 when false, and the logical operators 1 or 0.
+ */
+int32_t fold(BinaryOpType type, int32_t l, int32_t r) {
+  auto ul = static_cast<uint32_t>(l), ur = static_cast<uint32_t>(r);
+  switch (type) {
+    case BinaryOpType::ADD:
+      return static_cast<int32_t>(ul + ur);
+    case BinaryOpType::SUB:
+      return static_cast<int32_t>(ul - ur);
+    case BinaryOpType::MULT:
+      return static_cast<int32_t>(ul * ur);
+    case BinaryOpType::DIV:
+    case BinaryOpType::MOD:
+      if (r == 0) {
+        throw AssemblerException("Division by zero");
+      } else if (r == -1) {
+        // The one quotient which does not fit
+        return type == BinaryOpType::DIV ? static_cast<int32_t>(0 - ul) : 0;
+      }
+      return type == BinaryOpType::DIV ? l / r : l % r;
+    case BinaryOpType::SHL:
+      return ur < 32 ? static_cast<int32_t>(ul << ur) : 0;
+    case BinaryOpType::SHR:
+      return ur < 32 ? l >> ur : (l < 0 ? -1 : 0);
+    case BinaryOpType::AND:
+      return l & r;
+    case BinaryOpType::OR:
+      return l | r;
+    case BinaryOpType::XOR:
+      return l ^ r;
+    case BinaryOpType::EQ:
+      return -(l == r);
+    case BinaryOpType::NE:
+      return -(l != r);
+    case BinaryOpType::LT:
+      return -(l < r);
+    case BinaryOpType::GT:
+      return -(l > r);
+    case BinaryOpType::LE:
+      return -(l <= r);
+    case BinaryOpType::GE:
+      return -(l >= r);
+    case BinaryOpType::LAND:
+      return l != 0 && r != 0;
+    case BinaryOpType::LOR:
+      return l != 0 || r != 0;
+    default:
+      throw AssemblerException("Invalid BinaryOpType");
   }
 }
 
 /**
- * Encode the register as a two-bit number. 'm' is a special cheater value for
- * (hl).
+ * Value of op rand, wrapping around on overflow.
  */
-constexpr uint8_t encodeRegister(char reg) {
-  switch (reg) {
-    case 'b':
-      return 0;
-    case 'c':
-      return 1;
-    case 'd':
-      return 2;
-    case 'e':
-      return 3;
-    case 'h':
-      return 4;
-    case 'l':
-      return 5;
-    case 'm':
-      return 6;
-    case 'a':
-      return 7;
+int32_t fold(UnaryOpType type, int32_t rand) {
+  switch (type) {
+    case UnaryOpType::NEG:
+      return static_cast<int32_t>(0 - static_cast<uint32_t>(rand));
+    case UnaryOpType::NOT:
+      return ~rand;
+    case UnaryOpType::LNOT:
+      return rand == 0;
     default:
-      throw AssemblerException("Invalid register");
+      throw AssemblerException("Invalid UnaryOpType");
   }
 }
 
-constexpr uint8_t encodeDRegister(char reg0, char reg1) {
-  if (reg0 == 'b' && reg1 == 'c') {
-    return 0;
-  } else if (reg0 == 'd' && reg1 == 'e') {
-    return 1;
-  } else if (reg0 == 'h' && reg1 == 'l') {
-    return 2;
-  } else if (reg0 == 'a' && reg1 == 'f') {
-    return 3;
-  } else {
-    throw AssemblerException("Invalid register");
+/**
+ * Check that value fits an 8-bit field, either signed or unsigned.
+ *
+ * @throws AssemblerException if it does not.
+ */
+uint8_t imm8(int32_t value) {
+  if (value < INT8_MIN || value > UINT8_MAX) {
+    throw AssemblerException("Value " + std::to_string(value) +
+                             " does not fit in 8 bits");
   }
+  return static_cast<uint8_t>(value);
 }
 
-// TODO this works for single-operand ALU instrs but not INC/DEC
+/**
+ * Check that value fits a 16-bit field, either signed or unsigned.
+ *
+ * @throws AssemblerException if it does not.
+ */
+uint16_t imm16(int32_t value) {
+  if (value < INT16_MIN || value > UINT16_MAX) {
+    throw AssemblerException("Value " + std::to_string(value) +
+                             " does not fit in 16 bits");
+  }
+  return static_cast<uint16_t>(value);
+}
 
 /**
- * Instruction with a single register operand:
- *   A ← A op reg
+ * Value of operand n of program line i, if it is a constant.
  */
-struct InstructionRA {
-  InstructionType typ;
-  char reg;
-
-  constexpr uint8_t encode() {
-    switch (typ) {
-      case InstructionType::SUB: {
-        uint8_t opcode = 0x12;
-        return (opcode << 3) | encodeRegister(reg);
-      } break;
-      case InstructionType::SBC: {
-        uint8_t opcode = 0x13;
-        return (opcode << 3) | encodeRegister(reg);
-      } break;
-      case InstructionType::AND: {
-        uint8_t opcode = 0x14;
-        return (opcode << 3) | encodeRegister(reg);
-      } break;
-      case InstructionType::XOR: {
-        uint8_t opcode = 0x15;
-        return (opcode << 3) | encodeRegister(reg);
-      } break;
-      case InstructionType::OR: {
-        uint8_t opcode = 0x16;
-        return (opcode << 3) | encodeRegister(reg);
-      } break;
-      case InstructionType::CP: {
-        uint8_t opcode = 0x17;
-        return (opcode << 3) | encodeRegister(reg);
-      } break;
-      default:
-        throw AssemblerException("Invalid InstructionRA type");
-    }
+std::optional<int32_t> constant(const IR::Program& program, size_t i,
+                                size_t n) {
+  auto value = program.operands[n][i];
+  switch (program.operandKinds[n][i]) {
+    case IR::OperandKind::NUMBER:
+      return static_cast<int32_t>(value);
+    case IR::OperandKind::EXPRESSION:
+    case IR::OperandKind::ADDRESS:
+    case IR::OperandKind::STACK_OFFSET:
+      // Constant expressions were folded when they were added
+      if (program.expressions.op(value) == IR::Op::NUMBER) {
+        return static_cast<int32_t>(program.expressions.left(value));
+      }
+      return std::nullopt;
+    default:
+      return std::nullopt;
   }
-};
+}
 
 /**
- * "Unary" instruction operating on a register:
- *   reg ← op reg
+ * Check that value is a bit index, from 0 to 7.
+ *
+ * @throws AssemblerException if it is not.
  */
-struct InstructionR {
-  InstructionType typ;
-  char reg;
-
-  constexpr uint8_t encode() {
-    uint8_t prefix = 0x0;
-    switch (typ) {
-      case InstructionType::INC: {
-        uint8_t opcode = 0x4;
-        return (prefix << 6) | encodeRegister(reg) | opcode;
-      } break;
-      case InstructionType::DEC: {
-        uint8_t opcode = 0x5;
-        return (prefix << 6) | encodeRegister(reg) | opcode;
-      } break;
-      default:
-        throw AssemblerException("Invalid InstructionR");
-    }
+uint8_t bitIndex(int32_t value) {
+  if (value < 0 || value > 7) {
+    throw AssemblerException("Bit index " + std::to_string(value) +
+                             " is out of range");
   }
-};
+  return static_cast<uint8_t>(value);
+}
 
 /**
- * Instruction with a register and an immediate for operands:
- *   reg ← reg op imm8
+ * Check that value is the address of a restart, a multiple of 8 from $00 to
+ * $38.
+ *
+ * @throws AssemblerException if it is not.
  */
-template <uint8_t prefix, char reg>
-struct InstructionRI8 {
-  constexpr uint16_t encode() {
-    static_assert((prefix & 0xfc) == 0x00);
-    return (prefix << 6) | (encodeRegister(reg) << 3) | 0x6;
+uint8_t restartVector(int32_t value) {
+  if ((value & ~0x38) != 0) {
+    throw AssemblerException("Invalid restart vector " +
+                             std::to_string(value));
   }
-};
+  return static_cast<uint8_t>(value);
+}
 
 /**
- * Instruction with a dregister for an operand:
- *   dreg ← op dreg
+ * Low byte of an address from $ff00 to $ffff, which may also be written as
+ * just its low byte.
+ *
+ * @throws AssemblerException if value is neither.
  */
-struct InstructionD {
-  InstructionType typ;
-  char reg0, reg1;
-  constexpr uint8_t encode() {
-    switch (typ) {
-      case InstructionType::INC: {
-        uint8_t prefix = 0x0, opcode = 0x3;
-        return (prefix << 6) | (encodeDRegister(reg0, reg1) << 4) | opcode;
-      } break;
-      case InstructionType::DEC: {
-        uint8_t prefix = 0x0, opcode = 0xb;
-        return (prefix << 6) | (encodeDRegister(reg0, reg1) << 4) | opcode;
-      } break;
-      case InstructionType::POP: {
-        uint8_t prefix = 0x3, opcode = 0x1;
-        return (prefix << 6) | (encodeDRegister(reg0, reg1) << 4) | opcode;
-      } break;
-      case InstructionType::PUSH: {
-        uint8_t prefix = 0x3, opcode = 0x5;
-        return (prefix << 6) | (encodeDRegister(reg0, reg1) << 4) | opcode;
-      } break;
-      default:
-        throw AssemblerException("Invalid InstructionD");
-    }
+uint8_t highAddress(int32_t value) {
+  if (value >= 0xff00 && value <= 0xffff) {
+    return static_cast<uint8_t>(value);
+  } else if (value < 0 || value > 0xff) {
+    throw AssemblerException("Address " + std::to_string(value) +
+                             " is not from $ff00 to $ffff");
   }
-};
+  return static_cast<uint8_t>(value);
+}
 
 /**
- * Instruction with a (dregister) for an operand.
+ * Number of bytes of an immediate encoded as field.
  */
-struct InstructionA {
-  InstructionType typ;
-  char reg0, reg1;
-  constexpr uint8_t encode() {
-    if (reg0 != 'h' || reg1 != 'l') {
-      throw AssemblerException("Invalid register for InstructionA");
-    }
-    switch (typ) {
-      // TODO gonna have to refactor parser stuff to retain parens so we can
-      // differentiate between e.g. INC HL and INC (HL).
-      case InstructionType::INC:
-        return 0x34;
-        break;
-      case InstructionType::DEC:
-        return 0x35;
-        break;
-      case InstructionType::JP:
-        return 0xe9;
-        break;
-      default:
-        throw AssemblerException("Invalid InstructionA");
-    }
+size_t fieldSize(Operand field) {
+  return field == Operand::IMM16 || field == Operand::IND16 ? 2 : 1;
+}
+
+/**
+ * Encode value as field into the fieldSize(field) bytes at out.
+ *
+ * @throws AssemblerException if value does not fit field.
+ */
+void encodeField(Operand field, int32_t value, uint8_t* out) {
+  switch (field) {
+    case Operand::IMM16:
+    case Operand::IND16: {
+      // Little-endian, like every 16-bit immediate of the SM83
+      auto imm = imm16(value);
+      out[0] = static_cast<uint8_t>(imm & 0xff);
+      out[1] = static_cast<uint8_t>(imm >> 8);
+    } break;
+    case Operand::IND8:
+      out[0] = highAddress(value);
+      break;
+    default:
+      out[0] = imm8(value);
+      break;
   }
-};
+}
 
 /**
- * Instruction with a dregister and a 16-bit immediate for operands:
- *   dreg ← dreg op imm16
+ * How operand n of program line i is written, for looking up its opcode.
+ *
+ * @throws AssemblerException upon a register which no instruction takes.
  */
-template <uint8_t prefix, char reg0, char reg1, uint8_t opcode, uint16_t imm>
-struct InstructionDI16 {
-  constexpr uint32_t encode() {
-    static_assert((prefix & 0xfc) == 0x00);
-    static_assert((opcode & 0xf0) == 0x00);
-    uint8_t instr = (prefix << 6) | (encodeDRegister(reg0, reg1) << 4) | opcode;
-    return (instr << 16) | imm;
+Operand operandForm(const IR::Program& program, size_t i, size_t n) {
+  auto value = program.operands[n][i];
+  switch (program.operandKinds[n][i]) {
+    case IR::OperandKind::NONE:
+      return Operand::NONE;
+    case IR::OperandKind::REGISTER:
+      switch (static_cast<char>(value)) {
+        case 'a':
+          return Operand::A;
+        case 'b':
+          return Operand::B;
+        case 'c':
+          return Operand::C;
+        case 'd':
+          return Operand::D;
+        case 'e':
+          return Operand::E;
+        case 'h':
+          return Operand::H;
+        case 'l':
+          return Operand::L;
+        default:
+          throw AssemblerException("Invalid register");
+      }
+    case IR::OperandKind::DREGISTER:
+      switch (value) {
+        case 'a' << 8 | 'f':
+          return Operand::AF;
+        case 'b' << 8 | 'c':
+          return Operand::BC;
+        case 'd' << 8 | 'e':
+          return Operand::DE;
+        case 'h' << 8 | 'l':
+          return Operand::HL;
+        case 's' << 8 | 'p':
+          return Operand::SP;
+        default:
+          throw AssemblerException("Invalid register");
+      }
+    case IR::OperandKind::CONDITION:
+      switch (static_cast<ConditionType>(value)) {
+        case ConditionType::NZ:
+          return Operand::NZ;
+        case ConditionType::Z:
+          return Operand::Z;
+        case ConditionType::NC:
+          return Operand::NC;
+        default:
+          throw AssemblerException("Invalid condition");
+      }
+    case IR::OperandKind::POINTER:
+      switch (value) {
+        case 'c':
+          return Operand::C_IND;
+        case 'b' << 8 | 'c':
+          return Operand::BC_IND;
+        case 'd' << 8 | 'e':
+          return Operand::DE_IND;
+        case 'h' << 8 | 'l':
+          return Operand::HL_IND;
+        case '+' << 16 | 'h' << 8 | 'l':
+          return Operand::HLI_IND;
+        case '-' << 16 | 'h' << 8 | 'l':
+          return Operand::HLD_IND;
+        default:
+          throw AssemblerException("Invalid register in parentheses");
+      }
+    case IR::OperandKind::ADDRESS:
+      return Operand::IMM_IND;
+    case IR::OperandKind::STACK_OFFSET:
+      return Operand::SP_IMM;
+    default:
+      return Operand::IMM;
   }
+}
+
+/**
+ * A subexpression being compiled: either a constant, which only gets a node
+ * if an operation on something else needs it, or the id of its node.
+ */
+struct Compiled {
+  std::optional<int32_t> value;
+  uint32_t node;
 };
 
 /**
- * Instruction with two register operands:
- *   rd ← rd op rs,
- *   rd ← rs
+ * Id of the node of compiled, adding it if it is a constant.
  */
-template <uint8_t prefix, char rd, char rs>
-struct InstructionRR {
-  constexpr uint8_t encode() {
-    static_assert((prefix & 0xfc) == 0);
-    return (prefix << 6) | (encodeRegister(rd) << 3) | encodeRegister(rs);
+uint32_t nodeOf(IR::ExpressionDag& dag, const Compiled& compiled) {
+  if (compiled.value) {
+    return dag.add(IR::Op::NUMBER, static_cast<uint32_t>(*compiled.value));
   }
-};
+  return compiled.node;
+}
 
 /**
- * Instruction with a flag and 8-bit immediate.
+ * Compile the expression below node, folding its constant subexpressions.
  */
-template <uint8_t prefix, uint8_t flag, uint8_t opcode, uint8_t imm8>
-struct InstructionFI8 {
-  constexpr uint8_t encode() {
-    static_assert((prefix & 0xfc) == 0);
-    static_assert((opcode & 0xc0) == 0);
-    return (prefix << 6) | opcode;
+Compiled compileNode(IR::Program& program, BaseNode* node, size_t depth) {
+  if (depth > MAX_EXPRESSION_DEPTH) {
+    throw AssemblerException("Expression nested too deeply");
   }
-};
+  auto& dag = program.expressions;
+  return std::visit(
+      Overloaded{
+          [&](Number* num) { return Compiled{num->value(), 0}; },
+          [&](Label* label) {
+            auto name = program.name(label->name());
+            return Compiled{std::nullopt, dag.add(IR::Op::LABEL, name)};
+          },
+          [&](BaseUnaryOp* op) {
+            auto operand = compileNode(program, op->operand(), depth + 1);
+            if (operand.value) {
+              return Compiled{fold(op->opType(), *operand.value), 0};
+            }
+            return Compiled{std::nullopt,
+                            dag.add(IR::unaryOp(op->opType()), operand.node)};
+          },
+          [&](BaseBinaryOp* op) {
+            auto left = compileNode(program, op->left(), depth + 1);
+            auto right = compileNode(program, op->right(), depth + 1);
+            if (left.value && right.value) {
+              return Compiled{fold(op->opType(), *left.value, *right.value), 0};
+            }
+            return Compiled{std::nullopt, dag.add(IR::binaryOp(op->opType()),
+                                                  nodeOf(dag, left),
+                                                  nodeOf(dag, right))};
+          },
+          [](auto) -> Compiled {
+            throw AssemblerException("Invalid node in expression");
+          },
+      },
+      ref(node));
+}
 
 /**
- * Instruction with an 8-bit immediate.
+ * Add the expression below node to program.expressions, folding its
+ * constant subexpressions.
+ *
+ * @returns the id of its node.
  */
-struct InstructionI8 {
-  InstructionType typ;
-
-  constexpr uint8_t encode() {
-    switch (typ) {
-      case InstructionType::JR:
-        return 0x18;
-      case InstructionType::SUB:
-        return 0xd6;
-      case InstructionType::AND:
-        return 0xe6;
-      case InstructionType::OR:
-        return 0xf6;
-      case InstructionType::XOR:
-        return 0xee;
-      case InstructionType::CP:
-        return 0xff;
-      default:
-        throw AssemblerException("Invalid InstructionI8");
-    }
+uint32_t compile(IR::Program& program, BaseNode* node) {
+  return nodeOf(program.expressions, compileNode(program, node, 1));
+}
+
+/**
+ * Whether op is sp+e8 rather than an expression.
+ */
+bool isStackOffset(BaseBinaryOp* op) {
+  return op->opType() == BinaryOpType::ADD &&
+         op->left()->id() == NodeType::DREGISTER &&
+         static_cast<BaseDRegister*>(op->left())->reg() == "sp";
+}
+
+/**
+ * Value of the register, or double register, reg.
+ */
+uint32_t registerValue(BaseNode* reg) {
+  if (reg->id() == NodeType::REGISTER) {
+    return static_cast<uint8_t>(static_cast<BaseRegister*>(reg)->reg());
   }
-};
+  auto dreg = static_cast<BaseDRegister*>(reg);
+  return static_cast<uint8_t>(dreg->reg1()) << 8 |
+         static_cast<uint8_t>(dreg->reg2());
+}
 
 /**
- * Instruction with an 16-bit immediate.
+ * Describe operand of program line i.
  */
-struct InstructionI16 {
-  InstructionType typ;
-
-  constexpr uint8_t encode() {
-    switch (typ) {
-      case InstructionType::JP:
-        return 0xc3;
-      case InstructionType::CALL:
-        return 0xcd;
-      default:
-        throw AssemblerException("Invalid InstructionI16");
+void lowerOperand(IR::Program& program, size_t i, size_t n, BaseNode* node) {
+  auto& kind = program.operandKinds[n][i];
+  auto& value = program.operands[n][i];
+  std::visit(Overloaded{
+                 [&](BaseRegister*) {
+                   kind = IR::OperandKind::REGISTER;
+                   value = registerValue(node);
+                 },
+                 [&](BaseDRegister*) {
+                   kind = IR::OperandKind::DREGISTER;
+                   value = registerValue(node);
+                 },
+                 [&](Condition* condition) {
+                   kind = IR::OperandKind::CONDITION;
+                   value = static_cast<uint32_t>(condition->type());
+                 },
+                 [&](Indirect* indirect) {
+                   auto address = indirect->address();
+                   if (address->id() == NodeType::REGISTER ||
+                       address->id() == NodeType::DREGISTER) {
+                     kind = IR::OperandKind::POINTER;
+                     value = registerValue(address);
+                     if (indirect->step() != 0) {
+                       value |= (indirect->step() > 0 ? '+' : '-') << 16;
+                     }
+                   } else {
+                     kind = IR::OperandKind::ADDRESS;
+                     value = compile(program, address);
+                   }
+                 },
+                 [&](BaseBinaryOp* op) {
+                   if (isStackOffset(op)) {
+                     kind = IR::OperandKind::STACK_OFFSET;
+                     value = compile(program, op->right());
+                   } else {
+                     kind = IR::OperandKind::EXPRESSION;
+                     value = compile(program, node);
+                   }
+                 },
+                 [&](Number* num) {
+                   kind = IR::OperandKind::NUMBER;
+                   value = static_cast<uint32_t>(num->value());
+                 },
+                 [&](Label* label) {
+                   kind = IR::OperandKind::LABEL;
+                   value = program.name(label->name());
+                 },
+                 [&](auto) {
+                   kind = IR::OperandKind::EXPRESSION;
+                   value = compile(program, node);
+                 },
+             },
+             ref(node));
+}
+
+}  // namespace
+
+IR::Program Assembler::lower(std::shared_ptr<AST::Root> ast) {
+  IR::Program program{};
+  program.root = ast;
+  for (auto node : *ast) {
+    lower(program, node);
+  }
+  return program;
+}
+
+void Assembler::lower(IR::Program& program, BaseNode* node) {
+  try {
+    std::visit(
+        Overloaded{
+            [&](Directive* directive) {
+              switch (directive->type()) {
+                case DirectiveType::SECTION: {
+                  auto i = program.add(IR::LineKind::SECTION,
+                                       InstructionType::INVALID,
+                                       node->offset());
+                  program.operands[0][i] =
+                      program.name(directive->operands().at(0));
+                } break;
+                default:
+                  throw AssemblerException{"Invalid directive type"};
+              }
+            },
+            [&](BaseInstruction* instr) {
+              auto i = program.add(IR::LineKind::INSTRUCTION, instr->type(),
+                                   node->offset());
+              // nOperands() says which Instruction this is
+              switch (instr->nOperands()) {
+                case 0:
+                  break;
+                case 1:
+                  lowerOperand(program, i, 0,
+                               static_cast<Instruction1*>(instr)->operand());
+                  break;
+                case 2: {
+                  auto instr2 = static_cast<Instruction2*>(instr);
+                  lowerOperand(program, i, 0, instr2->left());
+                  lowerOperand(program, i, 1, instr2->right());
+                } break;
+                default:
+                  throw AssemblerException(
+                      "Invalid number of Instruction operands");
+              }
+            },
+            [&](Label* label) {
+              auto i = program.add(IR::LineKind::LABEL,
+                                   InstructionType::INVALID, node->offset());
+              program.operands[0][i] = program.name(label->name());
+            },
+            [](auto) { throw AssemblerException("Invalid node"); },
+        },
+        ref(node));
+  } catch (AssemblerException& e) {
+    if (e.offset() == SourceBuffer::NO_OFFSET) {
+      throw AssemblerException(e.what(), node->offset());
     }
+    throw;
   }
-};
+}
 
-enum class OperandType {
-  REGISTER,
-  DREGISTER,
-  IMM8,
-  IMM16,
-  RADDR,
-  IADDR,
-  FLAG,
-  INVALID,
-};
+void Assembler::assemble(const IR::Program& program, ELF& elf) {
+  for (size_t i = 0; i < program.size(); i++) {
+    try {
+      switch (program.kinds[i]) {
+        case IR::LineKind::SECTION:
+          elf.set_section(program.names[program.operands[0][i]]);
+          break;
+        case IR::LineKind::INSTRUCTION:
+          assembleInstruction(elf, program, i);
+          break;
+        case IR::LineKind::LABEL: {
+          // A label is the address of the next byte of its section, which is
+          // code to call in an executable section and data to read otherwise
+          auto type = elf.executable() ? ISection::Type{}.function()
+                                       : ISection::Type{}.object();
+          auto name = program.operands[0][i];
+          // TODO support bindings other than GLOBAL
+          // TODO relocatable
+          elf.add_symbol(program.names[name], elf.location(), 0, type,
+                         ISection::Binding{}.global(), ISection::Visibility{},
+                         false);
+          if (mLabels.size() <= name) {
+            mLabels.resize(name + 1);
+          }
+          mLabels[name] = LabelLocation{elf.section_index(), elf.location()};
+        } break;
+      }
+    } catch (AssemblerException& e) {
+      // Report errors from deep inside a line at the start of the line
+      if (e.offset() == SourceBuffer::NO_OFFSET) {
+        throw AssemblerException(e.what(), program.offsets[i]);
+      }
+      throw;
+    }
+  }
+}
 
-static const std::map<const InstructionType,
-                      const std::vector<std::pair<OperandType, OperandType>>>
-  formats{
-    // prefix 0x0
-    { InstructionType::INC,
-      {
-        { OperandType::REGISTER, OperandType::INVALID },
-        { OperandType::DREGISTER, OperandType::INVALID },
-      } },
-    { InstructionType::DEC,
-      {
-        { OperandType::REGISTER, OperandType::INVALID },
-        { OperandType::DREGISTER, OperandType::INVALID },
-      } },
-    { InstructionType::LD,
-      {
-        { OperandType::REGISTER, OperandType::IMM8 },
-        { OperandType::DREGISTER, OperandType::IMM16 },
-      } },
-    { InstructionType::NOP,
-      { { OperandType::INVALID, OperandType::INVALID } } },
-    { InstructionType::STOP,
-      { { OperandType::INVALID, OperandType::INVALID } } },
-    { InstructionType::RLCA,
-      { { OperandType::INVALID, OperandType::INVALID } } },
-    { InstructionType::RLA,
-      { { OperandType::INVALID, OperandType::INVALID } } },
-    { InstructionType::DAA,
-      { { OperandType::INVALID, OperandType::INVALID } } },
-    { InstructionType::SCF,
-      { { OperandType::INVALID, OperandType::INVALID } } },
-    { InstructionType::RRCA,
-      { { OperandType::INVALID, OperandType::INVALID } } },
-    { InstructionType::RRA,
-      { { OperandType::INVALID, OperandType::INVALID } } },
-    { InstructionType::CPL,
-      { { OperandType::INVALID, OperandType::INVALID } } },
-    { InstructionType::CCF,
-      { { OperandType::INVALID, OperandType::INVALID } } },
-    { InstructionType::JR,
-      {
-        { OperandType::FLAG, OperandType::IMM8 },
-        { OperandType::IMM8, OperandType::INVALID },
-      } },
-    { InstructionType::HALT,
-      { { OperandType::INVALID, OperandType::INVALID } } },
-    { InstructionType::SUB,
-      {
-        { OperandType::REGISTER, OperandType::INVALID },
-        { OperandType::REGISTER, OperandType::IMM8 },
-      } },
-    { InstructionType::AND,
-      {
-        { OperandType::REGISTER, OperandType::INVALID },
-        { OperandType::REGISTER, OperandType::IMM8 },
-      } },
-    { InstructionType::XOR,
-      {
-        { OperandType::REGISTER, OperandType::INVALID },
-        { OperandType::REGISTER, OperandType::IMM8 },
-      } },
-    { InstructionType::OR,
-      {
-        { OperandType::REGISTER, OperandType::INVALID },
-        { OperandType::REGISTER, OperandType::IMM8 },
-      } },
-    { InstructionType::CP,
-      {
-        { OperandType::REGISTER, OperandType::INVALID },
-        { OperandType::REGISTER, OperandType::IMM8 },
-      } },
-    { InstructionType::POP,
-      { { OperandType::DREGISTER, OperandType::INVALID } } },
-    { InstructionType::PUSH,
-      { { OperandType::DREGISTER, OperandType::INVALID } } },
-    { InstructionType::DI, { { OperandType::INVALID, OperandType::INVALID } } },
-    { InstructionType::EI, { { OperandType::INVALID, OperandType::INVALID } } },
-    { InstructionType::RET,
-      {
-        { OperandType::INVALID, OperandType::INVALID },
-        { OperandType::FLAG, OperandType::IMM8 },
-      } },
-    { InstructionType::RETI,
-      { { OperandType::INVALID, OperandType::INVALID } } },
-    { InstructionType::JP,
-      {
-        { OperandType::FLAG, OperandType::IMM8 },
-        { OperandType::IMM16, OperandType::INVALID },
-      } },
-    { InstructionType::CALL,
-      {
-        { OperandType::FLAG, OperandType::IMM8 },
-        { OperandType::IMM16, OperandType::INVALID },
-      } },
+void Assembler::resolve(const IR::Program& program, ELF& elf) {
+  std::sort(mFixups.begin(), mFixups.end(),
+            [](const Fixup& l, const Fixup& r) {
+              return l.section < r.section ||
+                     (l.section == r.section && l.offset < r.offset);
+            });
+
+  auto label = [&](uint32_t name) -> const LabelLocation* {
+    if (name < mLabels.size() && mLabels[name].section != NO_SECTION) {
+      return &mLabels[name];
+    }
+    return nullptr;
   };
+  // One evaluator for every fixup, so that expressions which share a
+  // subexpression evaluate it once
+  ExpressionEvaluator evaluator{
+      program, [&](uint32_t name) -> std::optional<int32_t> {
+        if (auto location = label(name)) {
+          return static_cast<int32_t>(location->value);
+        }
+        return std::nullopt;
+      }};
+
+  auto section = NO_SECTION;
+  std::vector<uint8_t>* data = nullptr;
+  for (auto& fixup : mFixups) {
+    try {
+      if (fixup.section != section) {
+        section = fixup.section;
+        data = &elf.progbits(section);
+      }
 
-// TODO
-// jp (hl)
-
-// prefix 0x0 TODO:
-// jr <flag>, imm8
-// ld (DR[+/-]), a
-// ld (imm16), sp
-// add HL, DR
-// ld a, (DR[+/-])
-
-void Assembler::assembleInstruction(ELF& elf, BaseInstruction& instr) {
-  switch (instr.nOperands()) {
-    case 0: {
-      auto& instr0 = dynamic_cast<Instruction0&>(instr);
-      const auto& fmts = formats.find(instr0.type());
-      if (fmts == formats.end()) {
-        // didn't find the key
+      std::optional<int32_t> value{};
+      if (fixup.kind == IR::OperandKind::LABEL) {
+        auto location = label(fixup.value);
+        if (location == nullptr) {
+          throw AssemblerException("Undefined label " +
+                                   program.names[fixup.value]);
+        } else if (fixup.field == Operand::REL8 &&
+                   location->section != fixup.section) {
+          throw AssemblerException("Relative jump to " +
+                                   program.names[fixup.value] +
+                                   " in another section");
+        }
+        value = static_cast<int32_t>(location->value);
       } else {
-        if (std::any_of(fmts->second.begin(), fmts->second.end(), [](auto fmt) {
-              return (fmt.first == OperandType::INVALID) &&
-                     (fmt.second == OperandType::INVALID);
-            })) {
-          elf.add_progbits(std::vector<uint8_t>{InstructionNone{instr0.type()}.encode()});
-        } else {
-          throw AssemblerException("Invalid instruction0 usage");
+        value = evaluator.value(fixup.value);
+        if (!value) {
+          throw AssemblerException("Operand depends on an undefined label");
         }
       }
-    } break;
 
-    case 1: {
-      auto& instr1 = dynamic_cast<Instruction1&>(instr);
-      const auto& fmts = formats.find(instr1.type());
-      if (fmts == formats.end()) {
-        // didn't find the key
-        throw AssemblerException("Invalid instruction format");
-      } else {
-        // search formats for one that matches this instruction
-        auto toperand = instr1.operand()->id();
-        for (auto it = fmts->second.begin(); it != fmts->second.end(); it++) {
-          if (it->second != OperandType::INVALID) {
-            continue;
-          } else if (toperand == NodeType::REGISTER &&
-                     it->first == OperandType::REGISTER) {
-            auto reg =
-                std::dynamic_pointer_cast<BaseRegister>(instr1.operand());
-            switch (instr1.type()) {
-              case InstructionType::INC:
-              case InstructionType::DEC:
-                elf.add_progbits(instructionR(instr1, *reg));
-                return;
-                break;
-              case InstructionType::SUB:
-              case InstructionType::SBC:
-              case InstructionType::AND:
-              case InstructionType::XOR:
-              case InstructionType::OR:
-              case InstructionType::CP:
-                elf.add_progbits(instructionRA(instr1, *reg));
-                return;
-                break;
-              default:
-                throw AssemblerException("Invalid Instruction1");
-            }
-          } else if (toperand == NodeType::DREGISTER &&
-                     it->first == OperandType::DREGISTER) {
-            auto reg =
-                std::dynamic_pointer_cast<BaseDRegister>(instr1.operand());
-            switch (instr1.type()) {
-              case InstructionType::INC:
-              case InstructionType::DEC:
-              case InstructionType::POP:
-              case InstructionType::PUSH:
-                elf.add_progbits(instructionD(instr1, *reg));
-                return;
-                break;
-              default:
-                throw AssemblerException("Invalid Instruction1");
-            }
-          } else if (toperand == NodeType::DREGISTER &&
-                     it->first == OperandType::RADDR) {
-            auto reg =
-                std::dynamic_pointer_cast<BaseDRegister>(instr1.operand());
-            switch (instr1.type()) {
-              case InstructionType::INC:
-              case InstructionType::DEC:
-              case InstructionType::JP: {
-                std::vector<uint8_t> encoded{
-                    InstructionA{instr1.type(), reg->reg1(), reg->reg2()}
-                        .encode()};
-                elf.add_progbits(encoded);
-              }
-                return;
-                break;
-              default:
-                throw AssemblerException("Invalid Instruction1");
-            }
-          } else if (toperand == NodeType::NUMBER) {
-            switch (it->first) {
-              case OperandType::IMM8:
-                switch (instr1.type()) {
-                  case InstructionType::JR:
-                  case InstructionType::SUB:
-                  case InstructionType::AND:
-                  case InstructionType::OR:
-                  case InstructionType::XOR:
-                  case InstructionType::CP: {
-                    auto num =
-                        std::dynamic_pointer_cast<Number>(instr1.operand());
-                    std::vector<uint8_t> encoded{
-                        InstructionI8{instr1.type()}.encode(), num->value()};
-                  } break;
-                  default:
-                    throw AssemblerException("Invalid Instruction1");
-                }
-                break;
-              case OperandType::IMM16:
-                switch (instr1.type()) {
-                  case InstructionType::JP:
-                  case InstructionType::CALL: {
-                    auto num =
-                        std::dynamic_pointer_cast<Number>(instr1.operand());
-                    // TODO is it little-endian?
-                    uint8_t hi = num->value() >> 8, lo = num->value() & 0xff;
-                    std::vector<uint8_t> encoded{
-                        InstructionI16{instr1.type()}.encode(), hi, lo};
-                  } break;
-                  default:
-                    throw AssemblerException("Invalid Instruction1");
-                }
-                break;
-              default:
-                continue;
-            }
-          } else if (toperand == NodeType::LABEL &&
-              it->first == OperandType::IMM8) {
-            // TODO
-          } else if (toperand == NodeType::LABEL &&
-              it->first == OperandType::IMM16) {
-            // TODO
-          } else if (toperand == NodeType::LABEL &&
-              it->first == OperandType::IADDR) {
-            // TODO
-            // operand could be a label--handle relocation
-          }
+      if (fixup.field == Operand::REL8) {
+        // Jumps are relative to the end of the instruction, which is right
+        // after the operand
+        auto displacement = *value - static_cast<int32_t>(fixup.offset + 1);
+        if (displacement < INT8_MIN || displacement > INT8_MAX) {
+          throw AssemblerException("Relative jump of " +
+                                   std::to_string(displacement) +
+                                   " is out of range");
         }
-        throw AssemblerException("Invalid instruction1 usage");
+        value = displacement;
+      }
+      encodeField(fixup.field, *value, data->data() + fixup.offset);
+    } catch (AssemblerException& e) {
+      if (e.offset() == SourceBuffer::NO_OFFSET) {
+        throw AssemblerException(e.what(), fixup.line);
       }
+      throw;
     }
+  }
+  mFixups.clear();
+}
+
+ExpressionEvaluator::ExpressionEvaluator(const IR::Program& program,
+                                         Resolver resolve)
+    : mProgram{program}, mResolve{std::move(resolve)}, mValues{}, mKnown{} {}
 
-    break;
+std::optional<int32_t> ExpressionEvaluator::value(uint32_t node) {
+  auto& dag = mProgram.expressions;
+  if (mKnown.size() < dag.size()) {
+    // The program grew since the last call
+    mValues.resize(dag.size());
+    mKnown.resize(dag.size());
+  }
+  if (mKnown[node]) {
+    return mValues[node];
+  }
 
-    case 2:
+  auto op = dag.op(node);
+  std::optional<int32_t> result{};
+  switch (op) {
+    case IR::Op::NUMBER:
+      result = static_cast<int32_t>(dag.left(node));
+      break;
+    case IR::Op::LABEL:
+      if (mResolve) {
+        result = mResolve(dag.left(node));
+      }
+      break;
+    case IR::Op::NEG:
+    case IR::Op::NOT:
+    case IR::Op::LNOT:
+      if (auto operand = value(dag.left(node))) {
+        result = fold(IR::unaryOpType(op), *operand);
+      }
       break;
+    default: {
+      auto left = value(dag.left(node));
+      auto right = left ? value(dag.right(node)) : std::nullopt;
+      if (right) {
+        result = fold(IR::binaryOpType(op), *left, *right);
+      }
+    } break;
   }
-}
 
-std::vector<uint8_t> Assembler::instructionR(Instruction1& instr1,
-                                             const BaseRegister& reg) {
-  switch (instr1.type()) {
-    case InstructionType::INC:
-      return std::vector<uint8_t>{
-          InstructionR{InstructionType::INC, reg.reg()}.encode()};
-    case InstructionType::DEC:
-      return std::vector<uint8_t>{
-          InstructionR{InstructionType::DEC, reg.reg()}.encode()};
-    default:
-      throw AssemblerException("Unrecognized Instruction0 type");
-  }
-}
-
-std::vector<uint8_t> Assembler::instructionRA(Instruction1& instr1,
-                                              const BaseRegister& reg) {
-  switch (instr1.type()) {
-    case InstructionType::SUB:
-      return std::vector<uint8_t>{
-          InstructionRA{InstructionType::SUB, reg.reg()}.encode()};
-    case InstructionType::SBC:
-      return std::vector<uint8_t>{
-          InstructionRA{InstructionType::SBC, reg.reg()}.encode()};
-    case InstructionType::AND:
-      return std::vector<uint8_t>{
-          InstructionRA{InstructionType::AND, reg.reg()}.encode()};
-    case InstructionType::XOR:
-      return std::vector<uint8_t>{
-          InstructionRA{InstructionType::XOR, reg.reg()}.encode()};
-    case InstructionType::OR:
-      return std::vector<uint8_t>{
-          InstructionRA{InstructionType::OR, reg.reg()}.encode()};
-    case InstructionType::CP:
-      return std::vector<uint8_t>{
-          InstructionRA{InstructionType::CP, reg.reg()}.encode()};
-    default:
-      throw AssemblerException("Invalid InstructionRA type");
+  // A label which is not resolved yet may be later
+  if (result) {
+    mValues[node] = *result;
+    mKnown[node] = true;
   }
+  return result;
 }
 
-std::vector<uint8_t> Assembler::instructionD(Instruction1& instr1,
-                                             const BaseDRegister& reg) {
-  switch (instr1.type()) {
-    case InstructionType::INC:
-      return std::vector<uint8_t>{
-          InstructionD{InstructionType::INC, reg.reg1(), reg.reg2()}.encode()};
-      break;
-    case InstructionType::DEC:
-      return std::vector<uint8_t>{
-          InstructionD{InstructionType::DEC, reg.reg1(), reg.reg2()}.encode()};
-    case InstructionType::POP:
-      return std::vector<uint8_t>{
-          InstructionD{InstructionType::POP, reg.reg1(), reg.reg2()}.encode()};
-    case InstructionType::PUSH:
-      return std::vector<uint8_t>{
-          InstructionD{InstructionType::PUSH, reg.reg1(), reg.reg2()}.encode()};
-    default:
-      throw AssemblerException("Invalid Instruction1");
+std::optional<int32_t> Assembler::evaluateExpression(
+    const IR::Program& program, uint32_t expression,
+    const ExpressionEvaluator::Resolver& resolve) {
+  return ExpressionEvaluator{program, resolve}.value(expression);
+}
+
+void Assembler::assembleInstruction(ELF& elf, const IR::Program& program,
+                                    size_t i) {
+  auto encoded = encodeInstruction(program, i);
+  if (encoded.pendingAt != 0) {
+    auto n = encoded.pendingOperand;
+    mFixups.push_back(Fixup{elf.section_index(),
+                            elf.location() + encoded.pendingAt,
+                            program.operands[n][i], program.offsets[i],
+                            program.operandKinds[n][i], encoded.pendingField});
   }
+  elf.add_progbits(encoded.data(), encoded.size());
 }
 
-std::shared_ptr<BaseNode> Assembler::evaluate(std::shared_ptr<BaseNode> node) {
-  switch (node->id()) {
-    case NodeType::ROOT: {
-      auto root = std::dynamic_pointer_cast<Root>(node);
-      auto newRoot = std::make_shared<Root>();
-      for (auto it = root->begin(); it != root->end(); it++) {
-        newRoot->add(evaluate(*it));
+EncodedInstruction Assembler::encodeInstruction(const IR::Program& program,
+                                                size_t i) {
+  auto index = findOpcode(program.types[i], operandForm(program, i, 0),
+                          operandForm(program, i, 1));
+  if (index == NO_OPCODE) {
+    throw AssemblerException("Invalid operands for instruction");
+  }
+
+  EncodedInstruction encoded{};
+  if (index >= 256) {
+    encoded.push_back(CB_PREFIX);
+  }
+  encoded.push_back(static_cast<uint8_t>(index));
+  auto& opcode = opcodes[index];
+  const Operand operands[] = {opcode.left, opcode.right};
+  // An accumulator which was named but is implied by the opcode comes first
+  size_t implied = program.nOperands(i) - (opcode.left != Operand::NONE) -
+                   (opcode.right != Operand::NONE);
+  for (size_t n = 0; n < IR::Program::MAX_OPERANDS; n++) {
+    if (operands[n] < Operand::SP_IMM) {
+      // Registers, pointers and conditions are all in the opcode
+      continue;
+    }
+    auto value = constant(program, i, n + implied);
+    if (operands[n] == Operand::BIT || operands[n] == Operand::VECTOR) {
+      // These are part of the opcode, which is never patched
+      if (!value) {
+        throw AssemblerException("Operand is not a constant");
       }
-      return newRoot;
-    } break;
-    case NodeType::INSTRUCTION: {
-      auto instr = std::dynamic_pointer_cast<BaseInstruction>(node);
-      return evaluateInstruction(instr);
-    } break;
-    case NodeType::REGISTER: {
-      auto reg = std::dynamic_pointer_cast<BaseRegister>(node);
-      // Can't evaluate a register.
-      return reg;
-    } break;
-    case NodeType::DREGISTER: {
-      auto reg = std::dynamic_pointer_cast<BaseDRegister>(node);
-      return reg;
-    } break;
-    case NodeType::LABEL: {
-      auto label = std::dynamic_pointer_cast<Label>(node);
-      // Can't evaluate a label until link-time.
-      return label;
-    } break;
-    case NodeType::NUMBER: {
-      auto num = std::dynamic_pointer_cast<Number>(node);
-      // A number's value is just itself.
-      return num;
-    } break;
-    case NodeType::BINARY_OP: {
-      auto op = std::dynamic_pointer_cast<BaseBinaryOp>(node);
-      return evaluateBinaryOp(op);
-    } break;
-    case NodeType::UNARY_OP: {
-      auto op = std::dynamic_pointer_cast<BaseUnaryOp>(node);
-      return evaluateUnaryOp(op);
-    } break;
-    case NodeType::INVALID:
-    default:
-      throw AssemblerException("Unrecognized AST node type");
+      encoded.back() |= operands[n] == Operand::BIT
+                            ? bitIndex(*value) << 3
+                            : restartVector(*value);
+      continue;
+    }
+
+    auto at = encoded.length;
+    encoded.length += fieldSize(operands[n]);
+    if (value) {
+      encodeField(operands[n], *value, &encoded.bytes[at]);
+    } else {
+      // No instruction has more than one immediate
+      encoded.pendingAt = at;
+      encoded.pendingOperand = static_cast<uint8_t>(n + implied);
+      encoded.pendingField = operands[n];
+    }
+  }
+  return encoded;
+}
+
+void Assembler::evaluate(Root& root) {
+  for (auto it = root.begin(); it != root.end(); it++) {
+    *it = evaluate(*it, root.arena());
+  }
+}
+
+BaseNode* Assembler::evaluate(BaseNode* node, Arena& arena) {
+  if (node->folded()) {
+    return node;
+  }
+  auto result = std::visit(
+      Overloaded{
+          [&](BaseInstruction* instr) -> BaseNode* {
+            return evaluateInstruction(instr, arena);
+          },
+          [&](BaseRegister*) -> BaseNode* {
+            // Can't evaluate a register.
+            return node;
+          },
+          [&](BaseDRegister*) -> BaseNode* { return node; },
+          [&](Condition*) -> BaseNode* { return node; },
+          [&](Indirect* indirect) -> BaseNode* {
+            auto address = evaluate(indirect->address(), arena);
+            if (address == indirect->address()) {
+              return node;
+            }
+            auto copied = arena.make<Indirect>(address, indirect->step());
+            copied->setOffset(node->offset());
+            return copied;
+          },
+          [&](Label*) -> BaseNode* {
+            // Can't evaluate a label until link-time.
+            return node;
+          },
+          [&](Number*) -> BaseNode* {
+            // A number's value is just itself.
+            return node;
+          },
+          [&](BaseBinaryOp* op) -> BaseNode* {
+            return evaluateBinaryOp(op, arena);
+          },
+          [&](BaseUnaryOp* op) -> BaseNode* {
+            return evaluateUnaryOp(op, arena);
+          },
+          [](Root*) -> BaseNode* {
+            // A Root owns the nodes below it, so it is evaluated through
+            // evaluate(Root&)
+            throw AssemblerException("Nested Root node");
+          },
+          [](auto) -> BaseNode* {
+            throw AssemblerException("Unrecognized AST node type");
+          },
+      },
+      ref(node));
+  result->setFolded();
+  return result;
+}
+
+namespace {
+
+/**
+ * Make node in arena at the offset of original.
+ */
+template <typename T, typename... Args>
+T* copy(Arena& arena, BaseNode* original, Args&&... args) {
+  auto node = arena.make<T>(std::forward<Args>(args)...);
+  node->setOffset(original->offset());
+  return node;
+}
+
+/**
+ * The Number which holds value in place of the operation node. The operand
+ * evaluated is reused if evaluating made it, since nothing else refers to
+ * it; numbers of the tree which was evaluated are never written.
+ */
+Number* foldInto(Arena& arena, BaseNode* node, BaseNode* operand,
+                 BaseNode* evaluated, int32_t value) {
+  if (evaluated != operand) {
+    auto num = static_cast<Number*>(evaluated);
+    num->setValue(value);
+    num->setOffset(node->offset());
+    return num;
   }
+  return copy<Number>(arena, node, value);
 }
 
-std::shared_ptr<BaseInstruction> Assembler::evaluateInstruction(
-    std::shared_ptr<BaseInstruction> node) {
+}  // namespace
+
+BaseInstruction* Assembler::evaluateInstruction(BaseInstruction* node,
+                                                Arena& arena) {
+  // nOperands() says which Instruction this is
   switch (node->nOperands()) {
     case 0:
       return node;
-      break;
     case 1: {
-      // auto instr1 = std::dynamic_pointer_cast<Instruction1>(node);
-      auto instr1 = std::dynamic_pointer_cast<Instruction1>(node);
-      return std::make_shared<Instruction1>(instr1->type(),
-                                            evaluate(instr1->operand()));
+      auto instr1 = static_cast<Instruction1*>(node);
+      auto operand = evaluate(instr1->operand(), arena);
+      if (operand == instr1->operand()) {
+        return node;
+      }
+      return copy<Instruction1>(arena, node, instr1->type(), operand);
     } break;
     case 2: {
-      auto instr2 = std::dynamic_pointer_cast<Instruction2>(node);
-      return std::make_shared<Instruction2>(
-          instr2->type(), evaluate(instr2->left()), evaluate(instr2->right()));
+      auto instr2 = static_cast<Instruction2*>(node);
+      auto left = evaluate(instr2->left(), arena);
+      auto right = evaluate(instr2->right(), arena);
+      if (left == instr2->left() && right == instr2->right()) {
+        return node;
+      }
+      return copy<Instruction2>(arena, node, instr2->type(), left, right);
     } break;
     default:
       throw AssemblerException("Invalid number of Instruction operands");
   }
 }
 
-std::shared_ptr<BaseNode>
-Assembler::evaluateBinaryOp(std::shared_ptr<BaseBinaryOp> node)
-{
-  switch (node->opType()) {
-    case BinaryOpType::ADD: {
-      auto op = std::dynamic_pointer_cast<AddOp>(node);
-      auto vLeft = evaluate(op->left());
-      auto vRight = evaluate(op->right());
-      if (vLeft->id() == NodeType::NUMBER && vRight->id() == NodeType::NUMBER) {
-        auto lnum = std::dynamic_pointer_cast<Number>(vLeft);
-        auto rnum = std::dynamic_pointer_cast<Number>(vRight);
-        return std::make_shared<Number>(lnum->value() + rnum->value());
-      } else {
-        // Can't evaluate anything
-        return std::make_shared<AddOp>(vLeft, vRight);
-      }
-    } break;
-    case BinaryOpType::SUB: {
-      auto op = std::dynamic_pointer_cast<SubOp>(node);
-      auto vLeft = evaluate(op->left());
-      auto vRight = evaluate(op->right());
-      if (vLeft->id() == NodeType::NUMBER && vRight->id() == NodeType::NUMBER) {
-        auto lnum = std::dynamic_pointer_cast<Number>(vLeft);
-        auto rnum = std::dynamic_pointer_cast<Number>(vRight);
-        return std::make_shared<Number>(lnum->value() - rnum->value());
-      } else {
-        // Can't evaluate anything
-        return std::make_shared<SubOp>(vLeft, vRight);
-      }
-    } break;
-    case BinaryOpType::MULT: {
-      auto op = std::dynamic_pointer_cast<MultOp>(node);
-      auto vLeft = evaluate(op->left());
-      auto vRight = evaluate(op->right());
-      if (vLeft->id() == NodeType::NUMBER && vRight->id() == NodeType::NUMBER) {
-        auto lnum = std::dynamic_pointer_cast<Number>(vLeft);
-        auto rnum = std::dynamic_pointer_cast<Number>(vRight);
-        return std::make_shared<Number>(lnum->value() * rnum->value());
-      } else {
-        // Can't evaluate anything
-        return std::make_shared<MultOp>(vLeft, vRight);
-      }
-    } break;
-    case BinaryOpType::DIV: {
-      auto op = std::dynamic_pointer_cast<DivOp>(node);
-      auto vLeft = evaluate(op->left());
-      auto vRight = evaluate(op->right());
-      if (vLeft->id() == NodeType::NUMBER && vRight->id() == NodeType::NUMBER) {
-        auto lnum = std::dynamic_pointer_cast<Number>(vLeft);
-        auto rnum = std::dynamic_pointer_cast<Number>(vRight);
-        return std::make_shared<Number>(lnum->value() / rnum->value());
-      } else {
-        // Can't evaluate anything
-        return std::make_shared<DivOp>(vLeft, vRight);
-      }
-    } break;
-    default:
-      throw AssemblerException("Invalid BinaryOpType");
+BaseNode* Assembler::evaluateBinaryOp(BaseBinaryOp* node, Arena& arena) {
+  auto type = node->opType();
+  if (type == BinaryOpType::INVALID) {
+    throw AssemblerException("Invalid BinaryOpType");
   }
+
+  auto vLeft = evaluate(node->left(), arena);
+  auto vRight = evaluate(node->right(), arena);
+  if (vLeft->id() == NodeType::NUMBER && vRight->id() == NodeType::NUMBER) {
+    auto value = fold(type, static_cast<Number*>(vLeft)->value(),
+                      static_cast<Number*>(vRight)->value());
+    return foldInto(arena, node, node->left(), vLeft, value);
+  } else if (vLeft == node->left() && vRight == node->right()) {
+    // Can't evaluate anything
+    return node;
+  }
+
+  auto op = makeBinaryOp(arena, type, vLeft, vRight);
+  op->setOffset(node->offset());
+  return op;
 }
 
-std::shared_ptr<BaseNode> Assembler::evaluateUnaryOp(
-    std::shared_ptr<BaseUnaryOp> node) {
-  switch (node->opType()) {
-    case UnaryOpType::NEG: {
-      auto op = std::dynamic_pointer_cast<NegOp>(node);
-      auto vRand = evaluate(op->operand());
-      if (vRand->id() == NodeType::NUMBER) {
-        auto num = std::dynamic_pointer_cast<Number>(vRand);
-        return std::make_shared<Number>(-num->value());
-      } else {
-        // Can't evaluate anything
-        return std::make_shared<NegOp>(vRand);
-      }
-    } break;
-    default:
-      throw AssemblerException("Invalid UnaryOpType");
+BaseNode* Assembler::evaluateUnaryOp(BaseUnaryOp* node, Arena& arena) {
+  auto type = node->opType();
+  if (type == UnaryOpType::INVALID) {
+    throw AssemblerException("Invalid UnaryOpType");
   }
+
+  auto vRand = evaluate(node->operand(), arena);
+  if (vRand->id() == NodeType::NUMBER) {
+    auto value = fold(type, static_cast<Number*>(vRand)->value());
+    return foldInto(arena, node, node->operand(), vRand, value);
+  } else if (vRand == node->operand()) {
+    // Can't evaluate anything
+    return node;
+  }
+
+  auto op = makeUnaryOp(arena, type, vRand);
+  op->setOffset(node->offset());
+  return op;
 }
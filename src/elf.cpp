@@ -377,7 +377,7 @@ Elf32_Sym& ELF::add_symbol(const std::string name, uint32_t value,
                 .st_size = size,
                 .st_info = static_cast<uint8_t>(ELF32_ST_INFO(bind.binding(), type.type())),
                 .st_other = static_cast<uint8_t>(ELF32_ST_VISIBILITY(visibility.visibility())),
-                .st_shndx = static_cast<uint8_t>(curr_section_)});
+                .st_shndx = static_cast<uint16_t>(curr_section_)});
 
   // If the symbol should be relocatable, find the corresponding section of
   // relocation information.
@@ -402,7 +402,26 @@ std::string& ELF::add_string(const std::string& str) {
   return string_table().strings().back();
 }
 
-void ELF::add_progbits(std::vector<uint8_t> data) {
+uint32_t ELF::location() {
+  if (current_section().type() != SectionType::PROGBITS) {
+    ELF_EXCEPTION("Attempted to locate data in non-PROGBITS section");
+  }
+  return static_cast<uint32_t>(current_section().size());
+}
+
+std::vector<uint8_t>& ELF::progbits(uint32_t index) {
+  auto& section = *sections_.at(index);
+  if (section.type() != SectionType::PROGBITS) {
+    ELF_EXCEPTION("Attempted to patch non-PROGBITS section");
+  }
+  return dynamic_cast<ProgramSection&>(section).data();
+}
+
+bool ELF::executable() {
+  return (current_section().header().sh_flags & SHF_EXECINSTR) != 0;
+}
+
+void ELF::add_progbits(const std::vector<uint8_t>& data) {
   if (current_section().type() != SectionType::PROGBITS) {
     ELF_EXCEPTION("Attempted to add PROGBITS to non-PROGBITS section");
   }
@@ -411,7 +430,7 @@ void ELF::add_progbits(std::vector<uint8_t> data) {
   section.data().insert(section.data().end(), data.begin(), data.end());
 }
 
-void ELF::add_progbits(uint8_t* pData, size_t n) {
+void ELF::add_progbits(const uint8_t* pData, size_t n) {
   if (current_section().type() != SectionType::PROGBITS) {
     ELF_EXCEPTION("Attempted to add PROGBITS to non-PROGBITS section");
   }
@@ -0,0 +1,280 @@
+
+#include <algorithm>
+#include <iterator>
+
+#include "incremental_parser.hpp"
+#include "scan.hpp"
+#include "token_stream.hpp"
+
+using namespace AST;
+
+namespace {
+
+/**
+ * Stream over the tokens of a single line, followed by END.
+ */
+class LineTokenStream : public TokenStream {
+ public:
+  LineTokenStream(std::string_view line, const TokenRecordList& tokens)
+      : TokenStream{}, mTokens{tokens}, mSize{line.size()}, mDone{false} {
+    setText(line, 0);
+  }
+
+ protected:
+  virtual bool fill(TokenRecordList& window) override {
+    if (mDone) {
+      window.push_back(
+          TokenRecord{TokenKind::END, static_cast<uint32_t>(mSize), 0, 0});
+      return false;
+    }
+    window.insert(window.end(), mTokens.begin(), mTokens.end());
+    mDone = true;
+    return true;
+  }
+
+ private:
+  const TokenRecordList& mTokens;
+  size_t mSize;
+  bool mDone;
+};
+
+/**
+ * Replace the count elements of to starting at pos with from.
+ */
+template <typename T>
+void splice(std::vector<T>& to, size_t pos, size_t count,
+            std::vector<T> from) {
+  auto first = to.begin() + pos;
+  size_t common = std::min(count, from.size());
+  std::move(from.begin(), from.begin() + common, first);
+  if (count > common) {
+    to.erase(first + common, first + count);
+  } else {
+    to.insert(first + common, std::make_move_iterator(from.begin() + common),
+              std::make_move_iterator(from.end()));
+  }
+}
+
+/**
+ * Move the offset of node, and of every node below it, by delta.
+ */
+void shiftOffsets(BaseNode& node, int64_t delta) {
+  if (node.offset() != SourceBuffer::NO_OFFSET) {
+    node.setOffset(static_cast<uint32_t>(node.offset() + delta));
+  }
+  // Every node after an edit is visited, so this avoids dynamic_cast: id()
+  // already says what the node is.
+  switch (node.id()) {
+    case NodeType::INSTRUCTION: {
+      auto& instr = static_cast<BaseInstruction&>(node);
+      if (instr.nOperands() == 1) {
+        shiftOffsets(*static_cast<Instruction1&>(instr).operand(), delta);
+      } else if (instr.nOperands() == 2) {
+        auto& instr2 = static_cast<Instruction2&>(instr);
+        shiftOffsets(*instr2.left(), delta);
+        shiftOffsets(*instr2.right(), delta);
+      }
+      break;
+    }
+    case NodeType::BINARY_OP: {
+      auto& op = static_cast<BaseBinaryOp&>(node);
+      shiftOffsets(*op.left(), delta);
+      shiftOffsets(*op.right(), delta);
+      break;
+    }
+    case NodeType::UNARY_OP:
+      shiftOffsets(*static_cast<BaseUnaryOp&>(node).operand(), delta);
+      break;
+    case NodeType::INDIRECT:
+      shiftOffsets(*static_cast<Indirect&>(node).address(), delta);
+      break;
+    default:
+      break;
+  }
+}
+
+}  // namespace
+
+IncrementalParser::IncrementalParser(std::string text)
+    : mTokenizer{},
+      mText{std::move(text)},
+      mLines{},
+      mLineStarts{},
+      mRoot{std::make_shared<Root>()},
+      mLive{0} {
+  if (mText.size() > UINT32_MAX) {
+    throw TokenizerException("Input too large", 0, 0);
+  }
+  std::vector<BaseNode*> nodes{};
+  parseLines(mText, 0, 0, mRoot, mLines, mLineStarts, nodes);
+  mRoot->splice(0, 0, std::move(nodes));
+  mLive = mRoot->arena().size();
+}
+
+void IncrementalParser::parseLines(std::string_view text, uint32_t offset,
+                                   int lineno,
+                                   const std::shared_ptr<Root>& root,
+                                   std::vector<Line>& lines,
+                                   std::vector<uint32_t>& starts,
+                                   std::vector<BaseNode*>& nodes) {
+  size_t pos = 0;
+  while (true) {
+    size_t end = Scan::findNewline(text.data(), pos, text.size());
+    auto line = text.substr(pos, end - pos);
+    auto lineOffset = offset + static_cast<uint32_t>(pos);
+
+    Line parsed{TokenRecordList{}, 0, 0};
+    mTokenizer.tokenizeLine(line, 0, lineno, parsed.tokens);
+    parseLine(line, lineOffset, root, parsed, nodes);
+
+    lines.push_back(std::move(parsed));
+    starts.push_back(lineOffset);
+    lineno++;
+    if (end >= text.size()) {
+      break;
+    }
+    pos = end + 1;
+  }
+}
+
+void IncrementalParser::parseLine(std::string_view text, uint32_t offset,
+                                  const std::shared_ptr<Root>& root,
+                                  Line& line, std::vector<BaseNode*>& nodes) {
+  LineTokenStream stream{text, line.tokens};
+  Parser parser{stream, root};
+  size_t made = root->arena().size();
+  line.nNodes = 0;
+  try {
+    while (!Parser::isEof(parser.peek())) {
+      if (Parser::isNewline(parser.peek())) {
+        parser.next();
+      } else {
+        auto node = parser.line();
+        shiftOffsets(*node, offset);
+        nodes.push_back(node);
+        line.nNodes++;
+      }
+    }
+  } catch (ParserException& e) {
+    if (e.offset() == SourceBuffer::NO_OFFSET) {
+      throw;
+    }
+    throw ParserException(e.what(), offset + e.offset());
+  }
+  line.nMade = root->arena().size() - made;
+}
+
+void IncrementalParser::compact() {
+  auto root = std::make_shared<Root>();
+  std::vector<BaseNode*> nodes{};
+  nodes.reserve(mRoot->size());
+  mLive = 0;
+  for (size_t i = 0; i < mLines.size(); i++) {
+    auto start = mLineStarts[i];
+    auto text = std::string_view{mText}.substr(start, lineEnd(i) - start);
+    parseLine(text, start, root, mLines[i], nodes);
+    mLive += mLines[i].nMade;
+  }
+  root->splice(0, 0, std::move(nodes));
+  // Move into the existing Root, which callers may hold on to
+  *mRoot = std::move(*root);
+}
+
+size_t IncrementalParser::lineAt(uint32_t offset) const {
+  auto it = std::upper_bound(mLineStarts.begin(), mLineStarts.end(), offset);
+  return (it - mLineStarts.begin()) - 1;
+}
+
+uint32_t IncrementalParser::lineEnd(size_t i) const {
+  return i + 1 < mLineStarts.size() ? mLineStarts[i + 1] - 1
+                                    : static_cast<uint32_t>(mText.size());
+}
+
+void IncrementalParser::apply(const Edit& edit) {
+  if (edit.offset > mText.size() ||
+      edit.length > mText.size() - edit.offset) {
+    throw ParserException("Edit out of range", edit.offset);
+  }
+  if (mText.size() - edit.length + edit.replacement.size() > UINT32_MAX) {
+    throw TokenizerException("Input too large", 0, 0);
+  }
+
+  // The lines touched by the edit, including the one a removed newline joins
+  // onto, are replaced wholesale.
+  size_t first = lineAt(edit.offset);
+  size_t last = lineAt(edit.offset + edit.length);
+  uint32_t start = mLineStarts[first];
+  uint32_t end = lineEnd(last);
+
+  std::string text{};
+  text.reserve(end - start - edit.length + edit.replacement.size());
+  text.append(mText, start, edit.offset - start);
+  text.append(edit.replacement);
+  text.append(mText, edit.offset + edit.length,
+              end - edit.offset - edit.length);
+
+  // Parse before changing anything, so that errors leave everything as it
+  // was
+  std::vector<Line> lines{};
+  std::vector<uint32_t> starts{};
+  std::vector<BaseNode*> nodes{};
+  parseLines(text, start, static_cast<int>(first), mRoot, lines, starts,
+             nodes);
+
+  size_t firstNode = 0;
+  for (size_t i = 0; i < first; i++) {
+    firstNode += mLines[i].nNodes;
+  }
+  size_t nNodes = 0;
+  for (size_t i = first; i <= last; i++) {
+    nNodes += mLines[i].nNodes;
+  }
+
+  int64_t delta = static_cast<int64_t>(edit.replacement.size()) -
+                  static_cast<int64_t>(edit.length);
+  if (delta != 0) {
+    for (size_t i = last + 1; i < mLineStarts.size(); i++) {
+      mLineStarts[i] = static_cast<uint32_t>(mLineStarts[i] + delta);
+    }
+    for (size_t i = firstNode + nNodes; i < mRoot->size(); i++) {
+      shiftOffsets(mRoot->child(i), delta);
+    }
+  }
+
+  for (size_t i = first; i <= last; i++) {
+    mLive -= mLines[i].nMade;
+  }
+  for (auto& line : lines) {
+    mLive += line.nMade;
+  }
+
+  mRoot->splice(firstNode, nNodes, std::move(nodes));
+  mText.replace(edit.offset, edit.length, edit.replacement);
+  splice(mLines, first, last - first + 1, std::move(lines));
+  splice(mLineStarts, first, last - first + 1, std::move(starts));
+
+  // The nodes of replaced lines stay in the arena until it is compacted,
+  // which happens once they outnumber the live ones.
+  if (mRoot->arena().size() - mLive > std::max(mLive, MIN_COMPACT)) {
+    compact();
+  }
+}
+
+TokenRecordList IncrementalParser::tokens() const {
+  TokenRecordList tokens{};
+  // Like std::getline, an empty last line, after a final newline, is no line
+  // at all
+  size_t n = mLines.size();
+  if (lineEnd(n - 1) == mLineStarts[n - 1]) {
+    n--;
+  }
+  for (size_t i = 0; i < n; i++) {
+    for (auto tok : mLines[i].tokens) {
+      tok.offset += mLineStarts[i];
+      tokens.push_back(tok);
+    }
+  }
+  tokens.push_back(
+      TokenRecord{TokenKind::END, static_cast<uint32_t>(mText.size()), 0, 0});
+  return tokens;
+}
@@ -1,31 +1,54 @@
 
 
-#include <fstream>
 #include <getopt.h>
+#include <algorithm>
+#include <cstdlib>
+#include <memory>
 
+#include "source_buffer.hpp"
+#include "token_stream.hpp"
 #include "tokenizer.hpp"
 #include "elf_writer.hpp"
 #include "assembler.hpp"
 #include "parser.hpp"
 
-class InputFile {
- public:
-  InputFile(std::string filename) : filename_{filename}, stream_{filename} {}
-
-  ~InputFile() { stream_.close(); }
-
-  bool exists() { return stream_.is_open(); }
-
-  std::ifstream& stream() { return stream_; }
-
- private:
-  std::string filename_;
-  std::ifstream stream_;
-};
-
 using namespace GBAS;
 
-static const std::string USAGE = " <input file>";
+static const std::string USAGE = " [-j threads] [--stream] <input file>";
+
+/**
+ * Print an error message, prefixed by the position in the source it refers to
+ * if that is known.
+ */
+static void reportError(const std::string& path, const SourceBuffer& source,
+                        uint32_t offset, const char* msg) {
+  std::cerr << path << ":";
+  if (offset != SourceBuffer::NO_OFFSET) {
+    auto location = source.locate(offset);
+    std::cerr << location.line << ":" << location.column << ":";
+  }
+  std::cerr << " error: " << msg << std::endl;
+}
+
+/**
+ * Print every error which was recovered from, in the order they appear in the
+ * source.
+ *
+ * @returns whether there were any.
+ */
+static bool reportDiagnostics(const std::string& path,
+                              const SourceBuffer& source,
+                              DiagnosticList& diagnostics) {
+  // Tokenizing on several threads reports all tokenizer errors first
+  std::stable_sort(diagnostics.begin(), diagnostics.end(),
+                   [](const Diagnostic& a, const Diagnostic& b) {
+                     return a.offset < b.offset;
+                   });
+  for (auto& diagnostic : diagnostics) {
+    reportError(path, source, diagnostic.offset, diagnostic.message.c_str());
+  }
+  return !diagnostics.empty();
+}
 
 int main(int argc, char* argv[]) {
   if (argc < 2) {
@@ -36,15 +59,19 @@ int main(int argc, char* argv[]) {
   const struct option long_options[] = {
       {"tokenize", no_argument, nullptr, 0},
       {"parse", no_argument, nullptr, 0},
+      {"jobs", required_argument, nullptr, 'j'},
+      {"stream", no_argument, nullptr, 0},
       {nullptr, 0, nullptr, 0},
   };
 
   bool tokenize_only = false;
   bool parse_only = false;
+  bool stream = false;
+  unsigned jobs = 1;
 
   int c = 0;
   int option_index = 0;
-  while ((c = getopt_long(argc, argv, "tp", long_options, &option_index)) != -1) {
+  while ((c = getopt_long(argc, argv, "tpj:", long_options, &option_index)) != -1) {
     switch (c) {
       case 0: {
         using namespace std::literals::string_view_literals;
@@ -53,6 +80,8 @@ int main(int argc, char* argv[]) {
           tokenize_only = true;
         } else if ("parse"sv == option_name) {
           parse_only = true;
+        } else if ("stream"sv == option_name) {
+          stream = true;
         }
       }
       break;
@@ -65,6 +94,10 @@ int main(int argc, char* argv[]) {
       parse_only = true;
       break;
 
+      case 'j':
+      jobs = static_cast<unsigned>(std::strtoul(optarg, nullptr, 10));
+      break;
+
       case '?':
       break;
 
@@ -78,35 +111,75 @@ int main(int argc, char* argv[]) {
     }
   }
 
-  InputFile infile{std::string{argv[optind]}};
-  if (!infile.exists()) {
-    std::cerr << "Input file does not exist" << std::endl;
+  std::string path{argv[optind]};
+  std::unique_ptr<SourceBuffer> source;
+  try {
+    source = std::make_unique<SourceBuffer>(SourceBuffer::map(path));
+  } catch (SourceBufferException& e) {
+    std::cerr << e.what() << std::endl;
     return -1;
   }
 
-  // infile.stream()
+  // Invalid lines are skipped so that every error in the file is reported
+  DiagnosticList diagnostics{};
+  try {
+    // Tokenizing on several threads needs all of the tokens up front; on a
+    // single thread they are produced as the parser asks for them.
+    std::unique_ptr<TokenStream> tokens;
+    if (jobs == 1) {
+      tokens = std::make_unique<SourceTokenStream>(*source);
+    } else {
+      Tokenizer tokenizer{};
+      tokenizer.setDiagnostics(&diagnostics);
+      tokens = std::make_unique<TokenRecordStream>(
+          *source, tokenizer.tokenize(*source, jobs));
+    }
+    tokens->setDiagnostics(&diagnostics);
+    if (tokenize_only) {
+      TokenRecord tok{};
+      do {
+        tok = tokens->next();
+        std::cout << Tokenizer::text(*source, tok) << std::endl;
+      } while (tok.kind != TokenKind::END);
+      return reportDiagnostics(path, *source, diagnostics) ? -1 : 0;
+    }
+    Parser parser{*tokens};
+    parser.setDiagnostics(&diagnostics);
+    Assembler assembler{};
+    ELF elf{};
+    if (stream && !parse_only) {
+      // Lines are assembled as they are parsed, mostly without a tree
+      parser.parseInto(assembler, elf);
+    } else {
+      auto root_node = parser.parse();
+      if (reportDiagnostics(path, *source, diagnostics)) {
+        return -1;
+      }
+      if (parse_only) {
+        // TODO print tree
+        return 0;
+      }
+      assembler.assemble(root_node, elf);
+    }
 
-  Tokenizer tokenizer{};
-  auto token_list = tokenizer.tokenize(infile.stream());
-  if (tokenize_only) {
-    for (auto& token : token_list) {
-      std::cout << token << std::endl;
+    if (reportDiagnostics(path, *source, diagnostics)) {
+      return -1;
     }
-    return 0;
-  }
-  Parser parser{token_list};
-  auto root_node = parser.parse();
-  if (parse_only) {
-    // TODO print tree
-    return 0;
+    ELFWriter writer{elf};
+    writer.write("a.out");
+  } catch (TokenizerException& e) {
+    // Tokenizer lines and columns count from 0
+    std::cerr << path << ":" << e.line() + 1 << ":" << e.column() + 1
+              << ": error: " << e.what() << std::endl;
+    return -1;
+  } catch (ParserException& e) {
+    reportError(path, *source, e.offset(), e.what());
+    return -1;
+  } catch (AssemblerException& e) {
+    reportDiagnostics(path, *source, diagnostics);
+    reportError(path, *source, e.offset(), e.what());
+    return -1;
   }
-  Assembler assembler{};
-  ELF elf{};
-  assembler.assemble(root_node, elf);
-
-  ELFWriter writer{elf};
-  writer.write("a.out");
-
 
   // ELFReader::read(infile.stream()).or_else([](std::string msg) {
   //   std::cerr << msg << std::endl;
@@ -1,314 +1,666 @@
 
 #include <algorithm>
+#include <charconv>
 
 #include "parser.hpp"
+#include "assembler.hpp"
 #include "char_utils.hpp"
+#include "ir.hpp"
+
+AST::Arena::Arena()
+    : mBlocks{}, mNext{nullptr}, mEnd{nullptr}, mSize{0}, mDestructors{} {}
+
+AST::Arena::Arena(Arena&& other) noexcept
+    : mBlocks{std::move(other.mBlocks)},
+      mNext{other.mNext},
+      mEnd{other.mEnd},
+      mSize{other.mSize},
+      mDestructors{std::move(other.mDestructors)} {
+  other.mBlocks.clear();
+  other.mNext = nullptr;
+  other.mEnd = nullptr;
+  other.mSize = 0;
+  other.mDestructors.clear();
+}
+
+AST::Arena& AST::Arena::operator=(Arena&& other) noexcept {
+  if (this != &other) {
+    release();
+    mBlocks = std::move(other.mBlocks);
+    mNext = other.mNext;
+    mEnd = other.mEnd;
+    mSize = other.mSize;
+    mDestructors = std::move(other.mDestructors);
+    other.mBlocks.clear();
+    other.mNext = nullptr;
+    other.mEnd = nullptr;
+    other.mSize = 0;
+    other.mDestructors.clear();
+  }
+  return *this;
+}
+
+AST::Arena::~Arena() { release(); }
+
+void AST::Arena::release() {
+  for (auto it = mDestructors.rbegin(); it != mDestructors.rend(); it++) {
+    it->destroy(it->object);
+  }
+  mDestructors.clear();
+  mBlocks.clear();
+}
 
-Parser::Parser(TokenList& tokens) : mTokens{tokens}, mRoot{}, mPos{0} {}
+void* AST::Arena::allocate(size_t size, size_t align) {
+  auto next = reinterpret_cast<uintptr_t>(mNext);
+  auto aligned = (next + align - 1) & ~static_cast<uintptr_t>(align - 1);
+  if (mNext == nullptr || aligned + size > reinterpret_cast<uintptr_t>(mEnd)) {
+    // Blocks from new[] are aligned for any node
+    size_t blockSize = std::max(size, BLOCK_SIZE);
+    mBlocks.push_back(std::make_unique<char[]>(blockSize));
+    mNext = mBlocks.back().get();
+    mEnd = mNext + blockSize;
+    aligned = reinterpret_cast<uintptr_t>(mNext);
+  }
+  mNext = reinterpret_cast<char*>(aligned + size);
+  return reinterpret_cast<void*>(aligned);
+}
+
+AST::BaseBinaryOp* AST::makeBinaryOp(Arena& arena, BinaryOpType type,
+                                     BaseNode* l, BaseNode* r) {
+  switch (type) {
+    case BinaryOpType::ADD:
+      return arena.make<AddOp>(l, r);
+    case BinaryOpType::SUB:
+      return arena.make<SubOp>(l, r);
+    case BinaryOpType::MULT:
+      return arena.make<MultOp>(l, r);
+    case BinaryOpType::DIV:
+      return arena.make<DivOp>(l, r);
+    case BinaryOpType::MOD:
+      return arena.make<ModOp>(l, r);
+    case BinaryOpType::SHL:
+      return arena.make<ShlOp>(l, r);
+    case BinaryOpType::SHR:
+      return arena.make<ShrOp>(l, r);
+    case BinaryOpType::AND:
+      return arena.make<AndOp>(l, r);
+    case BinaryOpType::OR:
+      return arena.make<OrOp>(l, r);
+    case BinaryOpType::XOR:
+      return arena.make<XorOp>(l, r);
+    case BinaryOpType::EQ:
+      return arena.make<EqOp>(l, r);
+    case BinaryOpType::NE:
+      return arena.make<NeOp>(l, r);
+    case BinaryOpType::LT:
+      return arena.make<LtOp>(l, r);
+    case BinaryOpType::GT:
+      return arena.make<GtOp>(l, r);
+    case BinaryOpType::LE:
+      return arena.make<LeOp>(l, r);
+    case BinaryOpType::GE:
+      return arena.make<GeOp>(l, r);
+    case BinaryOpType::LAND:
+      return arena.make<LandOp>(l, r);
+    case BinaryOpType::LOR:
+      return arena.make<LorOp>(l, r);
+    default:
+      throw ParserException("Invalid BinaryOpType");
+  }
+}
+
+AST::BaseUnaryOp* AST::makeUnaryOp(Arena& arena, UnaryOpType type,
+                                   BaseNode* rand) {
+  switch (type) {
+    case UnaryOpType::NEG:
+      return arena.make<NegOp>(rand);
+    case UnaryOpType::NOT:
+      return arena.make<NotOp>(rand);
+    case UnaryOpType::LNOT:
+      return arena.make<LnotOp>(rand);
+    default:
+      throw ParserException("Invalid UnaryOpType");
+  }
+}
+
+Parser::Parser(const TokenList& tokens)
+    : mOwnedTokens{std::make_unique<TokenListStream>(tokens)},
+      mTokens{*mOwnedTokens},
+      mRoot{std::make_shared<AST::Root>()},
+      mDiagnostics{nullptr},
+      mLineOffset{SourceBuffer::NO_OFFSET} {}
+
+Parser::Parser(TokenStream& tokens)
+    : mOwnedTokens{},
+      mTokens{tokens},
+      mRoot{std::make_shared<AST::Root>()},
+      mDiagnostics{nullptr},
+      mLineOffset{SourceBuffer::NO_OFFSET} {}
+
+Parser::Parser(TokenStream& tokens, std::shared_ptr<AST::Root> root)
+    : mOwnedTokens{},
+      mTokens{tokens},
+      mRoot{std::move(root)},
+      mDiagnostics{nullptr},
+      mLineOffset{SourceBuffer::NO_OFFSET} {}
 
 Parser::~Parser() {}
 
 using namespace AST;
 using namespace GBAS;
 
-static const std::array<const Token, 8> registers = {
-    "a", "f", "b", "c", "d", "e", "h", "l",
-};
-
-static const std::array<const Token, 6> doubleRegisters = {
-    "af", "bc", "de", "hl", "sp", "pc",
-};
-
-static DirectivePropsList directives{{
-    {".section", DirectiveType::SECTION, 1},
-}};
-
-static InstructionPropsList instructions{{
-    {"add", InstructionType::ADD, 2, 2},
-    {"adc", InstructionType::ADC, 2, 2},
-    {"inc", InstructionType::INC, 1, 1},
-    {"sub", InstructionType::SUB, 1, 2},
-    {"sbc", InstructionType::SBC, 2, 2},
-    {"and", InstructionType::AND, 1, 1},
-    {"xor", InstructionType::XOR, 1, 1},
-    {"or", InstructionType::OR, 1, 1},
-    {"cp", InstructionType::CP, 1, 1},
-    {"dec", InstructionType::DEC, 1, 1},
-    {"rlc", InstructionType::RLC, 1, 1},
-    {"rlca", InstructionType::RLCA, 0, 0},
-    {"rl", InstructionType::RL, 1, 1},
-    {"rla", InstructionType::RLA, 0, 0},
-    {"rrc", InstructionType::RRC, 1, 1},
-    {"rrca", InstructionType::RRCA, 0, 0},
-    {"rr", InstructionType::RR, 1, 1},
-    {"rra", InstructionType::RRA, 0, 0},
-    {"daa", InstructionType::DAA, 0, 0},
-    {"scf", InstructionType::SCF, 0, 0},
-    {"cpl", InstructionType::CPL, 0, 0},
-    {"ccf", InstructionType::CCF, 0, 0},
-
-    {"ld", InstructionType::LD, 2, 2},
-    {"ldi", InstructionType::LDI, 2, 2},
-    {"ldd", InstructionType::LDD, 2, 2},
-    {"push", InstructionType::PUSH, 1, 1},
-    {"pop", InstructionType::POP, 1, 1},
-
-    {"jr", InstructionType::JR, 1, 2},
-    {"ret", InstructionType::RET, 0, 0},
-    {"jp", InstructionType::JP, 0, 0},
-    {"call", InstructionType::CALL, 0, 0},
-    {"rst", InstructionType::RST, 1, 1},
-
-    {"nop", InstructionType::NOP, 0, 0},
-    {"stop", InstructionType::STOP, 0, 0},
-    {"halt", InstructionType::HALT, 0, 0},
-    {"di", InstructionType::DI, 0, 0},
-    {"ei", InstructionType::EI, 0, 0},
-
-    {"sla", InstructionType::SLA, 1, 1},
-    {"sra", InstructionType::SRA, 1, 1},
-    {"swap", InstructionType::SWAP, 1, 1},
-    {"srl", InstructionType::SRL, 1, 1},
-    {"bit", InstructionType::BIT, 2, 2},
-    {"res", InstructionType::RES, 2, 2},
-    {"set", InstructionType::SET, 2, 2},
-}};
-
-Token Parser::next() { return mTokens.at(mPos++); }
-
-Token Parser::peek() {
-  if (static_cast<size_t>(mPos) < mTokens.size()) {
-    return mTokens.at(mPos);
+std::shared_ptr<Root> Parser::parse() { return program(); };
+
+void Parser::setDiagnostics(DiagnosticList* diagnostics) {
+  mDiagnostics = diagnostics;
+  mTokens.setDiagnostics(diagnostics);
+}
+
+std::shared_ptr<Root> Parser::program() {
+  while (!isEof(peek())) {
+    if (isNewline(peek())) {
+      next();
+    } else if (auto node = line()) {
+      mRoot->add(node);
+    } else {
+      skipLine();
+    }
+  }
+  return mRoot;
+}
+
+BaseNode* Parser::line() {
+  auto& tok = peek();
+  auto offset = tok.offset;
+  mLineOffset = offset;
+  if (tok.kind != TokenKind::IDENTIFIER) {
+    return fail("Invalid token in program", offset);
+  }
+
+  BaseNode* node;
+  auto tokText = text(tok);
+  if (isDirective(tokText)) {
+    node = directive();
+  } else if (tok.keyword.kind == KeywordKind::INSTRUCTION) {
+    node = instruction();
+  } else if (isLabel(tokText) && isPunctuation(peekNext(), ':')) {
+    node = label();
+    next();
   } else {
-    // Assume no spaces will have survived tokenization. This is admittedly a
-    // hack ;)
-    return " ";
+    return fail("Invalid token in program", offset);
+  }
+  if (node != nullptr) {
+    node->setOffset(offset);
   }
+  return node;
 }
 
-Token Parser::peekNext() { return mTokens.at(mPos + 1); }
+std::nullptr_t Parser::fail(const char* msg, uint32_t offset) {
+  // Errors without a more precise position are reported at the start of the
+  // line
+  if (offset == SourceBuffer::NO_OFFSET) {
+    offset = mLineOffset;
+  }
+  if (mDiagnostics == nullptr) {
+    throw ParserException(msg, offset);
+  }
+  mDiagnostics->push_back(Diagnostic{offset, msg});
+  return nullptr;
+}
 
-std::shared_ptr<Root> Parser::parse() { return program(); };
+void Parser::skipLine() {
+  while (!isNewline(peek()) && !isEof(peek())) {
+    next();
+  }
+}
 
-std::shared_ptr<Root> Parser::program() {
-  std::vector<std::shared_ptr<BaseNode>> lines;
+std::shared_ptr<Root> Parser::parseInto(Assembler& assembler, ELF& elf) {
+  // Each line is assembled as soon as it is parsed, so the program only ever
+  // holds one
+  IR::Program program{};
+  program.root = mRoot;
   while (!isEof(peek())) {
     if (isNewline(peek())) {
       next();
     } else {
-      lines.push_back(line());
+      program.clear();
+      if (line(program)) {
+        assembler.assemble(program, elf);
+      } else {
+        skipLine();
+      }
     }
   }
-  return std::make_shared<Root>(lines);
+  assembler.resolve(program, elf);
+  return mRoot;
 }
 
-std::shared_ptr<BaseNode> Parser::line() {
-  auto tok = peek();
-  if (isDirective(tok)) {
-    return directive();
-  } else if (isLabel(tok) && (peekNext() == ":")) {
-    return label();
-  } else if (isInstruction(tok)) {
-    return instruction();
-  } else {
-    throw ParserException("Invalid token in program");
+bool Parser::line(IR::Program& program) {
+  auto& tok = peek();
+  if (tok.kind != TokenKind::IDENTIFIER ||
+      tok.keyword.kind != KeywordKind::INSTRUCTION) {
+    auto node = line();
+    if (node == nullptr) {
+      return false;
+    }
+    mRoot->add(node);
+    Assembler::lower(program, node);
+    return true;
   }
+
+  auto offset = tok.offset;
+  mLineOffset = offset;
+  auto lines = program.size();
+  auto node = instruction(program);
+  if (node != nullptr) {
+    node->setOffset(offset);
+    mRoot->add(node);
+    Assembler::lower(program, node);
+  }
+  // Without a node, the instruction was either appended or invalid
+  return node != nullptr || program.size() > lines;
 }
 
-std::shared_ptr<BaseNode> Parser::label() { return parseLabel(next()); }
+BaseNode* Parser::label() { return parseLabel(text(next())); }
 
-std::shared_ptr<BaseNode> Parser::parseLabel(const Token& tok) {
-  return std::make_shared<Label>(tok);
+BaseNode* Parser::parseLabel(std::string_view tok) {
+  return make<Label>(std::string{tok});
 }
 
-const DirectiveProps& Parser::findDirective(const Token& tok) {
-  auto props = std::find_if(directives.begin(), directives.end(),
-                            [&](auto props) { return props.lexeme == tok; });
-  if (props == directives.end()) {
+const DirectiveProps& Parser::findDirective(std::string_view tok) {
+  auto keyword = findKeyword(tok);
+  if (keyword.kind != KeywordKind::DIRECTIVE) {
     throw ParserException{"Invalid directive in program"};
   } else {
-    return *props;
+    return directives[keyword.index];
   }
 }
 
-std::shared_ptr<BaseNode> Parser::directive() {
-  auto props = findDirective(next());
+BaseNode* Parser::directive() {
+  auto tok = next();
+  if (tok.keyword.kind != KeywordKind::DIRECTIVE) {
+    return fail("Invalid directive in program", tok.offset);
+  }
+  auto& props = directives[tok.keyword.index];
   Directive::OperandList operands{};
   for (int i = 0; i < props.args; i++) {
-    auto tok = peek();
-    if (isNewline(tok)) {
-      throw ParserException{"Expected more arguments in directive"};
+    if (isNewline(peek())) {
+      return fail("Expected more arguments in directive", peek().offset);
     } else {
-      operands.push_back(next());
+      operands.emplace_back(text(next()));
     }
   }
-  return std::make_shared<Directive>(props.type, operands);
+  return make<Directive>(props.type, std::move(operands));
 }
 
-std::shared_ptr<BaseNode> Parser::instruction() {
+BaseNode* Parser::instruction() {
   auto inst = next();
-  std::vector<std::shared_ptr<BaseNode>> operands;
+  return instruction(inst, {});
+}
+
+BaseNode* Parser::instruction(IR::Program& program) {
+  auto inst = next();
+  std::array<IR::OperandKind, 3> kinds{};
+  std::array<uint32_t, 3> values{};
+  std::array<uint32_t, 3> offsets{};
+  size_t n = 0;
+  // An operand can be encoded from its token alone if that token is all
+  // there is to it
+  while (!isNewline(peek()) && n < kinds.size()) {
+    auto& tok = peek();
+    if (isComma(tok)) {
+      next();
+      continue;
+    } else if (!isComma(peekNext()) && !isNewline(peekNext())) {
+      break;
+    } else if (tok.keyword.kind == KeywordKind::REGISTER) {
+      kinds[n] = IR::OperandKind::REGISTER;
+      values[n] = static_cast<uint8_t>(text(tok)[0]);
+    } else if (tok.keyword.kind == KeywordKind::DREGISTER) {
+      auto reg = text(tok);
+      kinds[n] = IR::OperandKind::DREGISTER;
+      values[n] = static_cast<uint8_t>(reg[0]) << 8 |
+                  static_cast<uint8_t>(reg[1]);
+    } else if (tok.keyword.kind == KeywordKind::CONDITION) {
+      kinds[n] = IR::OperandKind::CONDITION;
+      values[n] = tok.keyword.index;
+    } else if (tok.kind == TokenKind::NUMBER) {
+      kinds[n] = IR::OperandKind::NUMBER;
+      values[n] = tok.value;
+    } else {
+      break;
+    }
+    offsets[n] = tok.offset;
+    n++;
+    next();
+  }
+
+  if (isNewline(peek()) || n == kinds.size()) {
+    auto props = findInstruction(inst, n);
+    if (props == nullptr) {
+      return nullptr;
+    }
+    auto i = program.add(IR::LineKind::INSTRUCTION, props->type, inst.offset);
+    for (size_t k = 0; k < n; k++) {
+      program.operandKinds[k][i] = kinds[k];
+      program.operands[k][i] = values[k];
+    }
+    return nullptr;
+  }
+
+  // Make nodes for the operands which were already read, then parse the rest
+  std::vector<BaseNode*> operands;
+  for (size_t k = 0; k < n; k++) {
+    BaseNode* node;
+    switch (kinds[k]) {
+      case IR::OperandKind::REGISTER:
+        node = make<BaseRegister>(static_cast<char>(values[k]));
+        break;
+      case IR::OperandKind::DREGISTER:
+        node = make<BaseDRegister>(static_cast<char>(values[k] >> 8),
+                                   static_cast<char>(values[k]));
+        break;
+      case IR::OperandKind::CONDITION:
+        node = make<Condition>(static_cast<ConditionType>(values[k]));
+        break;
+      default:
+        node = make<Number>(static_cast<int32_t>(values[k]));
+        break;
+    }
+    node->setOffset(offsets[k]);
+    operands.push_back(node);
+  }
+  return instruction(inst, std::move(operands));
+}
+
+BaseNode* Parser::instruction(const TokenRecord& inst,
+                              std::vector<BaseNode*> operands) {
   while (!isNewline(peek()) && operands.size() < 3) {
     if (isComma(peek())) {
       next();
+    } else if (auto node = operand()) {
+      operands.push_back(node);
     } else {
-      operands.push_back(operand());
+      return nullptr;
     }
   }
-  auto props = findInstruction(inst);
-  if (props == instructions.end()) {
-    throw ParserException("Unrecognized instruction");
-  } else if (operands.size() == static_cast<size_t>(props->args1) ||
-             operands.size() == static_cast<size_t>(props->args2)) {
-    switch (operands.size()) {
-      case 0:
-        return std::make_shared<Instruction0>(props->type);
-      case 1:
-        return std::make_shared<Instruction1>(props->type, operands.at(0));
-      case 2:
-        return std::make_shared<Instruction2>(props->type, operands.at(0),
-                                              operands.at(1));
-      default:
-        throw ParserException("Invalid number of args for instruction");
+  auto props = findInstruction(inst, operands.size());
+  if (props == nullptr) {
+    return nullptr;
+  }
+  switch (operands.size()) {
+    case 0:
+      return make<Instruction0>(props->type);
+    case 1:
+      return make<Instruction1>(props->type, operands.at(0));
+    default:
+      return make<Instruction2>(props->type, operands.at(0), operands.at(1));
+  }
+}
+
+const InstructionProps* Parser::findInstruction(const TokenRecord& inst,
+                                                size_t nOperands) {
+  if (inst.keyword.kind != KeywordKind::INSTRUCTION) {
+    return fail("Unrecognized instruction", SourceBuffer::NO_OFFSET);
+  }
+  auto& props = instructions[inst.keyword.index];
+  if (nOperands != static_cast<size_t>(props.args1) &&
+      nOperands != static_cast<size_t>(props.args2)) {
+    return fail("Invalid number of args for instruction",
+                SourceBuffer::NO_OFFSET);
+  }
+  return &props;
+}
+
+BaseNode* Parser::operand() {
+  auto& tok = peek();
+  auto offset = tok.offset;
+  BaseNode* node;
+  if (tok.keyword.kind == KeywordKind::REGISTER) {
+    node = register_();
+  } else if (tok.keyword.kind == KeywordKind::DREGISTER) {
+    node = dregister();
+    auto& after = peek();
+    if (node != nullptr &&
+        static_cast<BaseDRegister*>(node)->reg() == "sp" &&
+        (isPunctuation(after, '+') || isPunctuation(after, '-'))) {
+      // sp+e8 is sp plus the whole expression after it, whose sign is its
+      // own if it is negative
+      node->setOffset(offset);
+      if (isPunctuation(after, '+')) {
+        next();
+      }
+      auto e8 = expression();
+      if (e8 == nullptr) {
+        return nullptr;
+      }
+      node = makeBinaryOp(mRoot->arena(), BinaryOpType::ADD, node, e8);
     }
+  } else if (tok.keyword.kind == KeywordKind::CONDITION) {
+    node = condition();
+  } else if (isPunctuation(tok, '(')) {
+    node = indirect();
   } else {
-    throw ParserException("Invalid number of args for instruction");
+    node = expression();
   }
+  if (node != nullptr) {
+    node->setOffset(offset);
+  }
+  return node;
+}
+
+BaseNode* Parser::condition() {
+  auto tok = next();
+  return make<Condition>(static_cast<ConditionType>(tok.keyword.index));
 }
 
-std::shared_ptr<BaseNode> Parser::operand() {
-  auto tok = peek();
-  if (isRegister(tok)) {
-    return register_();
-  } else if (isDRegister(tok)) {
-    return dregister();
+BaseNode* Parser::indirect() {
+  next();
+  auto& tok = peek();
+  auto offset = tok.offset;
+  BaseNode* node;
+  int step = 0;
+  if (tok.keyword.kind == KeywordKind::REGISTER ||
+      tok.keyword.kind == KeywordKind::DREGISTER) {
+    node = tok.keyword.kind == KeywordKind::REGISTER ? register_()
+                                                      : dregister();
+    if (node == nullptr) {
+      return nullptr;
+    }
+    node->setOffset(offset);
+    if (isPunctuation(peek(), '+')) {
+      step = 1;
+      next();
+    } else if (isPunctuation(peek(), '-')) {
+      step = -1;
+      next();
+    }
   } else {
-    return addition();
+    node = expression();
+    if (node == nullptr) {
+      return nullptr;
+    }
+  }
+  if (!isPunctuation(peek(), ')')) {
+    return fail("Expected )", peek().offset);
+  }
+  next();
+
+  auto& after = peek();
+  if (isComma(after) || isNewline(after) || isEof(after)) {
+    return make<Indirect>(node, step);
+  } else if (step != 0 || node->id() == NodeType::REGISTER ||
+             node->id() == NodeType::DREGISTER) {
+    return fail("Expected , or end of line", after.offset);
   }
+  // The parentheses only grouped the first operand of an expression
+  return expression(node, 1);
 }
 
-std::shared_ptr<BaseNode> Parser::register_() {
-  auto tok = next();
+BaseNode* Parser::register_() {
+  auto offset = peek().offset;
+  auto tok = text(next());
   if (tok.size() != 1) {
-    throw ParserException("Unrecognized Register");
+    return fail("Unrecognized Register", offset);
   }
 
-  switch (tok.at(0)) {
+  switch (tok[0]) {
     case 'a':
-      return std::make_shared<Register<'a'>>();
+      return make<Register<'a'>>();
     case 'f':
-      return std::make_shared<Register<'f'>>();
+      return make<Register<'f'>>();
     case 'b':
-      return std::make_shared<Register<'b'>>();
+      return make<Register<'b'>>();
     case 'c':
-      return std::make_shared<Register<'c'>>();
+      return make<Register<'c'>>();
     case 'd':
-      return std::make_shared<Register<'d'>>();
+      return make<Register<'d'>>();
     case 'e':
-      return std::make_shared<Register<'e'>>();
+      return make<Register<'e'>>();
     case 'h':
-      return std::make_shared<Register<'h'>>();
+      return make<Register<'h'>>();
     case 'l':
-      return std::make_shared<Register<'l'>>();
+      return make<Register<'l'>>();
     default:
-      throw ParserException("Unrecognized Register");
+      return fail("Unrecognized Register", offset);
   }
 }
 
-std::shared_ptr<BaseNode> Parser::dregister() {
-  auto tok = next();
+BaseNode* Parser::dregister() {
+  auto offset = peek().offset;
+  auto tok = text(next());
   if (tok == "af") {
-    return std::make_shared<DRegister<'a', 'f'>>();
+    return make<DRegister<'a', 'f'>>();
   } else if (tok == "bc") {
-    return std::make_shared<DRegister<'b', 'c'>>();
+    return make<DRegister<'b', 'c'>>();
   } else if (tok == "de") {
-    return std::make_shared<DRegister<'d', 'e'>>();
+    return make<DRegister<'d', 'e'>>();
   } else if (tok == "hl") {
-    return std::make_shared<DRegister<'h', 'l'>>();
+    return make<DRegister<'h', 'l'>>();
   } else if (tok == "sp") {
-    return std::make_shared<DRegister<'s', 'p'>>();
+    return make<DRegister<'s', 'p'>>();
   } else if (tok == "pc") {
-    return std::make_shared<DRegister<'p', 'c'>>();
+    return make<DRegister<'p', 'c'>>();
   } else {
-    throw ParserException("Unrecognized DRegister");
+    return fail("Unrecognized DRegister", offset);
   }
 }
 
-std::shared_ptr<BaseNode> Parser::addition() {
-  auto left = multiplication();
-  while (isAddition(peek())) {
-    auto op = next().at(0);
-    switch (op) {
-      case '+':
-        left = std::make_shared<AddOp>(left, multiplication());
-        break;
-      case '-':
-        left = std::make_shared<SubOp>(left, multiplication());
-        break;
-    }
+BaseNode* Parser::expression(int minPrecedence) {
+  auto left = unary();
+  if (left == nullptr) {
+    return nullptr;
   }
-  return left;
+  return expression(left, minPrecedence);
 }
 
-bool Parser::isAddition(const Token& tok) {
-  return (tok.size() > 0) && ((tok == "+") || (tok == "-"));
-}
-
-std::shared_ptr<BaseNode> Parser::multiplication() {
-  auto left = unary();
-  while (isMultiplication(peek())) {
-    auto op = next().at(0);
-    switch (op) {
-      case '*':
-        left = std::make_shared<MultOp>(left, unary());
-        break;
-      case '/':
-        left = std::make_shared<DivOp>(left, unary());
-        break;
+BaseNode* Parser::expression(BaseNode* left, int minPrecedence) {
+  int nTokens = 0;
+  for (auto op = binaryOperator(nTokens);
+       op != nullptr && op->precedence >= minPrecedence;
+       op = binaryOperator(nTokens)) {
+    for (int i = 0; i < nTokens; i++) {
+      next();
+    }
+    auto right = expression(op->precedence + 1);
+    if (right == nullptr) {
+      return nullptr;
     }
+    left = makeBinaryOp(mRoot->arena(), op->type, left, right);
   }
   return left;
 }
 
-bool Parser::isMultiplication(const Token& tok) {
-  return (tok.size() > 0) && ((tok == "*") || (tok == "/"));
+const OperatorProps* Parser::binaryOperator(int& nTokens) {
+  auto& tok = peek();
+  if (tok.kind != TokenKind::PUNCTUATION) {
+    return nullptr;
+  }
+  auto lexeme = text(tok);
+  auto& after = peekNext();
+  if (lexeme.size() == 1 && after.kind == TokenKind::PUNCTUATION &&
+      after.length == 1 && after.offset == tok.offset + 1) {
+    const char pair[] = {lexeme[0], text(after)[0]};
+    if (auto op = findOperator(std::string_view{pair, 2})) {
+      nTokens = 2;
+      return op;
+    }
+  }
+  nTokens = 1;
+  return findOperator(lexeme);
 }
 
-std::shared_ptr<BaseNode> Parser::unary() {
-  if (peek().size() < 1) {
-    throw ParserException("Invalid unary op");
+BaseNode* Parser::unary() {
+  auto& tok = peek();
+  if (tok.length < 1) {
+    return fail("Invalid unary op", tok.offset);
   }
-  switch (peek().at(0)) {
-    case '-':
-      next();
-      return std::make_shared<NegOp>(unary());
-    default:
-      return primary();
+  UnaryOpType type;
+  if (isPunctuation(tok, '-')) {
+    type = UnaryOpType::NEG;
+  } else if (isPunctuation(tok, '~')) {
+    type = UnaryOpType::NOT;
+  } else if (isPunctuation(tok, '!')) {
+    type = UnaryOpType::LNOT;
+  } else {
+    return primary();
+  }
+  next();
+  auto operand = unary();
+  if (operand == nullptr) {
+    return nullptr;
   }
+  return makeUnaryOp(mRoot->arena(), type, operand);
 }
 
-std::shared_ptr<BaseNode> Parser::primary() {
-  auto tok = peek();
-  if (isLabel(tok)) {
+BaseNode* Parser::primary() {
+  auto& tok = peek();
+  if (tok.kind == TokenKind::IDENTIFIER && isLabel(text(tok))) {
     return label();
-  } else if (isNumber(tok)) {
+  } else if (tok.kind == TokenKind::NUMBER) {
     return number();
+  } else if (isPunctuation(tok, '(')) {
+    next();
+    auto node = expression();
+    if (node == nullptr) {
+      return nullptr;
+    } else if (!isPunctuation(peek(), ')')) {
+      return fail("Expected )", peek().offset);
+    }
+    next();
+    return node;
   } else {
-    throw ParserException("Unrecognized primary expression");
+    return fail("Unrecognized primary expression", tok.offset);
   }
 }
 
-std::shared_ptr<BaseNode> Parser::number() { return parseNumber(next()); }
+BaseNode* Parser::number() {
+  auto tok = next();
+  if (tok.kind == TokenKind::NUMBER) {
+    return make<Number>(static_cast<int32_t>(tok.value));
+  } else {
+    return parseNumber(text(tok));
+  }
+}
 
-std::shared_ptr<BaseNode> Parser::parseNumber(const Token& tok) {
-  return std::make_shared<Number>(static_cast<Number>(std::atoi(tok.c_str())));
+BaseNode* Parser::parseNumber(std::string_view tok) {
+  int32_t value = 0;
+  std::from_chars(tok.data(), tok.data() + tok.size(), value);
+  return make<Number>(value);
 }
 
-bool Parser::isNewline(const Token& tok) { return tok == "EOL"; }
+bool Parser::isNewline(const TokenRecord& tok) {
+  return tok.kind == TokenKind::NEWLINE;
+}
 
-bool Parser::isComma(const Token& tok) { return tok == ","; }
+bool Parser::isComma(const TokenRecord& tok) { return isPunctuation(tok, ','); }
 
-int Parser::expectNewline(const TokenList& list, int start, int max) {
+bool Parser::isPunctuation(const TokenRecord& tok, char c) {
+  return tok.kind == TokenKind::PUNCTUATION &&
+         tok.value == static_cast<uint32_t>(c);
+}
+
+int Parser::expectNewline(const TokenRecordList& list, int start, int max) {
   for (int i = start; i < max; i++) {
     if (isNewline(list.at(i))) {
       return i;
@@ -317,7 +669,7 @@ int Parser::expectNewline(const TokenList& list, int start, int max) {
   return -1;
 }
 
-bool Parser::isEof(const Token& tok) { return tok == "EOF"; }
+bool Parser::isEof(const TokenRecord& tok) { return tok.kind == TokenKind::END; }
 
 TokenList Parser::readLine(TokenList& tokens) {
   TokenList list{};
@@ -327,24 +679,24 @@ TokenList Parser::readLine(TokenList& tokens) {
   return list;
 }
 
-bool Parser::isNumericOp(const Token& tok) {
-  return tok.size() == 1 && GBAS::isNumericOp(tok.at(0));
+bool Parser::isNumericOp(std::string_view tok) {
+  return tok.size() == 1 && GBAS::isNumericOp(tok[0]);
 }
 
-InstructionPropsList::const_iterator Parser::findInstruction(const Token& tok) {
-  for (auto it = instructions.begin(); it != instructions.end(); it++) {
-    if (it->lexeme == tok) {
-      return it;
-    }
+InstructionPropsList::const_iterator Parser::findInstruction(
+    std::string_view tok) {
+  auto keyword = findKeyword(tok);
+  if (keyword.kind != KeywordKind::INSTRUCTION) {
+    return instructions.end();
   }
-  return instructions.end();
+  return instructions.begin() + keyword.index;
 }
 
-bool Parser::isInstruction(const Token& tok) {
-  return findInstruction(tok) != instructions.end();
+bool Parser::isInstruction(std::string_view tok) {
+  return findKeyword(tok).kind == KeywordKind::INSTRUCTION;
 }
 
-bool Parser::isLabel(const Token& tok) {
+bool Parser::isLabel(std::string_view tok) {
   if (tok.size() == 0) {
     return false;
   } else if (isDigit(tok[0])) {
@@ -369,7 +721,7 @@ bool Parser::isLabel(const Token& tok) {
   return true;
 }
 
-bool Parser::isDirective(const Token& tok) {
+bool Parser::isDirective(std::string_view tok) {
   if (tok.size() < 2) {
     return false;
   } else if (tok[0] != '.') {
@@ -383,11 +735,10 @@ bool Parser::isDirective(const Token& tok) {
                      [](auto c) { return isAlphaNumeric(c); });
 }
 
-bool Parser::isRegister(const Token& tok) {
-  return std::find(registers.begin(), registers.end(), tok) != registers.end();
+bool Parser::isRegister(std::string_view tok) {
+  return findKeyword(tok).kind == KeywordKind::REGISTER;
 }
 
-bool Parser::isDRegister(const Token& tok) {
-  return std::find(doubleRegisters.begin(), doubleRegisters.end(), tok) !=
-         doubleRegisters.end();
+bool Parser::isDRegister(std::string_view tok) {
+  return findKeyword(tok).kind == KeywordKind::DREGISTER;
 }
@@ -0,0 +1,310 @@
+
+#include "scan.hpp"
+#include "char_utils.hpp"
+
+#if defined(__x86_64__) || defined(__SSE2__)
+#define SCAN_X86 1
+#include <immintrin.h>
+#endif
+
+using namespace GBAS;
+
+namespace Scan {
+
+namespace {
+
+constexpr bool isIdentifierChar(char c) {
+  return isAlphaNumeric(c) || c == '.' || c == '_' || c == '\\';
+}
+
+/*
+ * Scalar implementations. These also finish off the tail of the input which is
+ * shorter than a vector in the wide implementations.
+ */
+
+size_t findNewlineScalar(const char* data, size_t pos, size_t size) {
+  while (pos < size && data[pos] != '\n') {
+    pos++;
+  }
+  return pos;
+}
+
+size_t skipSpacesScalar(const char* data, size_t pos, size_t size) {
+  while (pos < size && data[pos] == ' ') {
+    pos++;
+  }
+  return pos;
+}
+
+size_t identifierEndScalar(const char* data, size_t pos, size_t size) {
+  while (pos < size && isIdentifierChar(data[pos])) {
+    pos++;
+  }
+  return pos;
+}
+
+size_t stringEndScalar(const char* data, size_t pos, size_t size) {
+  while (pos < size && data[pos] != '"') {
+    pos++;
+  }
+  return pos;
+}
+
+#ifdef SCAN_X86
+
+/*
+ * Each wide implementation builds a mask with one bit set per byte which ends
+ * the run; the position of the lowest set bit is the answer.
+ *
+ * The AVX2 versions hand the tail to the SSE2 versions, which use the legacy
+ * encoding. GCC does not clear the upper halves of the ymm registers before a
+ * tail call, so that has to be done by hand to avoid the transition penalty.
+ */
+
+size_t findNewlineSSE2(const char* data, size_t pos, size_t size) {
+  const auto newline = _mm_set1_epi8('\n');
+  for (; pos + 16 <= size; pos += 16) {
+    auto v = _mm_loadu_si128(reinterpret_cast<const __m128i*>(data + pos));
+    unsigned mask = _mm_movemask_epi8(_mm_cmpeq_epi8(v, newline));
+    if (mask != 0) {
+      return pos + __builtin_ctz(mask);
+    }
+  }
+  return findNewlineScalar(data, pos, size);
+}
+
+size_t skipSpacesSSE2(const char* data, size_t pos, size_t size) {
+  const auto space = _mm_set1_epi8(' ');
+  for (; pos + 16 <= size; pos += 16) {
+    auto v = _mm_loadu_si128(reinterpret_cast<const __m128i*>(data + pos));
+    unsigned mask = ~_mm_movemask_epi8(_mm_cmpeq_epi8(v, space)) & 0xffff;
+    if (mask != 0) {
+      return pos + __builtin_ctz(mask);
+    }
+  }
+  return skipSpacesScalar(data, pos, size);
+}
+
+size_t identifierEndSSE2(const char* data, size_t pos, size_t size) {
+  // Bytes >= 0x80 compare as negative, so they fall outside both ranges.
+  const auto caseBit = _mm_set1_epi8(0x20);
+  const auto belowA = _mm_set1_epi8('a' - 1);
+  const auto aboveZ = _mm_set1_epi8('z' + 1);
+  const auto below0 = _mm_set1_epi8('0' - 1);
+  const auto above9 = _mm_set1_epi8('9' + 1);
+  const auto dot = _mm_set1_epi8('.');
+  const auto underscore = _mm_set1_epi8('_');
+  const auto backslash = _mm_set1_epi8('\\');
+  for (; pos + 16 <= size; pos += 16) {
+    auto v = _mm_loadu_si128(reinterpret_cast<const __m128i*>(data + pos));
+    auto lower = _mm_or_si128(v, caseBit);
+    auto alpha = _mm_and_si128(_mm_cmpgt_epi8(lower, belowA),
+                               _mm_cmpgt_epi8(aboveZ, lower));
+    auto digit = _mm_and_si128(_mm_cmpgt_epi8(v, below0),
+                               _mm_cmpgt_epi8(above9, v));
+    auto other = _mm_or_si128(
+        _mm_cmpeq_epi8(v, dot),
+        _mm_or_si128(_mm_cmpeq_epi8(v, underscore),
+                     _mm_cmpeq_epi8(v, backslash)));
+    auto ident = _mm_or_si128(alpha, _mm_or_si128(digit, other));
+    unsigned mask = ~_mm_movemask_epi8(ident) & 0xffff;
+    if (mask != 0) {
+      return pos + __builtin_ctz(mask);
+    }
+  }
+  return identifierEndScalar(data, pos, size);
+}
+
+size_t stringEndSSE2(const char* data, size_t pos, size_t size) {
+  const auto quote = _mm_set1_epi8('"');
+  for (; pos + 16 <= size; pos += 16) {
+    auto v = _mm_loadu_si128(reinterpret_cast<const __m128i*>(data + pos));
+    unsigned mask = _mm_movemask_epi8(_mm_cmpeq_epi8(v, quote));
+    if (mask != 0) {
+      return pos + __builtin_ctz(mask);
+    }
+  }
+  return stringEndScalar(data, pos, size);
+}
+
+__attribute__((target("avx2"))) size_t findNewlineAVX2(const char* data,
+                                                       size_t pos,
+                                                       size_t size) {
+  const auto newline = _mm256_set1_epi8('\n');
+  for (; pos + 32 <= size; pos += 32) {
+    auto v = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(data + pos));
+    unsigned mask = _mm256_movemask_epi8(_mm256_cmpeq_epi8(v, newline));
+    if (mask != 0) {
+      return pos + __builtin_ctz(mask);
+    }
+  }
+  _mm256_zeroupper();
+  return findNewlineSSE2(data, pos, size);
+}
+
+__attribute__((target("avx2"))) size_t skipSpacesAVX2(const char* data,
+                                                      size_t pos,
+                                                      size_t size) {
+  const auto space = _mm256_set1_epi8(' ');
+  for (; pos + 32 <= size; pos += 32) {
+    auto v = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(data + pos));
+    unsigned mask = ~_mm256_movemask_epi8(_mm256_cmpeq_epi8(v, space));
+    if (mask != 0) {
+      return pos + __builtin_ctz(mask);
+    }
+  }
+  _mm256_zeroupper();
+  return skipSpacesSSE2(data, pos, size);
+}
+
+__attribute__((target("avx2"))) size_t identifierEndAVX2(const char* data,
+                                                         size_t pos,
+                                                         size_t size) {
+  const auto caseBit = _mm256_set1_epi8(0x20);
+  const auto belowA = _mm256_set1_epi8('a' - 1);
+  const auto aboveZ = _mm256_set1_epi8('z' + 1);
+  const auto below0 = _mm256_set1_epi8('0' - 1);
+  const auto above9 = _mm256_set1_epi8('9' + 1);
+  const auto dot = _mm256_set1_epi8('.');
+  const auto underscore = _mm256_set1_epi8('_');
+  const auto backslash = _mm256_set1_epi8('\\');
+  for (; pos + 32 <= size; pos += 32) {
+    auto v = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(data + pos));
+    auto lower = _mm256_or_si256(v, caseBit);
+    auto alpha = _mm256_and_si256(_mm256_cmpgt_epi8(lower, belowA),
+                                  _mm256_cmpgt_epi8(aboveZ, lower));
+    auto digit = _mm256_and_si256(_mm256_cmpgt_epi8(v, below0),
+                                  _mm256_cmpgt_epi8(above9, v));
+    auto other = _mm256_or_si256(
+        _mm256_cmpeq_epi8(v, dot),
+        _mm256_or_si256(_mm256_cmpeq_epi8(v, underscore),
+                        _mm256_cmpeq_epi8(v, backslash)));
+    auto ident = _mm256_or_si256(alpha, _mm256_or_si256(digit, other));
+    unsigned mask = ~_mm256_movemask_epi8(ident);
+    if (mask != 0) {
+      return pos + __builtin_ctz(mask);
+    }
+  }
+  _mm256_zeroupper();
+  return identifierEndSSE2(data, pos, size);
+}
+
+__attribute__((target("avx2"))) size_t stringEndAVX2(const char* data,
+                                                     size_t pos,
+                                                     size_t size) {
+  const auto quote = _mm256_set1_epi8('"');
+  for (; pos + 32 <= size; pos += 32) {
+    auto v = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(data + pos));
+    unsigned mask = _mm256_movemask_epi8(_mm256_cmpeq_epi8(v, quote));
+    if (mask != 0) {
+      return pos + __builtin_ctz(mask);
+    }
+  }
+  _mm256_zeroupper();
+  return stringEndSSE2(data, pos, size);
+}
+
+#endif  // SCAN_X86
+
+struct Impl {
+  size_t (*findNewline)(const char*, size_t, size_t);
+  size_t (*skipSpaces)(const char*, size_t, size_t);
+  size_t (*identifierEnd)(const char*, size_t, size_t);
+  size_t (*stringEnd)(const char*, size_t, size_t);
+};
+
+const Impl scalarImpl = {
+    findNewlineScalar,
+    skipSpacesScalar,
+    identifierEndScalar,
+    stringEndScalar,
+};
+
+#ifdef SCAN_X86
+const Impl sse2Impl = {
+    findNewlineSSE2,
+    skipSpacesSSE2,
+    identifierEndSSE2,
+    stringEndSSE2,
+};
+
+const Impl avx2Impl = {
+    findNewlineAVX2,
+    skipSpacesAVX2,
+    identifierEndAVX2,
+    stringEndAVX2,
+};
+#endif
+
+const Impl& implFor(Isa isa) {
+  switch (isa) {
+#ifdef SCAN_X86
+    case Isa::AVX2:
+      return avx2Impl;
+    case Isa::SSE2:
+      return sse2Impl;
+#endif
+    default:
+      return scalarImpl;
+  }
+}
+
+// Constant-initialized so that scanning is safe even from other static
+// initializers; the detected instruction set is selected right after.
+Isa gSelected = Isa::SCALAR;
+const Impl* gImpl = &scalarImpl;
+
+struct SelectDetected {
+  SelectDetected() { select(detect()); }
+} selectDetected;
+
+}  // namespace
+
+Isa detect() {
+#ifdef SCAN_X86
+  __builtin_cpu_init();
+  if (__builtin_cpu_supports("avx2")) {
+    return Isa::AVX2;
+  }
+  return Isa::SSE2;
+#else
+  return Isa::SCALAR;
+#endif
+}
+
+Isa selected() { return gSelected; }
+
+void select(Isa isa) {
+  gSelected = isa;
+  gImpl = &implFor(isa);
+}
+
+const char* name(Isa isa) {
+  switch (isa) {
+    case Isa::SCALAR:
+      return "scalar";
+    case Isa::SSE2:
+      return "sse2";
+    case Isa::AVX2:
+      return "avx2";
+  }
+  return "unknown";
+}
+
+size_t findNewline(const char* data, size_t pos, size_t size) {
+  return gImpl->findNewline(data, pos, size);
+}
+
+size_t skipSpaces(const char* data, size_t pos, size_t size) {
+  return gImpl->skipSpaces(data, pos, size);
+}
+
+size_t identifierEnd(const char* data, size_t pos, size_t size) {
+  return gImpl->identifierEnd(data, pos, size);
+}
+
+size_t stringEnd(const char* data, size_t pos, size_t size) {
+  return gImpl->stringEnd(data, pos, size);
+}
+
+};  // namespace Scan
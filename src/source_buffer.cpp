@@ -0,0 +1,120 @@
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <sstream>
+
+#include "source_buffer.hpp"
+#include "scan.hpp"
+
+SourceBuffer::SourceBuffer(std::string text)
+    : mData{nullptr},
+      mSize{text.size()},
+      mMapped{false},
+      mOwned{std::move(text)},
+      mLineStarts{} {
+  mData = mOwned.data();
+}
+
+SourceBuffer::SourceBuffer(const char* data, size_t size)
+    : mData{data}, mSize{size}, mMapped{true}, mOwned{}, mLineStarts{} {}
+
+SourceBuffer::SourceBuffer(SourceBuffer&& other) noexcept
+    : mData{other.mData},
+      mSize{other.mSize},
+      mMapped{other.mMapped},
+      mOwned{std::move(other.mOwned)},
+      mLineStarts{std::move(other.mLineStarts)} {
+  // A short owned string may live inside the std::string object itself, so
+  // the data pointer has to follow it.
+  if (!mMapped) {
+    mData = mOwned.data();
+  }
+  other.mData = nullptr;
+  other.mSize = 0;
+  other.mMapped = false;
+}
+
+SourceBuffer& SourceBuffer::operator=(SourceBuffer&& other) noexcept {
+  if (this != &other) {
+    release();
+    mSize = other.mSize;
+    mMapped = other.mMapped;
+    mOwned = std::move(other.mOwned);
+    mLineStarts = std::move(other.mLineStarts);
+    mData = mMapped ? other.mData : mOwned.data();
+    other.mData = nullptr;
+    other.mSize = 0;
+    other.mMapped = false;
+  }
+  return *this;
+}
+
+SourceBuffer::~SourceBuffer() { release(); }
+
+void SourceBuffer::release() {
+  if (mMapped && mSize > 0) {
+    munmap(const_cast<char*>(mData), mSize);
+  }
+  mData = nullptr;
+  mSize = 0;
+  mMapped = false;
+  mLineStarts.clear();
+}
+
+SourceLocation SourceBuffer::locate(uint32_t offset) const {
+  if (mLineStarts.empty()) {
+    mLineStarts.push_back(0);
+    for (size_t pos = Scan::findNewline(mData, 0, mSize); pos < mSize;
+         pos = Scan::findNewline(mData, pos + 1, mSize)) {
+      mLineStarts.push_back(static_cast<uint32_t>(pos + 1));
+    }
+  }
+
+  // The line is the last one starting at or before offset
+  auto next = std::upper_bound(mLineStarts.begin(), mLineStarts.end(), offset);
+  auto line = static_cast<uint32_t>(next - mLineStarts.begin());
+  return SourceLocation{line, offset - *(next - 1) + 1};
+}
+
+SourceBuffer SourceBuffer::map(const std::string& path) {
+  int fd = open(path.c_str(), O_RDONLY);
+  if (fd < 0) {
+    std::ostringstream builder{};
+    builder << "Failed to open " << path << ": " << strerror(errno);
+    throw SourceBufferException{builder.str()};
+  }
+
+  struct stat st;
+  if (fstat(fd, &st) != 0) {
+    std::ostringstream builder{};
+    builder << "Failed to stat " << path << ": " << strerror(errno);
+    close(fd);
+    throw SourceBufferException{builder.str()};
+  }
+
+  size_t size = static_cast<size_t>(st.st_size);
+  if (size == 0) {
+    // mmap refuses zero-length mappings.
+    close(fd);
+    return SourceBuffer{std::string{}};
+  }
+
+  void* addr = mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0);
+  // The mapping stays valid after the descriptor is closed.
+  close(fd);
+  if (addr == MAP_FAILED) {
+    std::ostringstream builder{};
+    builder << "Failed to map " << path << ": " << strerror(errno);
+    throw SourceBufferException{builder.str()};
+  }
+  // Tokenizing reads the file front to back exactly once.
+  madvise(addr, size, MADV_SEQUENTIAL);
+
+  return SourceBuffer{static_cast<const char*>(addr), size};
+}
@@ -0,0 +1,162 @@
+
+#include <cstdint>
+
+#include "token_stream.hpp"
+#include "scan.hpp"
+
+TokenStream::TokenStream()
+    : mWindow{},
+      mPos{0},
+      mDone{false},
+      mEnd{TokenKind::END, 0, 0, 0},
+      mText{},
+      mTextOffset{0},
+      mDiagnostics{nullptr} {}
+
+bool TokenStream::ensure(size_t n) {
+  while (mWindow.size() - mPos < n) {
+    if (mDone) {
+      return false;
+    }
+    if (mPos == mWindow.size()) {
+      // Everything has been consumed, and the last token consumed was a
+      // NEWLINE, which has no text of its own.
+      mWindow.clear();
+      mPos = 0;
+    }
+    if (!fill(mWindow)) {
+      mDone = true;
+      mEnd = mWindow.back();
+    }
+  }
+  return true;
+}
+
+SourceTokenStream::SourceTokenStream(const SourceBuffer& source)
+    : TokenStream{}, mTokenizer{}, mSource{source}, mPos{0}, mLineno{0} {
+  if (source.size() > UINT32_MAX) {
+    throw TokenizerException("Input too large", 0, 0);
+  }
+  setText(source.text(), 0);
+}
+
+bool SourceTokenStream::fill(TokenRecordList& window) {
+  // Same notion of a line as std::getline: the final line does not need a
+  // terminating newline, but an empty file has no lines at all.
+  size_t size = mSource.size();
+  if (mPos >= size) {
+    window.push_back(
+        TokenRecord{TokenKind::END, static_cast<uint32_t>(size), 0, 0});
+    return false;
+  }
+
+  size_t end = Scan::findNewline(mSource.data(), mPos, size);
+  mTokenizer.setDiagnostics(diagnostics());
+  mTokenizer.tokenizeLine(mSource.text().substr(mPos, end - mPos),
+                          static_cast<uint32_t>(mPos), mLineno, window);
+  mLineno++;
+  mPos = end + 1;
+  return true;
+}
+
+InputTokenStream::InputTokenStream(std::istream& input)
+    : TokenStream{},
+      mTokenizer{},
+      mInput{input},
+      mLines{},
+      mLine{},
+      mLinesOffset{0},
+      mOffset{0},
+      mLineno{0} {}
+
+bool InputTokenStream::fill(TokenRecordList& window) {
+  if (window.empty()) {
+    mLines.clear();
+    mLinesOffset = mOffset;
+  }
+
+  if (!std::getline(mInput, mLine)) {
+    window.push_back(TokenRecord{TokenKind::END, mOffset, 0, 0});
+    setText(mLines, mLinesOffset);
+    return false;
+  }
+
+  // The last line may not have a newline
+  size_t consumed = mLine.size() + (mInput.eof() ? 0 : 1);
+  if (mOffset + consumed > UINT32_MAX) {
+    throw TokenizerException("Input too large", mLineno, 0);
+  }
+
+  auto lineOffset = mOffset;
+  mOffset += static_cast<uint32_t>(consumed);
+  mLines.append(mLine);
+  mLines.push_back('\n');
+  mTokenizer.setDiagnostics(diagnostics());
+  mTokenizer.tokenizeLine(mLine, lineOffset, mLineno, window);
+  mLineno++;
+  setText(mLines, mLinesOffset);
+  return true;
+}
+
+TokenRecordStream::TokenRecordStream(const SourceBuffer& source,
+                                     TokenRecordList tokens)
+    : TokenStream{},
+      mTokens{std::move(tokens)},
+      mPos{0},
+      mSize{static_cast<uint32_t>(source.size())} {
+  setText(source.text(), 0);
+}
+
+bool TokenRecordStream::fill(TokenRecordList& window) {
+  while (mPos < mTokens.size()) {
+    auto& tok = mTokens[mPos++];
+    window.push_back(tok);
+    if (tok.kind == TokenKind::NEWLINE) {
+      return true;
+    } else if (tok.kind == TokenKind::END) {
+      return false;
+    }
+  }
+  window.push_back(TokenRecord{TokenKind::END, mSize, 0, 0});
+  return false;
+}
+
+TokenListStream::TokenListStream(const TokenList& tokens)
+    : TokenStream{},
+      mTokens{tokens},
+      mPos{0},
+      mLines{},
+      mLinesOffset{0},
+      mOffset{0} {}
+
+bool TokenListStream::fill(TokenRecordList& window) {
+  if (window.empty()) {
+    mLines.clear();
+    mLinesOffset = mOffset;
+  }
+
+  while (mPos < mTokens.size()) {
+    auto& tok = mTokens[mPos++];
+    if (mOffset + tok.size() > UINT32_MAX) {
+      throw TokenizerException("Input too large", 0, 0);
+    }
+    auto offset = mOffset;
+    mLines.append(tok);
+    mOffset += static_cast<uint32_t>(tok.size());
+    if (tok == "EOL") {
+      window.push_back(TokenRecord{TokenKind::NEWLINE, offset, 0, 0});
+      setText(mLines, mLinesOffset);
+      return true;
+    } else if (tok == "EOF") {
+      window.push_back(TokenRecord{TokenKind::END, offset, 0, 0});
+      setText(mLines, mLinesOffset);
+      return false;
+    } else {
+      window.push_back(Tokenizer::classify(tok, offset));
+    }
+  }
+  // Lists which were not produced by the tokenizer may lack EOF
+  window.push_back(TokenRecord{TokenKind::END, mOffset, 0, 0});
+  setText(mLines, mLinesOffset);
+  return false;
+}
@@ -1,12 +1,20 @@
 
 #include <algorithm>
+#include <array>
+#include <exception>
 #include <string>
+#include <thread>
 
 #include "tokenizer.hpp"
 #include "char_utils.hpp"
+#include "scan.hpp"
 
 using namespace GBAS;
 
+Tokenizer::Tokenizer() : mLog{&std::cerr}, mDiagnostics{nullptr} {}
+
+Tokenizer::Tokenizer(std::ostream& log) : mLog{&log}, mDiagnostics{nullptr} {}
+
 const std::array<Token, 2> Tokenizer::reserved = {
     "EOL",
     "EOF",
@@ -18,7 +26,7 @@ bool Tokenizer::isReserved(Token tok) {
 }
 
 void Tokenizer::logError(std::ostream& out, const std::string& msg,
-                         const std::string& line, int lineno, int col) {
+                         std::string_view line, int lineno, int col) {
   out << "Line " << lineno << ": " << msg << std::endl;
   out << line << std::endl;
   std::string arrow(col + 1, '-');
@@ -26,115 +34,509 @@ void Tokenizer::logError(std::ostream& out, const std::string& msg,
   out << arrow << std::endl;
 }
 
+namespace {
+
+/**
+ * Classes of characters which the tokenizer treats the same way. EOL stands
+ * for the end of the line, which is not a character.
+ */
+enum CharClass : uint8_t {
+  SPACE,
+  IDENT,
+  QUOTE,
+  OPEN,
+  // Characters which form a token of their own, and also end an identifier
+  // without a space in between
+  CLOSE,
+  SEMICOLON,
+  // $, which starts hexadecimal numbers
+  RADIX,
+  // %, which starts binary numbers but is the modulo operator right after
+  // another token
+  PERCENT,
+  APOSTROPHE,
+  OTHER,
+  EOL,
+  N_CLASSES,
+};
+
+constexpr std::array<CharClass, 256> makeCharClasses() {
+  std::array<CharClass, 256> classes{};
+  for (int i = 0; i < 256; i++) {
+    char c = static_cast<char>(i);
+    if (c == ' ') {
+      classes[i] = SPACE;
+    } else if (isAlphaNumeric(c) || c == '.' || c == '_' || c == '\\') {
+      classes[i] = IDENT;
+    } else if (c == '"') {
+      classes[i] = QUOTE;
+    } else if (c == '(') {
+      classes[i] = OPEN;
+    } else if (c == ')' || c == ',' || c == ':' || isNumericOp(c) ||
+               isOperatorChar(c)) {
+      classes[i] = CLOSE;
+    } else if (c == ';') {
+      classes[i] = SEMICOLON;
+    } else if (c == '$') {
+      classes[i] = RADIX;
+    } else if (c == '%') {
+      classes[i] = PERCENT;
+    } else if (c == '\'') {
+      classes[i] = APOSTROPHE;
+    } else {
+      classes[i] = OTHER;
+    }
+  }
+  return classes;
+}
+
+constexpr auto charClasses = makeCharClasses();
+
+enum State : uint8_t {
+  // Between tokens
+  START,
+  // Inside an identifier or number
+  TOKEN,
+  // Inside a string, after the opening quote
+  STRING,
+  // Inside a character literal, after the opening apostrophe
+  CHARACTER,
+  N_STATES,
+};
+
+enum Action : uint8_t {
+  // Skip a run of spaces
+  SKIP,
+  // Start a token at this character
+  BEGIN,
+  // Continue the token with this character
+  CONTINUE,
+  // This character is a token of its own
+  SINGLE,
+  // The token ends before this character, which is skipped
+  END,
+  // The token ends before this character, which is a token of its own
+  END_SINGLE,
+  // The token ends with this character
+  END_INCLUSIVE,
+  // The token ends the line
+  END_LINE_TOKEN,
+  END_LINE,
+  INVALID,
+  UNTERMINATED,
+};
+
+struct Transition {
+  State next;
+  Action action;
+};
+
+constexpr Transition transitions[N_STATES][N_CLASSES] = {
+    // START
+    {
+        {START, SKIP},        // SPACE
+        {TOKEN, BEGIN},       // IDENT
+        {STRING, BEGIN},      // QUOTE
+        {START, SINGLE},      // OPEN
+        {START, SINGLE},      // CLOSE
+        {START, END_LINE},    // SEMICOLON
+        {TOKEN, BEGIN},       // RADIX
+        {TOKEN, BEGIN},       // PERCENT
+        {CHARACTER, BEGIN},   // APOSTROPHE
+        {START, INVALID},     // OTHER
+        {START, END_LINE},    // EOL
+    },
+    // TOKEN
+    {
+        {START, END},             // SPACE
+        {TOKEN, CONTINUE},        // IDENT
+        {TOKEN, INVALID},         // QUOTE
+        {TOKEN, INVALID},         // OPEN
+        {START, END_SINGLE},      // CLOSE
+        {TOKEN, INVALID},         // SEMICOLON
+        {TOKEN, INVALID},         // RADIX
+        {START, END_SINGLE},      // PERCENT
+        {TOKEN, INVALID},         // APOSTROPHE
+        {TOKEN, INVALID},         // OTHER
+        {START, END_LINE_TOKEN},  // EOL
+    },
+    // STRING
+    {
+        {STRING, CONTINUE},       // SPACE
+        {STRING, CONTINUE},       // IDENT
+        {START, END_INCLUSIVE},   // QUOTE
+        {STRING, CONTINUE},       // OPEN
+        {STRING, CONTINUE},       // CLOSE
+        {STRING, CONTINUE},       // SEMICOLON
+        {STRING, CONTINUE},       // RADIX
+        {STRING, CONTINUE},       // PERCENT
+        {STRING, CONTINUE},       // APOSTROPHE
+        {STRING, CONTINUE},       // OTHER
+        {STRING, UNTERMINATED},   // EOL
+    },
+    // CHARACTER
+    {
+        {CHARACTER, CONTINUE},      // SPACE
+        {CHARACTER, CONTINUE},      // IDENT
+        {CHARACTER, CONTINUE},      // QUOTE
+        {CHARACTER, CONTINUE},      // OPEN
+        {CHARACTER, CONTINUE},      // CLOSE
+        {CHARACTER, CONTINUE},      // SEMICOLON
+        {CHARACTER, CONTINUE},      // RADIX
+        {CHARACTER, CONTINUE},      // PERCENT
+        {START, END_INCLUSIVE},     // APOSTROPHE
+        {CHARACTER, CONTINUE},      // OTHER
+        {CHARACTER, UNTERMINATED},  // EOL
+    },
+};
+
+/**
+ * Decode digits in base radix into value, wrapping around at 32 bits. False if
+ * there are no digits or one of them is not valid in radix.
+ */
+bool decodeDigits(std::string_view digits, uint32_t radix, uint32_t& value) {
+  if (digits.empty()) {
+    return false;
+  }
+  value = 0;
+  for (auto c : digits) {
+    if (!isHexDigit(c) || digitValue(c) >= radix) {
+      return false;
+    }
+    value = value * radix + digitValue(c);
+  }
+  return true;
+}
+
+/**
+ * Decode a numeric literal: decimal 123, hexadecimal $7f or 0x7f, binary
+ * %1010 or the character literal 'A'.
+ */
+bool decodeNumber(std::string_view text, uint32_t& value) {
+  if (text.size() == 3 && text[0] == '\'' && text[2] == '\'') {
+    value = static_cast<uint8_t>(text[1]);
+    return true;
+  } else if (text[0] == '$') {
+    return decodeDigits(text.substr(1), 16, value);
+  } else if (text[0] == '%') {
+    return decodeDigits(text.substr(1), 2, value);
+  } else if (text.size() > 2 && text[0] == '0' &&
+             (text[1] == 'x' || text[1] == 'X')) {
+    return decodeDigits(text.substr(2), 16, value);
+  } else {
+    return isDigit(text[0]) && decodeDigits(text, 10, value);
+  }
+}
+
+/**
+ * Skip the rest of a run of characters which do not change the state, from
+ * pos.
+ */
+size_t skipRun(State state, const char* data, size_t pos, size_t size) {
+  // The identifier and string states loop on most characters, so their runs
+  // are skipped with the vectorized scanner rather than a character at a
+  // time. Character literals are short.
+  switch (state) {
+    case TOKEN:
+      return Scan::identifierEnd(data, pos, size);
+    case STRING:
+      return Scan::stringEnd(data, pos, size);
+    default:
+      return pos;
+  }
+}
+
+}  // namespace
+
+template <typename Emit>
+bool Tokenizer::tokenizeLine(std::string_view line, uint32_t offset,
+                             int lineno, Emit&& emit) {
+  const char* data = line.data();
+  size_t size = line.size();
+  State state = START;
+  size_t pos = 0;
+  size_t start = 0;
+  while (true) {
+    auto cls = pos < size ? charClasses[static_cast<uint8_t>(data[pos])] : EOL;
+    auto transition = transitions[state][cls];
+    state = transition.next;
+    switch (transition.action) {
+      case SKIP:
+        pos = Scan::skipSpaces(data, pos, size);
+        break;
+      case BEGIN:
+        start = pos;
+        pos = skipRun(state, data, pos + 1, size);
+        break;
+      case CONTINUE:
+        pos = skipRun(state, data, pos + 1, size);
+        break;
+      case SINGLE:
+        emit(pos, 1);
+        pos++;
+        break;
+      case END:
+        emit(start, pos - start);
+        pos++;
+        break;
+      case END_SINGLE:
+        emit(start, pos - start);
+        emit(pos, 1);
+        pos++;
+        break;
+      case END_INCLUSIVE:
+        emit(start, pos + 1 - start);
+        pos++;
+        break;
+      case END_LINE_TOKEN:
+        emit(start, pos - start);
+        return true;
+      case END_LINE:
+        return true;
+      case INVALID:
+        if (mDiagnostics != nullptr) {
+          mDiagnostics->push_back(Diagnostic{
+              offset + static_cast<uint32_t>(pos), "Invalid token"});
+          return false;
+        }
+        logError(*mLog, "Invalid token", line, lineno, pos);
+        throw TokenizerException("Invalid token " + std::string{line}, lineno,
+                                 pos);
+      case UNTERMINATED: {
+        auto msg = state == STRING ? "Unterminated string"
+                                   : "Unterminated character literal";
+        if (mDiagnostics != nullptr) {
+          mDiagnostics->push_back(
+              Diagnostic{offset + static_cast<uint32_t>(pos), msg});
+          return false;
+        }
+        logError(*mLog, msg, line, lineno, pos);
+        throw TokenizerException(msg, lineno, pos);
+      }
+    }
+  }
+}
+
 TokenList Tokenizer::tokenize(std::basic_istream<char>& lines) {
   TokenList tokens = TokenList{};
 
   int lineno = 0;
-  std::string tokbuf;
+  uint32_t offset = 0;
   for (std::string line; std::getline(lines, line); line.clear()) {
-    auto state = State::START_LINE;
-
-    size_t pos = 0;
-    while (state != State::END_LINE) {
-      char curr = line[pos];
-      // std::cout << curr << std::endl;
-      switch (state) {
-        case State::START_LINE:
-          if (pos >= line.size()) {
-            // EOL
-            lineno++;
-            state = State::END_LINE;
-          } else if (curr == ' ') {
-            pos++;
-          } else {
-            state = State::START_TOKEN;
-          }
-          break;
-        case State::START_TOKEN:
-          tokbuf.clear();
-          if (pos >= line.size() || curr == ';') {
-            // EOL or comment
-            lineno++;
-            state = State::END_LINE;
-          } else if (curr == ' ') {
-            // skip spaces but keep track of position for error messages
-            pos++;
-          } else if (isAlphaNumeric(curr) || curr == '.' || curr == '_' ||
-                     curr == '\\') {
-            // start of regular token
-            state = State::TOKEN;
-          } else if (curr == '"') {
-            // opening quote for string---requires special handling so spaces
-            // don't indicate the end of a token
-            tokbuf.push_back(curr);
-            pos++;
-            state = State::STRING_TOKEN;
-          } else if (curr == '(' || curr == ')' || curr == ',') {
-            // one-symbol tokens
-            tokbuf.push_back(curr);
-            pos++;
-            state = State::END_TOKEN;
-          } else if (isNumericOp(curr)) {
-            tokbuf.push_back(curr);
-            pos++;
-            state = State::END_TOKEN;
-          } else {
-            logError(std::cerr, "Invalid token", std::string{line.c_str()},
-                     lineno, pos);
-            throw TokenizerException("Invalid token" + line, lineno, pos);
-          }
-          break;
-        case State::STRING_TOKEN:
-          if (pos >= line.size()) {
-            logError(std::cerr, "Unterminated string", std::string{line.c_str()},
-                     lineno, pos);
-            throw TokenizerException("Unterminated string", lineno, pos);
-          } else if (curr == '"') {
-            // string end
-            tokbuf.push_back(curr);
-            pos++;
-            state = State::END_TOKEN;
-          } else {
-            // mid-string
-            tokbuf.push_back(curr);
-            pos++;
-          }
-          break;
-        case State::TOKEN:
-          if (pos >= line.size()) {
-            // EOL
-            state = State::END_TOKEN;
-          } else if (curr == ' ') {
-            pos++;
-            state = State::END_TOKEN;
-          } else if (isNumericOp(curr)) {
-            state = State::END_TOKEN;
-          } else if (curr == ',' || curr == ')') {
-            // end of token, but don't increment pos so these symbols are
-            // stored themselves as a token
-            state = State::END_TOKEN;
-          } else if (isAlphaNumeric(curr) || curr == '.' || curr == '_' ||
-                     curr == '\\') {
-            tokbuf.push_back(curr);
-            pos++;
-          } else {
-            logError(std::cerr, "Invalid token", std::string{line.data()},
-                     lineno, pos);
-            throw TokenizerException("Invalid token " + line, lineno, pos);
-          }
-          break;
-        case State::END_TOKEN:
-          tokens.push_back(Token{tokbuf});
-          tokbuf.clear();
-          state = State::START_TOKEN;
-          break;
-        case State::END_LINE:
-          break;
-      }
+    size_t lineStart = tokens.size();
+    auto emit = [&](size_t pos, size_t len) {
+      tokens.emplace_back(line, pos, len);
+    };
+    if (!tokenizeLine(line, offset, lineno, emit)) {
+      tokens.resize(lineStart);
     }
+    lineno++;
+    offset += static_cast<uint32_t>(line.size() + 1);
     tokens.push_back("EOL");
   }
   tokens.push_back("EOF");
 
   return tokens;
 }
+
+TokenRecordList Tokenizer::tokenize(const SourceBuffer& source) {
+  if (source.size() > UINT32_MAX) {
+    throw TokenizerException("Input too large", 0, 0);
+  }
+
+  TokenRecordList tokens = TokenRecordList{};
+  tokenizeLines(source.data(), 0, source.size(), 0, tokens);
+  tokens.push_back(
+      TokenRecord{TokenKind::END, static_cast<uint32_t>(source.size()), 0, 0});
+
+  return tokens;
+}
+
+/**
+ * Run fn(i) for every i in [0, n) on a thread of its own.
+ */
+template <typename Fn>
+static void parallelFor(size_t n, Fn&& fn) {
+  std::vector<std::thread> threads{};
+  threads.reserve(n);
+  for (size_t i = 0; i < n; i++) {
+    threads.emplace_back([&fn, i]() { fn(i); });
+  }
+  for (auto& thread : threads) {
+    thread.join();
+  }
+}
+
+TokenRecordList Tokenizer::tokenize(const SourceBuffer& source,
+                                    unsigned threads) {
+  if (source.size() > UINT32_MAX) {
+    throw TokenizerException("Input too large", 0, 0);
+  }
+
+  if (threads == 0) {
+    threads = std::max(1u, std::thread::hardware_concurrency());
+  }
+  const char* data = source.data();
+  size_t size = source.size();
+  size_t nChunks = std::min<size_t>(threads, size / MIN_CHUNK_SIZE);
+  if (nChunks <= 1) {
+    return tokenize(source);
+  }
+
+  // Chunks start right after a newline, so every chunk begins in
+  // the START state exactly as it would when tokenizing sequentially.
+  std::vector<size_t> bounds{0};
+  for (size_t i = 1; i < nChunks; i++) {
+    size_t pos = std::max(bounds.back(), size * i / nChunks);
+    pos = Scan::findNewline(data, pos, size);
+    if (pos >= size) {
+      break;
+    }
+    bounds.push_back(pos + 1);
+  }
+  bounds.push_back(size);
+  nChunks = bounds.size() - 1;
+
+  // First number the lines of each chunk so that errors report the same line
+  // as the sequential tokenizer.
+  std::vector<int> firstLine(nChunks + 1, 0);
+  parallelFor(nChunks, [&](size_t i) {
+    int lines = 0;
+    for (size_t pos = bounds[i]; pos < bounds[i + 1];
+         pos = Scan::findNewline(data, pos, bounds[i + 1]) + 1) {
+      lines++;
+    }
+    firstLine[i + 1] = lines;
+  });
+  for (size_t i = 0; i < nChunks; i++) {
+    firstLine[i + 1] += firstLine[i];
+  }
+
+  // Error messages are held back so that only those of the first chunk to
+  // fail are printed, as the sequential tokenizer stops at the first error.
+  std::vector<TokenRecordList> chunks(nChunks);
+  std::vector<std::ostringstream> logs(nChunks);
+  std::vector<std::exception_ptr> errors(nChunks);
+  std::vector<DiagnosticList> diagnostics(nChunks);
+  parallelFor(nChunks, [&](size_t i) {
+    try {
+      Tokenizer tokenizer{logs[i]};
+      if (mDiagnostics != nullptr) {
+        tokenizer.setDiagnostics(&diagnostics[i]);
+      }
+      tokenizer.tokenizeLines(data, bounds[i], bounds[i + 1], firstLine[i],
+                              chunks[i]);
+    } catch (...) {
+      errors[i] = std::current_exception();
+    }
+  });
+  for (size_t i = 0; i < nChunks; i++) {
+    if (errors[i]) {
+      *mLog << logs[i].str();
+      std::rethrow_exception(errors[i]);
+    }
+  }
+  if (mDiagnostics != nullptr) {
+    for (auto& chunk : diagnostics) {
+      mDiagnostics->insert(mDiagnostics->end(), chunk.begin(), chunk.end());
+    }
+  }
+
+  std::vector<size_t> starts(nChunks + 1, 0);
+  for (size_t i = 0; i < nChunks; i++) {
+    starts[i + 1] = starts[i] + chunks[i].size();
+  }
+  TokenRecordList tokens(starts[nChunks] + 1);
+  parallelFor(nChunks, [&](size_t i) {
+    std::copy(chunks[i].begin(), chunks[i].end(), tokens.begin() + starts[i]);
+    TokenRecordList{}.swap(chunks[i]);
+  });
+  tokens.back() = TokenRecord{TokenKind::END, static_cast<uint32_t>(size), 0, 0};
+
+  return tokens;
+}
+
+void Tokenizer::tokenizeLines(const char* data, size_t begin, size_t end,
+                              int lineno, TokenRecordList& tokens) {
+  // Same notion of a line as std::getline: the final line does not need a
+  // terminating newline, but an empty file has no lines at all.
+  for (size_t pos = begin; pos < end;) {
+    size_t lineEnd = Scan::findNewline(data, pos, end);
+    tokenizeLine(std::string_view{data + pos, lineEnd - pos},
+                 static_cast<uint32_t>(pos), lineno, tokens);
+    lineno++;
+    pos = lineEnd + 1;
+  }
+}
+
+bool Tokenizer::tokenizeLine(std::string_view line, uint32_t offset,
+                             int lineno, TokenRecordList& tokens) {
+  size_t lineStart = tokens.size();
+  auto emit = [&](size_t pos, size_t len) {
+    tokens.push_back(
+        classify(line.substr(pos, len), offset + static_cast<uint32_t>(pos)));
+  };
+  bool valid = tokenizeLine(line, offset, lineno, emit);
+  if (!valid) {
+    tokens.resize(lineStart);
+  }
+  tokens.push_back(TokenRecord{
+      TokenKind::NEWLINE, offset + static_cast<uint32_t>(line.size()), 0, 0});
+  return valid;
+}
+
+TokenRecord Tokenizer::classify(std::string_view text, uint32_t offset) {
+  auto length = static_cast<uint32_t>(text.size());
+  if (text.empty()) {
+    return TokenRecord{TokenKind::IDENTIFIER, offset, length, 0};
+  }
+
+  char first = text[0];
+  if (first == '"') {
+    return TokenRecord{TokenKind::STRING, offset, length, 0};
+  } else if (text.size() == 1 &&
+             (first == '(' || first == ')' || first == ',' || first == ':' ||
+              first == '%' || isNumericOp(first) || isOperatorChar(first))) {
+    return TokenRecord{TokenKind::PUNCTUATION, offset, length,
+                       static_cast<uint32_t>(first)};
+  } else if (text.size() == 2 && findOperator(text) != nullptr) {
+    // The tokenizer splits these into two tokens, but lists of token strings
+    // may hold them whole
+    return TokenRecord{TokenKind::PUNCTUATION, offset, length,
+                       static_cast<uint32_t>(first)};
+  }
+
+  uint32_t value = 0;
+  if (decodeNumber(text, value)) {
+    return TokenRecord{TokenKind::NUMBER, offset, length, value};
+  } else if (isDigit(first) || first == '$' || first == '%' ||
+             first == '\'') {
+    // Malformed numbers are left for the parser to reject
+    return TokenRecord{TokenKind::IDENTIFIER, offset, length, 0};
+  } else {
+    return TokenRecord{TokenKind::IDENTIFIER, offset, length, 0,
+                       findKeyword(text)};
+  }
+}
+
+std::string_view Tokenizer::text(const SourceBuffer& source,
+                                 const TokenRecord& tok) {
+  switch (tok.kind) {
+    case TokenKind::NEWLINE:
+      return reserved[0];
+    case TokenKind::END:
+      return reserved[1];
+    default:
+      return source.text(tok.offset, tok.length);
+  }
+}
+
+TokenList Tokenizer::toTokenList(const SourceBuffer& source,
+                                 const TokenRecordList& tokens) {
+  TokenList list{};
+  list.reserve(tokens.size());
+  for (auto& tok : tokens) {
+    list.emplace_back(text(source, tok));
+  }
+  return list;
+}
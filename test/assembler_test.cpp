@@ -2,8 +2,11 @@
 #define BOOST_TEST_DYN_LINK
 #include <boost/test/unit_test.hpp>
 
+#include <map>
+
 #include "assembler.hpp"
 #include "elf_wrapper.hpp"
+#include "opcodes.hpp"
 
 /*
  * We need a notion of AST equality. Given two trees, let's walk them both and
@@ -12,14 +15,13 @@
  * @note We could move this into the individual node definitions if it's useful
  * outside these tests, but otherwise let's isolate the clutter.
  */
-static bool isAstEqual(std::shared_ptr<AST::BaseNode> left,
-                       std::shared_ptr<AST::BaseNode> right) {
+static bool isAstEqual(AST::BaseNode* left, AST::BaseNode* right) {
   // Examine only the left node's NodeType. If the right node fails to
-  // `dynamic_pointer_cast`, we'll know its type doesn't match.
+  // `dynamic_cast`, we'll know its type doesn't match.
   switch (left->id()) {
     case AST::NodeType::ROOT: {
-      auto lRoot = std::dynamic_pointer_cast<AST::Root>(left);
-      auto rRoot = std::dynamic_pointer_cast<AST::Root>(right);
+      auto lRoot = dynamic_cast<AST::Root*>(left);
+      auto rRoot = dynamic_cast<AST::Root*>(right);
       if (lRoot && rRoot) {
         auto lIt = lRoot->begin();
         auto rIt = rRoot->begin();
@@ -37,8 +39,8 @@ static bool isAstEqual(std::shared_ptr<AST::BaseNode> left,
       }
     } break;
     case AST::NodeType::INSTRUCTION: {
-      auto lInstr = std::dynamic_pointer_cast<AST::BaseInstruction>(left);
-      auto rInstr = std::dynamic_pointer_cast<AST::BaseInstruction>(right);
+      auto lInstr = dynamic_cast<AST::BaseInstruction*>(left);
+      auto rInstr = dynamic_cast<AST::BaseInstruction*>(right);
       if (lInstr && rInstr) {
         if (lInstr->nOperands() != rInstr->nOperands() ||
             lInstr->type() != rInstr->type()) {
@@ -53,8 +55,8 @@ static bool isAstEqual(std::shared_ptr<AST::BaseNode> left,
           // operands and instruction type, which are checked above.
           break;
         case 1: {
-          auto lInstr1 = std::dynamic_pointer_cast<AST::Instruction1>(lInstr);
-          auto rInstr1 = std::dynamic_pointer_cast<AST::Instruction1>(rInstr);
+          auto lInstr1 = dynamic_cast<AST::Instruction1*>(lInstr);
+          auto rInstr1 = dynamic_cast<AST::Instruction1*>(rInstr);
           if (lInstr1 && rInstr1) {
             if (!isAstEqual(lInstr1->operand(), rInstr1->operand())) {
               return false;
@@ -64,8 +66,8 @@ static bool isAstEqual(std::shared_ptr<AST::BaseNode> left,
           }
         } break;
         case 2: {
-          auto lInstr2 = std::dynamic_pointer_cast<AST::Instruction2>(lInstr);
-          auto rInstr2 = std::dynamic_pointer_cast<AST::Instruction2>(rInstr);
+          auto lInstr2 = dynamic_cast<AST::Instruction2*>(lInstr);
+          auto rInstr2 = dynamic_cast<AST::Instruction2*>(rInstr);
           if (lInstr2 && rInstr2) {
             if (!isAstEqual(lInstr2->left(), rInstr2->left()) ||
                 !isAstEqual(lInstr2->right(), rInstr2->right())) {
@@ -80,8 +82,8 @@ static bool isAstEqual(std::shared_ptr<AST::BaseNode> left,
       }
     } break;
     case AST::NodeType::REGISTER: {
-      auto lreg = std::dynamic_pointer_cast<AST::BaseRegister>(left);
-      auto rreg = std::dynamic_pointer_cast<AST::BaseRegister>(right);
+      auto lreg = dynamic_cast<AST::BaseRegister*>(left);
+      auto rreg = dynamic_cast<AST::BaseRegister*>(right);
       if (lreg && rreg) {
         if (lreg->reg() != rreg->reg()) {
           return false;
@@ -91,8 +93,8 @@ static bool isAstEqual(std::shared_ptr<AST::BaseNode> left,
       }
     } break;
     case AST::NodeType::DREGISTER: {
-      auto lreg = std::dynamic_pointer_cast<AST::BaseDRegister>(left);
-      auto rreg = std::dynamic_pointer_cast<AST::BaseDRegister>(right);
+      auto lreg = dynamic_cast<AST::BaseDRegister*>(left);
+      auto rreg = dynamic_cast<AST::BaseDRegister*>(right);
       if (lreg && rreg) {
         if (lreg->reg() != rreg->reg()) {
           return false;
@@ -101,9 +103,24 @@ static bool isAstEqual(std::shared_ptr<AST::BaseNode> left,
         return false;
       }
     } break;
+    case AST::NodeType::CONDITION: {
+      auto lcond = dynamic_cast<AST::Condition*>(left);
+      auto rcond = dynamic_cast<AST::Condition*>(right);
+      if (!lcond || !rcond || lcond->type() != rcond->type()) {
+        return false;
+      }
+    } break;
+    case AST::NodeType::INDIRECT: {
+      auto lind = dynamic_cast<AST::Indirect*>(left);
+      auto rind = dynamic_cast<AST::Indirect*>(right);
+      if (!lind || !rind || lind->step() != rind->step() ||
+          !isAstEqual(lind->address(), rind->address())) {
+        return false;
+      }
+    } break;
     case AST::NodeType::LABEL: {
-      auto llabel = std::dynamic_pointer_cast<AST::Label>(left);
-      auto rlabel = std::dynamic_pointer_cast<AST::Label>(right);
+      auto llabel = dynamic_cast<AST::Label*>(left);
+      auto rlabel = dynamic_cast<AST::Label*>(right);
       if (llabel && rlabel) {
         if (llabel->name() != rlabel->name()) {
           return false;
@@ -113,8 +130,8 @@ static bool isAstEqual(std::shared_ptr<AST::BaseNode> left,
       }
     } break;
     case AST::NodeType::NUMBER: {
-      auto lnum = std::dynamic_pointer_cast<AST::Number>(left);
-      auto rnum = std::dynamic_pointer_cast<AST::Number>(right);
+      auto lnum = dynamic_cast<AST::Number*>(left);
+      auto rnum = dynamic_cast<AST::Number*>(right);
       if (lnum && rnum) {
         if (lnum->value() != rnum->value()) {
           return false;
@@ -124,8 +141,8 @@ static bool isAstEqual(std::shared_ptr<AST::BaseNode> left,
       }
     } break;
     case AST::NodeType::BINARY_OP: {
-      auto lop = std::dynamic_pointer_cast<AST::BaseBinaryOp>(left);
-      auto rop = std::dynamic_pointer_cast<AST::BaseBinaryOp>(right);
+      auto lop = dynamic_cast<AST::BaseBinaryOp*>(left);
+      auto rop = dynamic_cast<AST::BaseBinaryOp*>(right);
       if (lop && rop) {
         if (lop->opType() != rop->opType()) {
           return false;
@@ -140,8 +157,8 @@ static bool isAstEqual(std::shared_ptr<AST::BaseNode> left,
       }
     } break;
     case AST::NodeType::UNARY_OP: {
-      auto lop = std::dynamic_pointer_cast<AST::BaseUnaryOp>(left);
-      auto rop = std::dynamic_pointer_cast<AST::BaseUnaryOp>(right);
+      auto lop = dynamic_cast<AST::BaseUnaryOp*>(left);
+      auto rop = dynamic_cast<AST::BaseUnaryOp*>(right);
       if (lop && rop) {
         if (lop->opType() != rop->opType()) {
           return false;
@@ -165,10 +182,10 @@ static bool isAstEqual(std::shared_ptr<AST::BaseNode> left,
  * For debugging purposes.
  */
 #define INDENT() std::string(level, ' ')
-static void printAst(std::shared_ptr<AST::BaseNode> left, int level) {
+static void printAst(AST::BaseNode* left, int level) {
   switch (left->id()) {
     case AST::NodeType::ROOT: {
-      auto lRoot = std::dynamic_pointer_cast<AST::Root>(left);
+      auto lRoot = dynamic_cast<AST::Root*>(left);
       std::cout << INDENT() << "(Root" << std::endl;
       auto lIt = lRoot->begin();
       while (lIt != lRoot->end()) {
@@ -177,7 +194,7 @@ static void printAst(std::shared_ptr<AST::BaseNode> left, int level) {
       std::cout << INDENT() << ")" << std::endl;
     } break;
     case AST::NodeType::INSTRUCTION: {
-      auto lInstr = std::dynamic_pointer_cast<AST::BaseInstruction>(left);
+      auto lInstr = dynamic_cast<AST::BaseInstruction*>(left);
       switch (lInstr->nOperands()) {
         case 0:
           // The only properties we need to check for equality are number of
@@ -185,12 +202,12 @@ static void printAst(std::shared_ptr<AST::BaseNode> left, int level) {
           break;
         case 1: {
           std::cout << INDENT() << "(Instruction1" << std::endl;
-          auto lInstr1 = std::dynamic_pointer_cast<AST::Instruction1>(lInstr);
+          auto lInstr1 = dynamic_cast<AST::Instruction1*>(lInstr);
           printAst(lInstr1->operand(), level + 1);
           std::cout << INDENT() << ")" << std::endl;
         } break;
         case 2: {
-          auto lInstr2 = std::dynamic_pointer_cast<AST::Instruction2>(lInstr);
+          auto lInstr2 = dynamic_cast<AST::Instruction2*>(lInstr);
           std::cout << INDENT() << "(Instruction2" << std::endl;
           printAst(lInstr2->left(), level + 1);
           printAst(lInstr2->right(), level + 1);
@@ -201,25 +218,25 @@ static void printAst(std::shared_ptr<AST::BaseNode> left, int level) {
       }
     } break;
     case AST::NodeType::REGISTER: {
-      auto lreg = std::dynamic_pointer_cast<AST::BaseRegister>(left);
+      auto lreg = dynamic_cast<AST::BaseRegister*>(left);
       std::cout << INDENT() << "(Register " << lreg->reg() << ")" << std::endl;
     } break;
     case AST::NodeType::DREGISTER: {
-      auto lreg = std::dynamic_pointer_cast<AST::BaseDRegister>(left);
+      auto lreg = dynamic_cast<AST::BaseDRegister*>(left);
       std::cout << INDENT() << "(DRegister " << lreg->reg() << ")" << std::endl;
     } break;
     case AST::NodeType::LABEL: {
-      auto llabel = std::dynamic_pointer_cast<AST::Label>(left);
+      auto llabel = dynamic_cast<AST::Label*>(left);
       std::cout << INDENT() << "(Label " << llabel->name() << ")" << std::endl;
     } break;
     case AST::NodeType::NUMBER: {
-      auto lnum = std::dynamic_pointer_cast<AST::Number>(left);
+      auto lnum = dynamic_cast<AST::Number*>(left);
       std::cout << INDENT() << "(Number "
                 << std::to_string(static_cast<uint32_t>(lnum->value())) << ")"
                 << std::endl;
     } break;
     case AST::NodeType::BINARY_OP: {
-      auto lop = std::dynamic_pointer_cast<AST::BaseBinaryOp>(left);
+      auto lop = dynamic_cast<AST::BaseBinaryOp*>(left);
       std::cout << INDENT() << "(BinaryOp ";
       switch (lop->opType()) {
         case AST::BinaryOpType::ADD:
@@ -234,13 +251,16 @@ static void printAst(std::shared_ptr<AST::BaseNode> left, int level) {
         case AST::BinaryOpType::DIV:
           std::cout << "DIV" << std::endl;
           break;
+        default:
+          std::cout << static_cast<int>(lop->opType()) << std::endl;
+          break;
       }
       printAst(lop->left(), level + 1);
       printAst(lop->right(), level + 1);
       std::cout << INDENT() << ")" << std::endl;
     } break;
     case AST::NodeType::UNARY_OP: {
-      auto lop = std::dynamic_pointer_cast<AST::BaseUnaryOp>(left);
+      auto lop = dynamic_cast<AST::BaseUnaryOp*>(left);
       std::cout << INDENT() << "(UnaryOp ";
       switch (lop->opType()) {
         case AST::UnaryOpType::NEG:
@@ -273,181 +293,185 @@ class InvalidNode : public AST::Node<AST::NodeType::INVALID> {
  * expression.
  */
 BOOST_AUTO_TEST_CASE(assembler_test_evaluate_basic) {
+  AST::Arena arena{};
   {  // empty root evaluates to empty root
     auto lroot = std::make_shared<AST::Root>();
-    auto rroot = Assembler::evaluate(lroot);
-    BOOST_CHECK(isAstEqual(lroot, rroot));
+    Assembler::evaluate(*lroot);
+    BOOST_CHECK_EQUAL(lroot->size(), 0);
   }
 
-  {  // root with children that cannot be evaluated evaluates to same tree
-    auto lchild = std::make_shared<AST::Number>(42);
+  {  // root with children that cannot be evaluated keeps them
+    auto lchild = arena.make<AST::Number>(42);
     auto lroot = std::make_shared<AST::Root>();
     lroot->add(lchild);
-    auto rroot = Assembler::evaluate(lroot);
-    BOOST_CHECK(isAstEqual(lroot, rroot));
+    Assembler::evaluate(*lroot);
+    BOOST_REQUIRE_EQUAL(lroot->size(), 1);
+    BOOST_CHECK(lroot->begin()[0] == lchild);
+    BOOST_CHECK(lchild->folded());
   }
 
   {  // number evaluates to same number
-    auto lnum = std::make_shared<AST::Number>(42);
-    auto rnum = Assembler::evaluate(lnum);
+    auto lnum = arena.make<AST::Number>(42);
+    auto rnum = Assembler::evaluate(lnum, arena);
     BOOST_CHECK(isAstEqual(lnum, rnum));
   }
 
   {  // label evaluates to same label
-    auto llabel = std::make_shared<AST::Label>("asdf_1234");
-    auto rlabel = Assembler::evaluate(llabel);
+    auto llabel = arena.make<AST::Label>("asdf_1234");
+    auto rlabel = Assembler::evaluate(llabel, arena);
     BOOST_CHECK(isAstEqual(llabel, rlabel));
   }
 
   {  // register evaluates to same register
-    auto lreg = std::make_shared<AST::Register<'e'>>();
-    auto rreg = Assembler::evaluate(lreg);
+    auto lreg = arena.make<AST::Register<'e'>>();
+    auto rreg = Assembler::evaluate(lreg, arena);
     BOOST_CHECK(isAstEqual(lreg, rreg));
   }
 
   {  // dregister evaluates to same dregister
-    auto lreg = std::make_shared<AST::DRegister<'d', 'e'>>();
-    auto rreg = Assembler::evaluate(lreg);
+    auto lreg = arena.make<AST::DRegister<'d', 'e'>>();
+    auto rreg = Assembler::evaluate(lreg, arena);
     BOOST_CHECK(isAstEqual(lreg, rreg));
   }
 
   {  // invalid node throws exception
-    auto lnode = std::make_shared<InvalidNode>();
-    BOOST_CHECK_THROW(Assembler::evaluate(lnode), AssemblerException);
+    auto lnode = arena.make<InvalidNode>();
+    BOOST_CHECK_THROW(Assembler::evaluate(lnode, arena), AssemblerException);
   }
 }
 
 BOOST_AUTO_TEST_CASE(assembler_test_evaluateUnaryOp) {
+  AST::Arena arena{};
   {  // unary op on register cannot be evaluated
-    auto lrand = std::make_shared<AST::Register<'a'>>();
-    auto lnode = std::make_shared<AST::NegOp>(lrand);
-    auto rnode = Assembler::evaluateUnaryOp(lnode);
+    auto lrand = arena.make<AST::Register<'a'>>();
+    auto lnode = arena.make<AST::NegOp>(lrand);
+    auto rnode = Assembler::evaluateUnaryOp(lnode, arena);
     BOOST_CHECK(isAstEqual(lnode, rnode));
   }
 
   {  // unary op on label cannot be evaluated (... right?) TODO
-    auto lrand = std::make_shared<AST::Label>("asdf");
-    auto lnode = std::make_shared<AST::NegOp>(lrand);
-    auto rnode = Assembler::evaluateUnaryOp(lnode);
+    auto lrand = arena.make<AST::Label>("asdf");
+    auto lnode = arena.make<AST::NegOp>(lrand);
+    auto rnode = Assembler::evaluateUnaryOp(lnode, arena);
     BOOST_CHECK(isAstEqual(lnode, rnode));
   }
 
   {  // unary op on number CAN be evaluated
-    auto lrand = std::make_shared<AST::Number>(42);
-    auto lnode = std::make_shared<AST::NegOp>(lrand);
-    auto rnode = Assembler::evaluateUnaryOp(lnode);
+    auto lrand = arena.make<AST::Number>(42);
+    auto lnode = arena.make<AST::NegOp>(lrand);
+    auto rnode = Assembler::evaluateUnaryOp(lnode, arena);
     BOOST_CHECK(!isAstEqual(lnode, rnode));
     BOOST_CHECK(rnode->id() == AST::NodeType::NUMBER);
-    auto rnum = std::dynamic_pointer_cast<AST::Number>(rnode);
+    auto rnum = dynamic_cast<AST::Number*>(rnode);
     BOOST_CHECK(rnum);
     BOOST_CHECK(static_cast<int8_t>(rnum->value()) == -42);
   }
 
   {  // invalid unary op raises exception
-    auto lrand = std::make_shared<AST::Number>(42);
+    auto lrand = arena.make<AST::Number>(42);
     auto lnode =
-        std::make_shared<AST::UnaryOp<AST::UnaryOpType::INVALID>>(lrand);
-    BOOST_CHECK_THROW(Assembler::evaluateUnaryOp(lnode), AssemblerException);
+        arena.make<AST::UnaryOp<AST::UnaryOpType::INVALID>>(lrand);
+    BOOST_CHECK_THROW(Assembler::evaluateUnaryOp(lnode, arena), AssemblerException);
   }
 }
 
 class InvalidBinaryOp : public AST::BaseBinaryOp {
  public:
   InvalidBinaryOp()
-      : AST::BaseBinaryOp{std::shared_ptr<BaseNode>{nullptr},
-                          std::shared_ptr<BaseNode>{nullptr}} {}
+      : AST::BaseBinaryOp{nullptr, nullptr} {}
 };
 
 BOOST_AUTO_TEST_CASE(assembler_test_evaluateBinaryOp) {
+  AST::Arena arena{};
   {  // binary op on register cannot be evaluated
-    auto lleft = std::make_shared<AST::Register<'a'>>();
-    auto lright = std::make_shared<AST::Register<'b'>>();
-    auto lnode = std::make_shared<AST::MultOp>(lleft, lright);
-    auto rnode = Assembler::evaluateBinaryOp(lnode);
+    auto lleft = arena.make<AST::Register<'a'>>();
+    auto lright = arena.make<AST::Register<'b'>>();
+    auto lnode = arena.make<AST::MultOp>(lleft, lright);
+    auto rnode = Assembler::evaluateBinaryOp(lnode, arena);
     BOOST_CHECK(isAstEqual(lnode, rnode));
   }
 
   {  // binary op on label cannot be evaluated TODO
-    auto lleft = std::make_shared<AST::Label>("asdf1");
-    auto lright = std::make_shared<AST::Label>("asdf2");
-    auto lnode = std::make_shared<AST::MultOp>(lleft, lright);
-    auto rnode = Assembler::evaluateBinaryOp(lnode);
+    auto lleft = arena.make<AST::Label>("asdf1");
+    auto lright = arena.make<AST::Label>("asdf2");
+    auto lnode = arena.make<AST::MultOp>(lleft, lright);
+    auto rnode = Assembler::evaluateBinaryOp(lnode, arena);
     BOOST_CHECK(isAstEqual(lnode, rnode));
   }
 
   {  // binary op on label cannot be evaluated TODO
-    auto lleft = std::make_shared<AST::Number>(42);
-    auto lright = std::make_shared<AST::Label>("asdf2");
-    auto lnode = std::make_shared<AST::AddOp>(lleft, lright);
-    auto rnode = Assembler::evaluateBinaryOp(lnode);
+    auto lleft = arena.make<AST::Number>(42);
+    auto lright = arena.make<AST::Label>("asdf2");
+    auto lnode = arena.make<AST::AddOp>(lleft, lright);
+    auto rnode = Assembler::evaluateBinaryOp(lnode, arena);
     BOOST_CHECK(isAstEqual(lnode, rnode));
   }
 
   {  // binary op on label cannot be evaluated TODO
-    auto lleft = std::make_shared<AST::Label>("asdf2");
-    auto lright = std::make_shared<AST::Number>(42);
-    auto lnode = std::make_shared<AST::SubOp>(lleft, lright);
-    auto rnode = Assembler::evaluateBinaryOp(lnode);
+    auto lleft = arena.make<AST::Label>("asdf2");
+    auto lright = arena.make<AST::Number>(42);
+    auto lnode = arena.make<AST::SubOp>(lleft, lright);
+    auto rnode = Assembler::evaluateBinaryOp(lnode, arena);
     BOOST_CHECK(isAstEqual(lnode, rnode));
   }
 
   {  // binary op on label cannot be evaluated TODO
-    auto lleft = std::make_shared<AST::Register<'d'>>();
-    auto lright = std::make_shared<AST::Number>(42);
-    auto lnode = std::make_shared<AST::DivOp>(lleft, lright);
-    auto rnode = Assembler::evaluateBinaryOp(lnode);
+    auto lleft = arena.make<AST::Register<'d'>>();
+    auto lright = arena.make<AST::Number>(42);
+    auto lnode = arena.make<AST::DivOp>(lleft, lright);
+    auto rnode = Assembler::evaluateBinaryOp(lnode, arena);
     BOOST_CHECK(isAstEqual(lnode, rnode));
   }
 
   {  // binary op on numbers CAN be evaluated
-    auto lleft = std::make_shared<AST::Number>(21);
-    auto lright = std::make_shared<AST::Number>(2);
-    auto lnode = std::make_shared<AST::MultOp>(lleft, lright);
-    auto rnode = Assembler::evaluateBinaryOp(lnode);
+    auto lleft = arena.make<AST::Number>(21);
+    auto lright = arena.make<AST::Number>(2);
+    auto lnode = arena.make<AST::MultOp>(lleft, lright);
+    auto rnode = Assembler::evaluateBinaryOp(lnode, arena);
     BOOST_CHECK(!isAstEqual(lnode, rnode));
     BOOST_CHECK(rnode->id() == AST::NodeType::NUMBER);
-    auto rnum = std::dynamic_pointer_cast<AST::Number>(rnode);
+    auto rnum = dynamic_cast<AST::Number*>(rnode);
     BOOST_CHECK(rnum->value() == 42);
   }
 
   {  // binary op on numbers CAN be evaluated
-    auto lleft = std::make_shared<AST::Number>(40);
-    auto lright = std::make_shared<AST::Number>(2);
-    auto lnode = std::make_shared<AST::AddOp>(lleft, lright);
-    auto rnode = Assembler::evaluateBinaryOp(lnode);
+    auto lleft = arena.make<AST::Number>(40);
+    auto lright = arena.make<AST::Number>(2);
+    auto lnode = arena.make<AST::AddOp>(lleft, lright);
+    auto rnode = Assembler::evaluateBinaryOp(lnode, arena);
     BOOST_CHECK(!isAstEqual(lnode, rnode));
     BOOST_CHECK(rnode->id() == AST::NodeType::NUMBER);
-    auto rnum = std::dynamic_pointer_cast<AST::Number>(rnode);
+    auto rnum = dynamic_cast<AST::Number*>(rnode);
     BOOST_CHECK(rnum->value() == 42);
   }
 
   {  // binary op on numbers CAN be evaluated
-    auto lleft = std::make_shared<AST::Number>(50);
-    auto lright = std::make_shared<AST::Number>(8);
-    auto lnode = std::make_shared<AST::SubOp>(lleft, lright);
-    auto rnode = Assembler::evaluateBinaryOp(lnode);
+    auto lleft = arena.make<AST::Number>(50);
+    auto lright = arena.make<AST::Number>(8);
+    auto lnode = arena.make<AST::SubOp>(lleft, lright);
+    auto rnode = Assembler::evaluateBinaryOp(lnode, arena);
     BOOST_CHECK(!isAstEqual(lnode, rnode));
     BOOST_CHECK(rnode->id() == AST::NodeType::NUMBER);
-    auto rnum = std::dynamic_pointer_cast<AST::Number>(rnode);
+    auto rnum = dynamic_cast<AST::Number*>(rnode);
     BOOST_CHECK(rnum->value() == 42);
   }
 
   {  // binary op on numbers CAN be evaluated
-    auto lright = std::make_shared<AST::Number>(4);
-    auto llleft = std::make_shared<AST::Number>(92);
-    auto llright = std::make_shared<AST::Number>(2);
-    auto llnode = std::make_shared<AST::DivOp>(llleft, llright);
-    auto lnode = std::make_shared<AST::SubOp>(llnode, lright);
-    auto rnode = Assembler::evaluateBinaryOp(lnode);
+    auto lright = arena.make<AST::Number>(4);
+    auto llleft = arena.make<AST::Number>(92);
+    auto llright = arena.make<AST::Number>(2);
+    auto llnode = arena.make<AST::DivOp>(llleft, llright);
+    auto lnode = arena.make<AST::SubOp>(llnode, lright);
+    auto rnode = Assembler::evaluateBinaryOp(lnode, arena);
     BOOST_CHECK(!isAstEqual(lnode, rnode));
     BOOST_CHECK(rnode->id() == AST::NodeType::NUMBER);
-    auto rnum = std::dynamic_pointer_cast<AST::Number>(rnode);
+    auto rnum = dynamic_cast<AST::Number*>(rnode);
     BOOST_CHECK(rnum->value() == 42);
   }
 
   {  // invalid binary op should throw
-    auto lnode = std::make_shared<InvalidBinaryOp>();
-    BOOST_CHECK_THROW(Assembler::evaluateBinaryOp(lnode), AssemblerException);
+    auto lnode = arena.make<InvalidBinaryOp>();
+    BOOST_CHECK_THROW(Assembler::evaluateBinaryOp(lnode, arena), AssemblerException);
   }
 }
 
@@ -457,143 +481,236 @@ class InvalidInstruction : public AST::Instruction<3> {
 };
 
 BOOST_AUTO_TEST_CASE(assembler_test_evaluateInstruction) {
+  AST::Arena arena{};
   {  // instruction with no operands should not change
     auto linstr =
-        std::make_shared<AST::Instruction0>(AST::InstructionType::NOP);
-    auto rinstr = Assembler::evaluateInstruction(linstr);
+        arena.make<AST::Instruction0>(AST::InstructionType::NOP);
+    auto rinstr = Assembler::evaluateInstruction(linstr, arena);
     BOOST_CHECK(isAstEqual(linstr, rinstr));
   }
 
   {  // instruction with one register operand should not change
-    auto lrand = std::make_shared<AST::Register<'b'>>();
+    auto lrand = arena.make<AST::Register<'b'>>();
     auto linstr =
-        std::make_shared<AST::Instruction1>(AST::InstructionType::INC, lrand);
-    auto rinstr = Assembler::evaluateInstruction(linstr);
+        arena.make<AST::Instruction1>(AST::InstructionType::INC, lrand);
+    auto rinstr = Assembler::evaluateInstruction(linstr, arena);
     BOOST_CHECK(isAstEqual(linstr, rinstr));
   }
 
   {  // instruction with one register and one label operand should not change
-    auto lleft = std::make_shared<AST::Register<'b'>>();
-    auto lright = std::make_shared<AST::Label>("asdf");
-    auto linstr = std::make_shared<AST::Instruction2>(AST::InstructionType::ADD,
+    auto lleft = arena.make<AST::Register<'b'>>();
+    auto lright = arena.make<AST::Label>("asdf");
+    auto linstr = arena.make<AST::Instruction2>(AST::InstructionType::ADD,
                                                       lleft, lright);
-    auto rinstr = Assembler::evaluateInstruction(linstr);
+    auto rinstr = Assembler::evaluateInstruction(linstr, arena);
     BOOST_CHECK(isAstEqual(linstr, rinstr));
   }
 
   {  // invalid instruction should throw
-    auto linstr = std::make_shared<InvalidInstruction>();
-    BOOST_CHECK_THROW(Assembler::evaluateInstruction(linstr),
+    auto linstr = arena.make<InvalidInstruction>();
+    BOOST_CHECK_THROW(Assembler::evaluateInstruction(linstr, arena),
                       AssemblerException);
   }
 
   {  // instruction with one unary operation as operand should get simplified
-    auto lrand = std::make_shared<AST::Number>(static_cast<uint8_t>(-42));
-    auto lop = std::make_shared<AST::NegOp>(lrand);
+    auto lrand = arena.make<AST::Number>(-42);
+    auto lop = arena.make<AST::NegOp>(lrand);
     auto linstr =
-        std::make_shared<AST::Instruction1>(AST::InstructionType::DEC, lop);
-    auto rinstr = Assembler::evaluateInstruction(linstr);
+        arena.make<AST::Instruction1>(AST::InstructionType::DEC, lop);
+    auto rinstr = Assembler::evaluateInstruction(linstr, arena);
     BOOST_CHECK(!isAstEqual(linstr, rinstr));
-    auto rinstr1 = std::dynamic_pointer_cast<AST::Instruction1>(rinstr);
+    auto rinstr1 = dynamic_cast<AST::Instruction1*>(rinstr);
     BOOST_CHECK(rinstr1->operand()->id() == AST::NodeType::NUMBER);
-    auto rrand = std::dynamic_pointer_cast<AST::Number>(rinstr1->operand());
+    auto rrand = dynamic_cast<AST::Number*>(rinstr1->operand());
     BOOST_CHECK(rrand->value() == 42);
   }
 
   {  // instruction with one binary operation as operand should get simplified
-    auto lleft = std::make_shared<AST::Number>(21);
-    auto lright = std::make_shared<AST::Number>(2);
-    auto lrand = std::make_shared<AST::MultOp>(lleft, lright);
+    auto lleft = arena.make<AST::Number>(21);
+    auto lright = arena.make<AST::Number>(2);
+    auto lrand = arena.make<AST::MultOp>(lleft, lright);
     auto linstr =
-        std::make_shared<AST::Instruction1>(AST::InstructionType::INC, lrand);
-    auto rinstr = Assembler::evaluateInstruction(linstr);
+        arena.make<AST::Instruction1>(AST::InstructionType::INC, lrand);
+    auto rinstr = Assembler::evaluateInstruction(linstr, arena);
     BOOST_CHECK(!isAstEqual(linstr, rinstr));
-    auto rinstr1 = std::dynamic_pointer_cast<AST::Instruction1>(rinstr);
+    auto rinstr1 = dynamic_cast<AST::Instruction1*>(rinstr);
     BOOST_CHECK(rinstr1->operand()->id() == AST::NodeType::NUMBER);
-    auto rrand = std::dynamic_pointer_cast<AST::Number>(rinstr1->operand());
+    auto rrand = dynamic_cast<AST::Number*>(rinstr1->operand());
     BOOST_CHECK(rrand->value() == 42);
   }
 
   {  // instruction with one unary operation and one binary operation as
     // operands should get simplified
-    auto l1rand = std::make_shared<AST::Number>(static_cast<uint8_t>(-42));
-    auto l1op = std::make_shared<AST::NegOp>(l1rand);
-    auto l2left = std::make_shared<AST::Number>(84);
-    auto l2right = std::make_shared<AST::Number>(2);
-    auto l2op = std::make_shared<AST::DivOp>(l2left, l2right);
-    auto linstr = std::make_shared<AST::Instruction2>(AST::InstructionType::ADD,
+    auto l1rand = arena.make<AST::Number>(-42);
+    auto l1op = arena.make<AST::NegOp>(l1rand);
+    auto l2left = arena.make<AST::Number>(84);
+    auto l2right = arena.make<AST::Number>(2);
+    auto l2op = arena.make<AST::DivOp>(l2left, l2right);
+    auto linstr = arena.make<AST::Instruction2>(AST::InstructionType::ADD,
                                                       l1op, l2op);
-    auto rinstr = Assembler::evaluateInstruction(linstr);
+    auto rinstr = Assembler::evaluateInstruction(linstr, arena);
     BOOST_CHECK(!isAstEqual(linstr, rinstr));
-    auto rinstr2 = std::dynamic_pointer_cast<AST::Instruction2>(rinstr);
+    auto rinstr2 = dynamic_cast<AST::Instruction2*>(rinstr);
     BOOST_CHECK(rinstr2->left()->id() == AST::NodeType::NUMBER);
     BOOST_CHECK(rinstr2->right()->id() == AST::NodeType::NUMBER);
-    auto r1num = std::dynamic_pointer_cast<AST::Number>(rinstr2->left());
+    auto r1num = dynamic_cast<AST::Number*>(rinstr2->left());
     BOOST_CHECK(r1num->value() == 42);
-    auto r2num = std::dynamic_pointer_cast<AST::Number>(rinstr2->right());
+    auto r2num = dynamic_cast<AST::Number*>(rinstr2->right());
     BOOST_CHECK(r2num->value() == 42);
   }
 }
 
+BOOST_AUTO_TEST_CASE(assembler_test_evaluateOperators) {
+  AST::Arena arena{};
+  auto num = [&](int32_t value) { return arena.make<AST::Number>(value); };
+  auto value = [&](AST::BaseNode* node) {
+    auto result = Assembler::evaluate(node, arena);
+    BOOST_REQUIRE(result->id() == AST::NodeType::NUMBER);
+    return static_cast<AST::Number*>(result)->value();
+  };
+
+  BOOST_CHECK_EQUAL(value(arena.make<AST::OrOp>(
+                        arena.make<AST::ShlOp>(num(1), num(3)), num(1))),
+                    9);
+  BOOST_CHECK_EQUAL(value(arena.make<AST::ShrOp>(num(0x80), num(7))), 1);
+  BOOST_CHECK_EQUAL(value(arena.make<AST::ModOp>(num(17), num(5))), 2);
+  BOOST_CHECK_EQUAL(value(arena.make<AST::XorOp>(num(0x0f), num(0xff))), 0xf0);
+  // Comparisons are -1 when true, like in GNU as
+  BOOST_CHECK_EQUAL(value(arena.make<AST::LtOp>(num(1), num(2))), -1);
+  BOOST_CHECK_EQUAL(value(arena.make<AST::GeOp>(num(1), num(2))), 0);
+  BOOST_CHECK_EQUAL(value(arena.make<AST::LandOp>(num(3), num(4))), 1);
+  BOOST_CHECK_EQUAL(value(arena.make<AST::NotOp>(num(0x0f))), ~0x0f);
+  // Values are wide, so addresses do not wrap
+  BOOST_CHECK_EQUAL(value(arena.make<AST::AddOp>(num(0xc000), num(0x1234))),
+                    0xd234);
+  BOOST_CHECK_EQUAL(value(arena.make<AST::MultOp>(num(0x100), num(0x100))),
+                    0x10000);
+  BOOST_CHECK_EQUAL(value(arena.make<AST::LnotOp>(num(0))), 1);
+  BOOST_CHECK_THROW(value(arena.make<AST::ModOp>(num(1), num(0))),
+                    AssemblerException);
+
+  // Operands which are not numbers are kept
+  auto label = arena.make<AST::Label>("x");
+  auto kept = Assembler::evaluate(arena.make<AST::AndOp>(label, num(1)), arena);
+  BOOST_REQUIRE(kept->id() == AST::NodeType::BINARY_OP);
+  BOOST_CHECK(static_cast<AST::BaseBinaryOp*>(kept)->opType() ==
+              AST::BinaryOpType::AND);
+}
+
 BOOST_AUTO_TEST_CASE(assembler_test_evaluate) {
+  AST::Arena arena{};
   // Now let's evaluate a more interesting "program" that should not get
   // modified during evaluation
   {
     auto instr0 =
-        std::make_shared<AST::Instruction0>(AST::InstructionType::NOP);
-    auto instr1 = std::make_shared<AST::Instruction1>(
-        AST::InstructionType::JP, std::make_shared<AST::Label>("asdf"));
-    auto instr2 = std::make_shared<AST::Instruction2>(
-        AST::InstructionType::LD, std::make_shared<AST::DRegister<'b', 'c'>>(),
-        std::make_shared<AST::Number>(0x10));
+        arena.make<AST::Instruction0>(AST::InstructionType::NOP);
+    auto instr1 = arena.make<AST::Instruction1>(
+        AST::InstructionType::JP, arena.make<AST::Label>("asdf"));
+    auto instr2 = arena.make<AST::Instruction2>(
+        AST::InstructionType::LD, arena.make<AST::DRegister<'b', 'c'>>(),
+        arena.make<AST::Number>(0x10));
 
-    auto instrs =
-        std::vector<std::shared_ptr<AST::BaseNode>>{instr0, instr1, instr2};
-    auto lroot = std::make_shared<AST::Root>(instrs);
-    auto rroot = Assembler::evaluate(lroot);
-    BOOST_CHECK(isAstEqual(lroot, rroot));
+    auto lroot = std::make_shared<AST::Root>();
+    std::vector<AST::BaseNode*> instrs{instr0, instr1, instr2};
+    for (auto instr : instrs) {
+      lroot->add(instr);
+    }
+    // Nothing is copied
+    Assembler::evaluate(*lroot);
+    BOOST_CHECK(std::equal(lroot->begin(), lroot->end(), instrs.begin(),
+                           instrs.end()));
+    BOOST_CHECK_EQUAL(lroot->arena().size(), 0);
   }
 
   // Now a "program" that SHOULD get modified during evaluation
   {
     auto linstr0 =
-        std::make_shared<AST::Instruction0>(AST::InstructionType::NOP);
-    auto linstr1rand = std::make_shared<AST::Number>(static_cast<uint8_t>(-42));
-    auto linstr1op = std::make_shared<AST::NegOp>(linstr1rand);
-    auto linstr1 = std::make_shared<AST::Instruction1>(AST::InstructionType::JP,
+        arena.make<AST::Instruction0>(AST::InstructionType::NOP);
+    auto linstr1rand = arena.make<AST::Number>(-42);
+    auto linstr1op = arena.make<AST::NegOp>(linstr1rand);
+    auto linstr1 = arena.make<AST::Instruction1>(AST::InstructionType::JP,
                                                        linstr1op);
     auto linstr2op1left =
-        std::make_shared<AST::Number>(static_cast<uint8_t>(-42));
-    auto linstr2op1right = std::make_shared<AST::Number>(84);
+        arena.make<AST::Number>(-42);
+    auto linstr2op1right = arena.make<AST::Number>(84);
     auto linstr2op1 =
-        std::make_shared<AST::AddOp>(linstr2op1left, linstr2op1right);
-    auto linstr2op2left = std::make_shared<AST::Number>(84);
+        arena.make<AST::AddOp>(linstr2op1left, linstr2op1right);
+    auto linstr2op2left = arena.make<AST::Number>(84);
     auto linstr2op2right =
-        std::make_shared<AST::Number>(static_cast<uint8_t>(2));
-    auto linstr2op2 = std::make_shared<AST::NegOp>(std::make_shared<AST::NegOp>(
-        std::make_shared<AST::DivOp>(linstr2op2left, linstr2op2right)));
-    auto linstr2 = std::make_shared<AST::Instruction2>(AST::InstructionType::LD,
+        arena.make<AST::Number>(2);
+    auto linstr2op2 = arena.make<AST::NegOp>(arena.make<AST::NegOp>(
+        arena.make<AST::DivOp>(linstr2op2left, linstr2op2right)));
+    auto linstr2 = arena.make<AST::Instruction2>(AST::InstructionType::LD,
                                                        linstr2op1, linstr2op2);
 
-    auto linstrs =
-        std::vector<std::shared_ptr<AST::BaseNode>>{linstr0, linstr1, linstr2};
-    auto lroot = std::make_shared<AST::Root>(linstrs);
-    auto rroot = Assembler::evaluate(lroot);
-    BOOST_CHECK(!isAstEqual(lroot, rroot));
+    auto lroot = std::make_shared<AST::Root>();
+    for (auto instr : std::vector<AST::BaseNode*>{linstr0, linstr1, linstr2}) {
+      lroot->add(instr);
+    }
+    Assembler::evaluate(*lroot);
+    auto rroot = lroot;
+    // Only the instructions whose operands changed are copied, and the nodes
+    // which they were copied from are left as they were
+    BOOST_CHECK(lroot->begin()[0] == linstr0);
+    BOOST_CHECK(lroot->begin()[1] != linstr1);
+    BOOST_CHECK(linstr1->operand() == linstr1op);
+    BOOST_CHECK_EQUAL(linstr1rand->value(), -42);
+    BOOST_CHECK_EQUAL(linstr2op1left->value(), -42);
 
     // Let's just build the expected tree and make sure it's equal
     auto rinstr0 =
-      std::make_shared<AST::Instruction0>(AST::InstructionType::NOP);
-    auto rinstr1 = std::make_shared<AST::Instruction1>(
-        AST::InstructionType::JP, std::make_shared<AST::Number>(42));
-    auto rinstr2 = std::make_shared<AST::Instruction2>(
-        AST::InstructionType::LD, std::make_shared<AST::Number>(42),
-        std::make_shared<AST::Number>(42));
-
-    auto rinstrs =
-        std::vector<std::shared_ptr<AST::BaseNode>>{rinstr0, rinstr1, rinstr2};
-    auto rrootExpected = std::make_shared<AST::Root>(rinstrs);
-    BOOST_CHECK(isAstEqual(rroot, rrootExpected));
+      arena.make<AST::Instruction0>(AST::InstructionType::NOP);
+    auto rinstr1 = arena.make<AST::Instruction1>(
+        AST::InstructionType::JP, arena.make<AST::Number>(42));
+    auto rinstr2 = arena.make<AST::Instruction2>(
+        AST::InstructionType::LD, arena.make<AST::Number>(42),
+        arena.make<AST::Number>(42));
+
+    auto rrootExpected = std::make_shared<AST::Root>();
+    for (auto instr : std::vector<AST::BaseNode*>{rinstr0, rinstr1, rinstr2}) {
+      rrootExpected->add(instr);
+    }
+    BOOST_CHECK(isAstEqual(rroot.get(), rrootExpected.get()));
+
+    // Evaluating it again finds nothing to do
+    auto nodes = lroot->arena().size();
+    std::vector<AST::BaseNode*> instrs{lroot->begin(), lroot->end()};
+    Assembler::evaluate(*lroot);
+    BOOST_CHECK_EQUAL(lroot->arena().size(), nodes);
+    BOOST_CHECK(std::equal(lroot->begin(), lroot->end(), instrs.begin(),
+                           instrs.end()));
+  }
+
+  {  // folding nested operations makes a single number
+    auto sum = arena.make<AST::SubOp>(
+        arena.make<AST::AddOp>(
+            arena.make<AST::AddOp>(arena.make<AST::Number>(1),
+                                   arena.make<AST::Number>(2)),
+            arena.make<AST::Number>(3)),
+        arena.make<AST::Number>(4));
+    sum->setOffset(12);
+    AST::Arena evalArena{};
+    auto rnode = Assembler::evaluate(sum, evalArena);
+    BOOST_CHECK_EQUAL(evalArena.size(), 1);
+    BOOST_REQUIRE(rnode->id() == AST::NodeType::NUMBER);
+    BOOST_CHECK_EQUAL(static_cast<AST::Number*>(rnode)->value(), 2);
+    BOOST_CHECK_EQUAL(rnode->offset(), 12);
+  }
+
+  {  // an operation on a label keeps the label, and its folded operand
+    auto label = arena.make<AST::Label>("table");
+    auto lop = arena.make<AST::SubOp>(
+        label, arena.make<AST::MultOp>(arena.make<AST::Number>(2),
+                                       arena.make<AST::Number>(3)));
+    AST::Arena evalArena{};
+    auto rnode = Assembler::evaluate(lop, evalArena);
+    BOOST_CHECK_EQUAL(evalArena.size(), 2);
+    BOOST_REQUIRE(rnode->id() == AST::NodeType::BINARY_OP);
+    auto rop = static_cast<AST::BaseBinaryOp*>(rnode);
+    BOOST_CHECK(rop->left() == label);
+    BOOST_CHECK_EQUAL(static_cast<AST::Number*>(rop->right())->value(), 6);
+    BOOST_CHECK(Assembler::evaluate(rnode, evalArena) == rnode);
+    BOOST_CHECK_EQUAL(evalArena.size(), 2);
   }
 }
 
@@ -602,84 +719,25 @@ BOOST_AUTO_TEST_SUITE_END();
 BOOST_AUTO_TEST_SUITE(assembler_translation)
 
 BOOST_AUTO_TEST_CASE(assembler_test_instructionNone) {
-  {
-    auto result = std::vector<uint8_t>{InstructionNone(AST::InstructionType::NOP).encode()};
-    auto expected = std::vector<uint8_t>{0x00};
-    BOOST_CHECK(result == expected);
-  }
-  {
-    auto result = std::vector<uint8_t>{InstructionNone(AST::InstructionType::STOP).encode()};
-    auto expected = std::vector<uint8_t>{0x10};
-    BOOST_CHECK(result == expected);
-  }
-  {
-    auto result = std::vector<uint8_t>{InstructionNone(AST::InstructionType::RLCA).encode()};
-    auto expected = std::vector<uint8_t>{0x07};
-    BOOST_CHECK(result == expected);
-  }
-  {
-    auto result = std::vector<uint8_t>{InstructionNone(AST::InstructionType::RLA).encode()};
-    auto expected = std::vector<uint8_t>{0x17};
-    BOOST_CHECK(result == expected);
-  }
-  {
-    auto result = std::vector<uint8_t>{InstructionNone(AST::InstructionType::DAA).encode()};
-    auto expected = std::vector<uint8_t>{0x27};
-    BOOST_CHECK(result == expected);
-  }
-  {
-    auto result = std::vector<uint8_t>{InstructionNone(AST::InstructionType::SCF).encode()};
-    auto expected = std::vector<uint8_t>{0x37};
-    BOOST_CHECK(result == expected);
-  }
-  {
-    auto result = std::vector<uint8_t>{InstructionNone(AST::InstructionType::RRCA).encode()};
-    auto expected = std::vector<uint8_t>{0x0f};
-    BOOST_CHECK(result == expected);
-  }
-  {
-    auto result = std::vector<uint8_t>{InstructionNone(AST::InstructionType::RRA).encode()};
-    auto expected = std::vector<uint8_t>{0x1f};
-    BOOST_CHECK(result == expected);
-  }
-  {
-    auto result = std::vector<uint8_t>{InstructionNone(AST::InstructionType::CPL).encode()};
-    auto expected = std::vector<uint8_t>{0x2f};
-    BOOST_CHECK(result == expected);
-  }
-  {
-    auto result = std::vector<uint8_t>{InstructionNone(AST::InstructionType::CCF).encode()};
-    auto expected = std::vector<uint8_t>{0x3f};
-    BOOST_CHECK(result == expected);
-  }
-  {
-    auto result = std::vector<uint8_t>{InstructionNone(AST::InstructionType::HALT).encode()};
-    auto expected = std::vector<uint8_t>{0x76};
-    BOOST_CHECK(result == expected);
-  }
-  {
-    auto result = std::vector<uint8_t>{InstructionNone(AST::InstructionType::DI).encode()};
-    auto expected = std::vector<uint8_t>{0xf3};
-    BOOST_CHECK(result == expected);
-  }
-  {
-    auto result = std::vector<uint8_t>{InstructionNone(AST::InstructionType::RET).encode()};
-    auto expected = std::vector<uint8_t>{0xc9};
-    BOOST_CHECK(result == expected);
-  }
-  {
-    auto result = std::vector<uint8_t>{InstructionNone(AST::InstructionType::RETI).encode()};
-    auto expected = std::vector<uint8_t>{0xd9};
-    BOOST_CHECK(result == expected);
-  }
-  {
-    auto result = std::vector<uint8_t>{InstructionNone(AST::InstructionType::EI).encode()};
-    auto expected = std::vector<uint8_t>{0xfb};
-    BOOST_CHECK(result == expected);
-  }
-  {
-    BOOST_CHECK_THROW(InstructionNone(AST::InstructionType::RST).encode(), AssemblerException);
-  }
+  using namespace AST;
+  using namespace GBAS;
+  BOOST_CHECK_EQUAL(findOpcode(InstructionType::NOP, Operand::NONE), 0x00);
+  BOOST_CHECK_EQUAL(findOpcode(InstructionType::STOP, Operand::NONE), 0x10);
+  BOOST_CHECK_EQUAL(findOpcode(InstructionType::RLCA, Operand::NONE), 0x07);
+  BOOST_CHECK_EQUAL(findOpcode(InstructionType::RLA, Operand::NONE), 0x17);
+  BOOST_CHECK_EQUAL(findOpcode(InstructionType::DAA, Operand::NONE), 0x27);
+  BOOST_CHECK_EQUAL(findOpcode(InstructionType::SCF, Operand::NONE), 0x37);
+  BOOST_CHECK_EQUAL(findOpcode(InstructionType::RRCA, Operand::NONE), 0x0f);
+  BOOST_CHECK_EQUAL(findOpcode(InstructionType::RRA, Operand::NONE), 0x1f);
+  BOOST_CHECK_EQUAL(findOpcode(InstructionType::CPL, Operand::NONE), 0x2f);
+  BOOST_CHECK_EQUAL(findOpcode(InstructionType::CCF, Operand::NONE), 0x3f);
+  BOOST_CHECK_EQUAL(findOpcode(InstructionType::HALT, Operand::NONE), 0x76);
+  BOOST_CHECK_EQUAL(findOpcode(InstructionType::DI, Operand::NONE), 0xf3);
+  BOOST_CHECK_EQUAL(findOpcode(InstructionType::RET, Operand::NONE), 0xc9);
+  BOOST_CHECK_EQUAL(findOpcode(InstructionType::RETI, Operand::NONE), 0xd9);
+  BOOST_CHECK_EQUAL(findOpcode(InstructionType::EI, Operand::NONE), 0xfb);
+  // RST always takes a vector
+  BOOST_CHECK_EQUAL(findOpcode(InstructionType::RST, Operand::NONE), NO_OPCODE);
 }
 
 BOOST_AUTO_TEST_CASE(assembler_test_assemble_directive) {
@@ -690,7 +748,7 @@ BOOST_AUTO_TEST_CASE(assembler_test_assemble_directive) {
   {
     ELFWrapper elf{};
     //auto ast = std::make_shared<Root>();
-    //ast->add(std::make_shared<Instruction0>(InstructionType::NOP));
+    //ast->add(ast->arena().make<Instruction0>(InstructionType::NOP));
 
     //Assembler assembler{};
     //BOOST_CHECK_THROW(assembler.assemble(ast, elf), ELFException);
@@ -698,7 +756,7 @@ BOOST_AUTO_TEST_CASE(assembler_test_assemble_directive) {
   {
     ELFWrapper elf{};
     auto ast = std::make_shared<Root>();
-    ast->add(std::make_shared<Directive>(DirectiveType::SECTION, Directive::OperandList{"text"}));
+    ast->add(ast->arena().make<Directive>(DirectiveType::SECTION, Directive::OperandList{"text"}));
 
     Assembler assembler{};
     assembler.assemble(ast, elf);
@@ -706,13 +764,13 @@ BOOST_AUTO_TEST_CASE(assembler_test_assemble_directive) {
   {
     ELFWrapper elf{};
     auto ast = std::make_shared<Root>();
-    ast->add(std::make_shared<Directive>(DirectiveType::SECTION, Directive::OperandList{"text"}));
-    ast->add(std::make_shared<Instruction0>(InstructionType::NOP));
+    ast->add(ast->arena().make<Directive>(DirectiveType::SECTION, Directive::OperandList{"text"}));
+    ast->add(ast->arena().make<Instruction0>(InstructionType::NOP));
 
     Assembler assembler{};
     assembler.assemble(ast, elf);
 
-    auto expected = std::vector<uint8_t>{InstructionNone{InstructionType::NOP}.encode()};
+    auto expected = std::vector<uint8_t>{0x00};
     auto& text = dynamic_cast<ProgramSection&>(elf.get_section("text"));
     BOOST_CHECK(text.data() == expected);
   }
@@ -723,17 +781,439 @@ BOOST_AUTO_TEST_CASE(assembler_test_assemble_label) {
   using namespace GBAS;
   ELFWrapper elf{};
   auto ast = std::make_shared<Root>();
-  ast->add(std::make_shared<Directive>(DirectiveType::SECTION,
+  ast->add(ast->arena().make<Directive>(DirectiveType::SECTION,
         Directive::OperandList{"text"}));
-  ast->add(std::make_shared<Label>("nop"));
-  ast->add(std::make_shared<Instruction0>(InstructionType::NOP));
+  ast->add(ast->arena().make<Label>("nop"));
+  ast->add(ast->arena().make<Instruction0>(InstructionType::NOP));
 
   Assembler assembler{};
   assembler.assemble(ast, elf);
 
-  auto expected = std::vector<uint8_t>{InstructionNone{InstructionType::NOP}.encode()};
+  auto expected = std::vector<uint8_t>{0x00};
   auto& text = dynamic_cast<ProgramSection&>(elf.get_section("text"));
   BOOST_CHECK(text.data() == expected);
 }
 
+BOOST_AUTO_TEST_CASE(assembler_test_assemble_label_values) {
+  using namespace GBAS;
+  SourceBuffer source{
+      ".section text\nstart:\nnop\nld bc, 1\nmid: inc a\n"
+      ".section data\ntable:\n"
+      ".section text\nend:\n"};
+  SourceTokenStream tokens{source};
+  ELFWrapper elf{};
+  Assembler{}.assemble(Parser{tokens}.parse(), elf);
+
+  // Each label is the offset in its own section of the next byte
+  auto& symbols = elf.get_symbol_table().symbols();
+  BOOST_REQUIRE_EQUAL(symbols.size(), 5);
+  auto text = elf.get_section_idx("text");
+  auto data = elf.get_section_idx("data");
+  const std::pair<uint32_t, size_t> expected[] = {
+      {0, text}, {4, text}, {0, data}, {5, text}};
+  for (size_t i = 0; i < 4; i++) {
+    BOOST_TEST_CONTEXT(i) {
+      auto& symbol = symbols[i + 1];
+      BOOST_CHECK_EQUAL(symbol.st_value, expected[i].first);
+      BOOST_CHECK_EQUAL(symbol.st_shndx, expected[i].second);
+      // Labels of code are functions, and any other labels objects
+      BOOST_CHECK_EQUAL(ELF32_ST_TYPE(symbol.st_info),
+                        expected[i].second == text ? STT_FUNC : STT_OBJECT);
+      BOOST_CHECK_EQUAL(ELF32_ST_BIND(symbol.st_info), STB_GLOBAL);
+    }
+  }
+
+  // There is no location outside of a section
+  SourceBuffer outside{"start:\n"};
+  SourceTokenStream outsideTokens{outside};
+  ELFWrapper outsideElf{};
+  BOOST_CHECK_THROW(
+      Assembler{}.assemble(Parser{outsideTokens}.parse(), outsideElf),
+      ELFException);
+}
+
+BOOST_AUTO_TEST_CASE(assembler_test_lower) {
+  using namespace AST;
+  auto ast = std::make_shared<Root>();
+  auto& arena = ast->arena();
+  ast->add(arena.make<Directive>(DirectiveType::SECTION,
+        Directive::OperandList{"text"}));
+  ast->add(arena.make<Label>("main"));
+  ast->add(arena.make<Instruction1>(InstructionType::INC,
+                                    arena.make<Register<'b'>>()));
+  auto sum = arena.make<AddOp>(arena.make<Label>("table"),
+                               arena.make<Number>(2));
+  auto ld = arena.make<Instruction2>(InstructionType::LD,
+                                     arena.make<DRegister<'h', 'l'>>(), sum);
+  ld->setOffset(7);
+  ast->add(ld);
+  ast->add(arena.make<Instruction1>(InstructionType::JP,
+                                    arena.make<Label>("main")));
+
+  auto program = Assembler::lower(ast);
+  BOOST_REQUIRE_EQUAL(program.size(), 5);
+  BOOST_CHECK(program.kinds[0] == IR::LineKind::SECTION);
+  BOOST_CHECK_EQUAL(program.names.at(program.operands[0][0]), "text");
+  BOOST_CHECK(program.kinds[1] == IR::LineKind::LABEL);
+  BOOST_CHECK_EQUAL(program.names.at(program.operands[0][1]), "main");
+
+  BOOST_CHECK(program.kinds[2] == IR::LineKind::INSTRUCTION);
+  BOOST_CHECK(program.types[2] == InstructionType::INC);
+  BOOST_CHECK_EQUAL(program.nOperands(2), 1);
+  BOOST_CHECK(program.operandKinds[0][2] == IR::OperandKind::REGISTER);
+  BOOST_CHECK_EQUAL(program.operands[0][2], 'b');
+
+  BOOST_CHECK(program.types[3] == InstructionType::LD);
+  BOOST_CHECK_EQUAL(program.nOperands(3), 2);
+  BOOST_CHECK(program.operandKinds[0][3] == IR::OperandKind::DREGISTER);
+  BOOST_CHECK_EQUAL(program.operands[0][3], 'h' << 8 | 'l');
+  BOOST_CHECK(program.operandKinds[1][3] == IR::OperandKind::EXPRESSION);
+  auto& dag = program.expressions;
+  auto expr = program.operands[1][3];
+  BOOST_CHECK(dag.op(expr) == IR::Op::ADD);
+  BOOST_CHECK(dag.op(dag.left(expr)) == IR::Op::LABEL);
+  BOOST_CHECK_EQUAL(program.names.at(dag.left(dag.left(expr))), "table");
+  BOOST_CHECK(dag.op(dag.right(expr)) == IR::Op::NUMBER);
+  BOOST_CHECK_EQUAL(dag.left(dag.right(expr)), 2);
+  BOOST_CHECK_EQUAL(program.offsets[3], 7);
+
+  BOOST_CHECK(program.operandKinds[0][4] == IR::OperandKind::LABEL);
+  BOOST_CHECK_EQUAL(program.names.at(program.operands[0][4]), "main");
+}
+
+BOOST_AUTO_TEST_CASE(assembler_test_evaluateExpression) {
+  SourceBuffer source{
+      "ld a, 1 + 2 * 3\n"
+      "ld hl, table + 2 * (4 - 1) << 1\n"
+      "ld b, (2 > 1) & 7\n"
+      "ld a, x / (3 - 3)\n"};
+  SourceTokenStream tokens{source};
+  auto program = Assembler::lower(Parser{tokens}.parse());
+  auto expression = [&](size_t i) { return program.operands[1].at(i); };
+
+  // Constants are folded as they are lowered
+  BOOST_CHECK(program.expressions.op(expression(0)) == IR::Op::NUMBER);
+  BOOST_CHECK_EQUAL(*Assembler::evaluateExpression(program, expression(0)),
+                    7);
+  // Labels are resolved by the caller
+  BOOST_CHECK(!Assembler::evaluateExpression(program, expression(1)));
+  auto resolve = [&](uint32_t name) -> std::optional<int32_t> {
+    if (program.names.at(name) == "table") {
+      return 0x100;
+    }
+    return std::nullopt;
+  };
+  BOOST_CHECK_EQUAL(
+      *Assembler::evaluateExpression(program, expression(1), resolve), 0x10c);
+  BOOST_CHECK_EQUAL(*Assembler::evaluateExpression(program, expression(2)),
+                    7);
+  BOOST_CHECK_THROW(
+      Assembler::evaluateExpression(program, expression(3),
+                                    [](uint32_t) { return 1; }),
+      AssemblerException);
+
+  // Dividing constants by zero is found when lowering
+  SourceBuffer divide{"nop\nld a, 7 / (3 - 3)\n"};
+  SourceTokenStream divideTokens{divide};
+  try {
+    Assembler::lower(Parser{divideTokens}.parse());
+    BOOST_FAIL("Expected an AssemblerException");
+  } catch (AssemblerException& e) {
+    BOOST_CHECK_EQUAL(e.offset(), 4);
+  }
+}
+
+BOOST_AUTO_TEST_CASE(assembler_test_expression_dag) {
+  SourceBuffer source{
+      "ld hl, table + 2 * 3\n"
+      "ld hl, table + 6\n"
+      "ld de, (end - start) * 2\n"
+      "ld bc, end - start\n"
+      "ld hl, table + 2 * 3\n"};
+  SourceTokenStream tokens{source};
+  auto program = Assembler::lower(Parser{tokens}.parse());
+  auto expression = [&](size_t i) { return program.operands[1].at(i); };
+
+  // Equal expressions, and equal subexpressions, are the same node
+  BOOST_CHECK_EQUAL(expression(0), expression(1));
+  BOOST_CHECK_EQUAL(expression(0), expression(4));
+  BOOST_CHECK_EQUAL(program.expressions.left(expression(2)), expression(3));
+  // table, 6, table + 6, end, start, end - start, 2, (end - start) * 2
+  BOOST_CHECK_EQUAL(program.expressions.size(), 8);
+  BOOST_CHECK_EQUAL(program.names.size(), 3);
+
+  // Each node is evaluated once, when the labels it needs are known
+  int resolved = 0;
+  std::map<std::string, int32_t> symbols{{"table", 0x100}, {"end", 0x40}};
+  ExpressionEvaluator evaluator{program, [&](uint32_t name) {
+                                  resolved++;
+                                  auto it = symbols.find(program.names[name]);
+                                  return it == symbols.end()
+                                             ? std::nullopt
+                                             : std::optional{it->second};
+                                }};
+  BOOST_CHECK_EQUAL(*evaluator.value(expression(0)), 0x106);
+  BOOST_CHECK_EQUAL(*evaluator.value(expression(4)), 0x106);
+  BOOST_CHECK_EQUAL(resolved, 1);
+  BOOST_CHECK(!evaluator.value(expression(2)));
+  symbols["start"] = 0x10;
+  BOOST_CHECK_EQUAL(*evaluator.value(expression(2)), 0x60);
+  BOOST_CHECK_EQUAL(*evaluator.value(expression(3)), 0x30);
+  // end was kept, start was not
+  BOOST_CHECK_EQUAL(resolved, 4);
+}
+
+BOOST_AUTO_TEST_CASE(assembler_test_assemble_location) {
+  using namespace AST;
+  using namespace GBAS;
+  ELFWrapper elf{};
+  auto ast = std::make_shared<Root>();
+  ast->add(ast->arena().make<Directive>(DirectiveType::SECTION,
+        Directive::OperandList{"text"}));
+  auto ld = ast->arena().make<Instruction0>(InstructionType::LD);
+  ld->setOffset(42);
+  ast->add(ld);
+
+  Assembler assembler{};
+  try {
+    assembler.assemble(ast, elf);
+    BOOST_FAIL("Expected an AssemblerException");
+  } catch (AssemblerException& e) {
+    BOOST_CHECK_EQUAL(e.offset(), 42);
+  }
+}
+
+BOOST_AUTO_TEST_CASE(assembler_test_parse_into) {
+  using namespace GBAS;
+  SourceBuffer source{
+      ".section text\nnop\ninc a\n  dec bc\nld a, 2 * 3\npush hl\ncp b\n"
+      "ret z\nld (hl+), a\n"};
+
+  SourceTokenStream treeTokens{source};
+  auto ast = Parser{treeTokens}.parse();
+  ELFWrapper treeElf{};
+  Assembler{}.assemble(ast, treeElf);
+
+  SourceTokenStream tokens{source};
+  ELFWrapper elf{};
+  Assembler assembler{};
+  auto root = Parser{tokens}.parseInto(assembler, elf);
+
+  // Only the directive, the expression and the indirect operand needed nodes
+  BOOST_CHECK_EQUAL(root->size(), 3);
+  auto& expected = dynamic_cast<ProgramSection&>(treeElf.get_section("text"));
+  auto& text = dynamic_cast<ProgramSection&>(elf.get_section("text"));
+  BOOST_CHECK(text.data() == expected.data());
+  BOOST_CHECK_EQUAL(text.data().size(), 9);
+
+  // Errors are reported where they are in the source
+  SourceBuffer bad{".section text\nnop\ninc a, b\n"};
+  SourceTokenStream badTokens{bad};
+  try {
+    Parser{badTokens}.parseInto(assembler, elf);
+    BOOST_FAIL("Expected a ParserException");
+  } catch (ParserException& e) {
+    BOOST_CHECK_EQUAL(e.offset(), 18);
+  }
+
+  // Recovering skips the invalid line and assembles the rest
+  SourceBuffer recover{".section text\nnop\ninc a, b\ninc a\n"};
+  SourceTokenStream recoverTokens{recover};
+  DiagnosticList diagnostics{};
+  ELFWrapper recoverElf{};
+  Parser recoverParser{recoverTokens};
+  recoverParser.setDiagnostics(&diagnostics);
+  recoverParser.parseInto(assembler, recoverElf);
+  BOOST_REQUIRE_EQUAL(diagnostics.size(), 1);
+  BOOST_CHECK_EQUAL(diagnostics[0].offset, 18);
+  auto& recovered =
+      dynamic_cast<ProgramSection&>(recoverElf.get_section("text"));
+  BOOST_CHECK_EQUAL(recovered.data().size(), 2);
+}
+
+BOOST_AUTO_TEST_CASE(assembler_test_assemble_immediates) {
+  using namespace GBAS;
+  auto assemble = [](const std::string& text) {
+    SourceBuffer source{".section text\n" + text};
+    SourceTokenStream tokens{source};
+    ELFWrapper elf{};
+    Assembler{}.assemble(Parser{tokens}.parse(), elf);
+    return dynamic_cast<ProgramSection&>(elf.get_section("text")).data();
+  };
+
+  // 16-bit immediates are little-endian
+  BOOST_CHECK(assemble("jp $1234\n") ==
+              (std::vector<uint8_t>{0xc3, 0x34, 0x12}));
+  BOOST_CHECK(assemble("call $c000 + $150 * 2\n") ==
+              (std::vector<uint8_t>{0xcd, 0xa0, 0xc2}));
+  BOOST_CHECK(assemble("jp -1\n") ==
+              (std::vector<uint8_t>{0xc3, 0xff, 0xff}));
+  BOOST_CHECK(assemble("jr 2\njr -2\n") ==
+              (std::vector<uint8_t>{0x18, 0x02, 0x18, 0xfe}));
+  // Intermediate values may be wider than the field
+  BOOST_CHECK(assemble("jr ($1000 + 8) >> 8\n") ==
+              (std::vector<uint8_t>{0x18, 0x10}));
+
+  // Values are checked when they are encoded
+  BOOST_CHECK_THROW(assemble("jp $10000\n"), AssemblerException);
+  BOOST_CHECK_THROW(assemble("jp -32769\n"), AssemblerException);
+  BOOST_CHECK_THROW(assemble("jr 256\n"), AssemblerException);
+  try {
+    assemble("nop\njr -129\n");
+    BOOST_FAIL("Expected an AssemblerException");
+  } catch (AssemblerException& e) {
+    BOOST_CHECK_EQUAL(e.offset(), 18);
+  }
+}
+
+BOOST_AUTO_TEST_CASE(assembler_test_assemble_opcodes) {
+  using namespace GBAS;
+  auto assemble = [](const std::string& text) {
+    SourceBuffer source{".section text\n" + text};
+    SourceTokenStream tokens{source};
+    ELFWrapper elf{};
+    Assembler{}.assemble(Parser{tokens}.parse(), elf);
+    return dynamic_cast<ProgramSection&>(elf.get_section("text")).data();
+  };
+
+  BOOST_CHECK(assemble("cp 5\n") == (std::vector<uint8_t>{0xfe, 0x05}));
+  BOOST_CHECK(assemble("ld b, c\n") == (std::vector<uint8_t>{0x41}));
+  // The accumulator may be named or left out
+  BOOST_CHECK(assemble("sub a, 3\nsub 3\n") ==
+              (std::vector<uint8_t>{0xd6, 0x03, 0xd6, 0x03}));
+  BOOST_CHECK(assemble("ld bc, $1234\n") ==
+              (std::vector<uint8_t>{0x01, 0x34, 0x12}));
+  BOOST_CHECK(assemble("jp hl\n") == (std::vector<uint8_t>{0xe9}));
+  // Bit indices and restart vectors are part of the opcode
+  BOOST_CHECK(assemble("bit 7, h\nres 0, a\n") ==
+              (std::vector<uint8_t>{0xcb, 0x7c, 0xcb, 0x87}));
+  BOOST_CHECK(assemble("rst $38\n") == (std::vector<uint8_t>{0xff}));
+
+  BOOST_CHECK_THROW(assemble("bit 8, h\n"), AssemblerException);
+  BOOST_CHECK_THROW(assemble("rst $39\n"), AssemblerException);
+  BOOST_CHECK_THROW(assemble("ld sp, b\n"), AssemblerException);
+
+  // Encoding a line alone gives its bytes inline
+  IR::Program program{};
+  auto i = program.add(IR::LineKind::INSTRUCTION, AST::InstructionType::LD,
+                       SourceBuffer::NO_OFFSET);
+  program.operandKinds[0][i] = IR::OperandKind::DREGISTER;
+  program.operands[0][i] = 'h' << 8 | 'l';
+  program.operandKinds[1][i] = IR::OperandKind::NUMBER;
+  program.operands[1][i] = 0xc000;
+  auto encoded = Assembler::encodeInstruction(program, i);
+  BOOST_CHECK(std::vector<uint8_t>(encoded.data(),
+                                   encoded.data() + encoded.size()) ==
+              (std::vector<uint8_t>{0x21, 0x00, 0xc0}));
+}
+
+BOOST_AUTO_TEST_CASE(assembler_test_assemble_memory) {
+  using namespace GBAS;
+  auto assemble = [](const std::string& text) {
+    SourceBuffer source{".section text\n" + text};
+    SourceTokenStream tokens{source};
+    ELFWrapper elf{};
+    Assembler{}.assemble(Parser{tokens}.parse(), elf);
+    return dynamic_cast<ProgramSection&>(elf.get_section("text")).data();
+  };
+  using Bytes = std::vector<uint8_t>;
+
+  // Registers in parentheses
+  BOOST_CHECK(assemble("ld a, (hl)\nld (hl), b\nld (bc), a\nld a, (de)\n") ==
+              (Bytes{0x7e, 0x70, 0x02, 0x1a}));
+  BOOST_CHECK(assemble("ld a, (hl+)\nld (hl-), a\n") == (Bytes{0x2a, 0x32}));
+  BOOST_CHECK(assemble("ldi (hl), a\nldd a, (hl)\n") == (Bytes{0x22, 0x3a}));
+  BOOST_CHECK(assemble("ldh (c), a\nld a, (c)\n") == (Bytes{0xe2, 0xf2}));
+  BOOST_CHECK(assemble("inc (hl)\nadd a, (hl)\nbit 3, (hl)\n") ==
+              (Bytes{0x34, 0x86, 0xcb, 0x5e}));
+  BOOST_CHECK(assemble("ld (hl), 7\njp (hl)\n") ==
+              (Bytes{0x36, 0x07, 0xe9}));
+
+  // Addresses in parentheses
+  BOOST_CHECK(assemble("ld ($c000), sp\n") == (Bytes{0x08, 0x00, 0xc0}));
+  BOOST_CHECK(assemble("ld a, ($c000 + 1)\nld ($ff80), a\n") ==
+              (Bytes{0xfa, 0x01, 0xc0, 0xea, 0x80, 0xff}));
+  BOOST_CHECK(assemble("ldh ($ff80), a\nldh a, ($44)\n") ==
+              (Bytes{0xe0, 0x80, 0xf0, 0x44}));
+  // Parentheses which only group an expression make an immediate
+  BOOST_CHECK(assemble("ld a, (1 + 2) * 3\n") == (Bytes{0x3e, 0x09}));
+
+  // Conditions, including c
+  BOOST_CHECK(assemble("jr nz, 4\njp z, $150\ncall c, $4000\nret nc\n") ==
+              (Bytes{0x20, 0x04, 0xca, 0x50, 0x01, 0xdc, 0x00, 0x40, 0xd0}));
+  BOOST_CHECK(assemble("ret\nreti\n") == (Bytes{0xc9, 0xd9}));
+
+  // The stack pointer
+  BOOST_CHECK(assemble("ld hl, sp + 4\nld hl, sp - 2\nadd sp, -8\n") ==
+              (Bytes{0xf8, 0x04, 0xf8, 0xfe, 0xe8, 0xf8}));
+  BOOST_CHECK(assemble("ld sp, hl\nadd hl, sp\n") == (Bytes{0xf9, 0x39}));
+
+  BOOST_CHECK_THROW(assemble("ld (hl), (hl)\n"), AssemblerException);
+  BOOST_CHECK_THROW(assemble("ld b, (de)\n"), AssemblerException);
+  BOOST_CHECK_THROW(assemble("ld (a), b\n"), AssemblerException);
+  BOOST_CHECK_THROW(assemble("ld a, (bc+)\n"), AssemblerException);
+  BOOST_CHECK_THROW(assemble("ldh ($1234), a\n"), AssemblerException);
+  BOOST_CHECK_THROW(assemble("jr nz, sp + 1\n"), AssemblerException);
+}
+
+BOOST_AUTO_TEST_CASE(assembler_test_assemble_fixups) {
+  using namespace GBAS;
+  auto assemble = [](const std::string& text, bool stream = false) {
+    SourceBuffer source{".section text\n" + text};
+    SourceTokenStream tokens{source};
+    ELFWrapper elf{};
+    if (stream) {
+      Assembler assembler{};
+      Parser{tokens}.parseInto(assembler, elf);
+    } else {
+      Assembler{}.assemble(Parser{tokens}.parse(), elf);
+    }
+    return dynamic_cast<ProgramSection&>(elf.get_section("text")).data();
+  };
+  using Bytes = std::vector<uint8_t>;
+
+  // Labels may be used before and after they are defined, alone or in
+  // expressions, and relative jumps are from the end of the instruction
+  std::string text{
+      "start: jp end\n"
+      "ld hl, table + 2\n"
+      "end: jr start\n"
+      "jr end\n"
+      "ld a, (end - start)\n"
+      "call nz, start\n"
+      ".section data\n"
+      "nop\n"
+      "table:\n"};
+  Bytes expected{0xc3, 0x06, 0x00, 0x21, 0x03, 0x00, 0x18, 0xf8, 0x18,
+                 0xfc, 0xfa, 0x06, 0x00, 0xc4, 0x00, 0x00};
+  BOOST_CHECK(assemble(text) == expected);
+  BOOST_CHECK(assemble(text, true) == expected);
+
+  // Jumps only reach as far as 8 bits do
+  std::string nops{};
+  for (int i = 0; i < 126; i++) {
+    nops += "nop\n";
+  }
+  BOOST_CHECK_NO_THROW(assemble("back: " + nops + "jr back\n"));
+  BOOST_CHECK_THROW(assemble("back: nop\n" + nops + "jr back\n"),
+                    AssemblerException);
+  BOOST_CHECK_NO_THROW(assemble("jr next\nnop\n" + nops + "next:\n"));
+  BOOST_CHECK_THROW(assemble("jr next\nnop\nnop\n" + nops + "next:\n"),
+                    AssemblerException);
+
+  // Errors are reported at the line of the operand
+  try {
+    assemble("nop\njp nowhere\n");
+    BOOST_FAIL("Expected an AssemblerException");
+  } catch (AssemblerException& e) {
+    BOOST_CHECK_EQUAL(e.offset(), 18);
+    BOOST_CHECK_EQUAL(std::string{e.what()}, "Undefined label nowhere");
+  }
+  BOOST_CHECK_THROW(assemble("ld hl, nowhere + 1\n", true),
+                    AssemblerException);
+  BOOST_CHECK_THROW(assemble("jr away\n.section data\naway:\n"),
+                    AssemblerException);
+  BOOST_CHECK_THROW(assemble("bit here, a\nhere:\n"), AssemblerException);
+}
+
 BOOST_AUTO_TEST_SUITE_END();
@@ -19,6 +19,19 @@ BOOST_AUTO_TEST_CASE(char_utils_test_isNumber) {
   BOOST_CHECK_EQUAL(isNumber("42a"), false);
 }
 
+BOOST_AUTO_TEST_CASE(char_utils_test_isHexDigit) {
+  BOOST_CHECK_EQUAL(isHexDigit('0'), true);
+  BOOST_CHECK_EQUAL(isHexDigit('9'), true);
+  BOOST_CHECK_EQUAL(isHexDigit('a'), true);
+  BOOST_CHECK_EQUAL(isHexDigit('F'), true);
+  BOOST_CHECK_EQUAL(isHexDigit('g'), false);
+  BOOST_CHECK_EQUAL(isHexDigit('G'), false);
+  BOOST_CHECK_EQUAL(isHexDigit('$'), false);
+  BOOST_CHECK_EQUAL(digitValue('7'), 7);
+  BOOST_CHECK_EQUAL(digitValue('a'), 10);
+  BOOST_CHECK_EQUAL(digitValue('F'), 15);
+}
+
 BOOST_AUTO_TEST_CASE(char_utils_test_isNumericOp) {
   // We can assume that there are no trailing or leading spaces
   BOOST_CHECK_EQUAL(isNumericOp(' '), false);
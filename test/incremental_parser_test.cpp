@@ -0,0 +1,194 @@
+
+#define BOOST_TEST_DYN_LINK
+#include <boost/test/unit_test.hpp>
+
+#include <string>
+
+#include "incremental_parser.hpp"
+
+BOOST_AUTO_TEST_SUITE(incremental_parser_test);
+
+namespace {
+
+/**
+ * Text representation of a node and everything below it, including offsets.
+ */
+std::string describe(AST::BaseNode& node) {
+  using namespace AST;
+  std::string desc = "@" + std::to_string(node.offset()) + " ";
+  switch (node.id()) {
+    case NodeType::INSTRUCTION: {
+      auto& instr = dynamic_cast<BaseInstruction&>(node);
+      desc += "instr" + std::to_string(static_cast<int>(instr.type()));
+      if (instr.nOperands() == 1) {
+        desc += "(" + describe(*dynamic_cast<Instruction1&>(node).operand()) +
+                ")";
+      } else if (instr.nOperands() == 2) {
+        auto& instr2 = dynamic_cast<Instruction2&>(node);
+        desc += "(" + describe(*instr2.left()) + ", " +
+                describe(*instr2.right()) + ")";
+      }
+      break;
+    }
+    case NodeType::REGISTER:
+      desc += dynamic_cast<BaseRegister&>(node).reg();
+      break;
+    case NodeType::DREGISTER:
+      desc += dynamic_cast<BaseDRegister&>(node).reg();
+      break;
+    case NodeType::LABEL:
+      desc += dynamic_cast<Label&>(node).name();
+      break;
+    case NodeType::DIRECTIVE:
+      for (auto& operand : dynamic_cast<Directive&>(node).operands()) {
+        desc += "dir " + operand;
+      }
+      break;
+    case NodeType::NUMBER:
+      desc += std::to_string(dynamic_cast<Number&>(node).value());
+      break;
+    case NodeType::BINARY_OP: {
+      auto& op = dynamic_cast<BaseBinaryOp&>(node);
+      desc += "op" + std::to_string(static_cast<int>(op.opType())) + "(" +
+              describe(*op.left()) + ", " + describe(*op.right()) + ")";
+      break;
+    }
+    case NodeType::UNARY_OP:
+      desc += "neg(" + describe(*dynamic_cast<BaseUnaryOp&>(node).operand()) +
+              ")";
+      break;
+    default:
+      desc += "?";
+  }
+  return desc;
+}
+
+std::string describe(AST::Root& root) {
+  std::string desc{};
+  for (auto& child : root) {
+    desc += describe(*child) + "\n";
+  }
+  return desc;
+}
+
+/**
+ * Check that the state of parser is what parsing its text from scratch gives.
+ */
+void checkSameAsFull(const IncrementalParser& parser) {
+  SourceBuffer source{parser.text()};
+  auto expectedTokens = Tokenizer{}.tokenize(source);
+  auto tokens = parser.tokens();
+  BOOST_REQUIRE_EQUAL(tokens.size(), expectedTokens.size());
+  for (size_t i = 0; i < tokens.size(); i++) {
+    BOOST_CHECK(tokens[i].kind == expectedTokens[i].kind);
+    BOOST_CHECK_EQUAL(tokens[i].offset, expectedTokens[i].offset);
+    BOOST_CHECK_EQUAL(tokens[i].length, expectedTokens[i].length);
+    BOOST_CHECK_EQUAL(tokens[i].value, expectedTokens[i].value);
+  }
+
+  SourceTokenStream stream{source};
+  auto expectedRoot = Parser{stream}.parse();
+  BOOST_CHECK_EQUAL(describe(*parser.root()), describe(*expectedRoot));
+}
+
+}  // namespace
+
+BOOST_AUTO_TEST_CASE(incremental_parser_test_parse) {
+  IncrementalParser parser{"nop\n  ld a, b\n\n.section \"text\"\n"};
+  BOOST_CHECK_EQUAL(parser.lines(), 5);
+  BOOST_CHECK_EQUAL(parser.root()->size(), 3);
+  checkSameAsFull(parser);
+
+  IncrementalParser empty{""};
+  BOOST_CHECK_EQUAL(empty.root()->size(), 0);
+  checkSameAsFull(empty);
+}
+
+BOOST_AUTO_TEST_CASE(incremental_parser_test_edits) {
+  IncrementalParser parser{"nop\n  ld a, b\ninc a\n"};
+  auto root = parser.root();
+  auto nop = root->begin()[0];
+  auto inc = root->begin()[2];
+
+  // Within a line
+  parser.apply(Edit{12, 1, "c"});
+  BOOST_CHECK_EQUAL(parser.text(), "nop\n  ld a, c\ninc a\n");
+  checkSameAsFull(parser);
+  // The lines around the edit keep their nodes
+  BOOST_CHECK(parser.root() == root);
+  BOOST_CHECK(root->begin()[0] == nop);
+  BOOST_CHECK(root->begin()[2] == inc);
+
+  // Adding lines moves the ones after them
+  parser.apply(Edit{4, 0, "add a, 2 * 3\n\n"});
+  BOOST_CHECK_EQUAL(parser.text(), "nop\nadd a, 2 * 3\n\n  ld a, c\ninc a\n");
+  checkSameAsFull(parser);
+  BOOST_CHECK(root->begin()[3] == inc);
+  BOOST_CHECK_EQUAL(inc->offset(), 28);
+
+  // Removing a newline joins two lines
+  parser.apply(Edit{0, 4, ""});
+  checkSameAsFull(parser);
+  parser.apply(Edit{12, 1, ""});
+  BOOST_CHECK_EQUAL(parser.text(), "add a, 2 * 3\n  ld a, c\ninc a\n");
+  checkSameAsFull(parser);
+
+  // Replacing several lines at once
+  parser.apply(Edit{7, 15, "-1\n  dec bc"});
+  BOOST_CHECK_EQUAL(parser.text(), "add a, -1\n  dec bc\ninc a\n");
+  checkSameAsFull(parser);
+
+  // At the very end, with and without a final newline
+  parser.apply(Edit{static_cast<uint32_t>(parser.text().size()), 0, "nop"});
+  checkSameAsFull(parser);
+  parser.apply(Edit{static_cast<uint32_t>(parser.text().size()), 0, "\n"});
+  checkSameAsFull(parser);
+
+  // Everything
+  parser.apply(Edit{0, static_cast<uint32_t>(parser.text().size()), ""});
+  BOOST_CHECK_EQUAL(parser.root()->size(), 0);
+  checkSameAsFull(parser);
+  parser.apply(Edit{0, 0, "inc hl\n"});
+  checkSameAsFull(parser);
+}
+
+BOOST_AUTO_TEST_CASE(incremental_parser_test_compact) {
+  IncrementalParser parser{"nop\nld a, 1\ninc a\n"};
+  auto root = parser.root();
+  // Replaced nodes pile up in the arena until it is compacted
+  for (int i = 0; i < 2000; i++) {
+    parser.apply(Edit{10, 1, std::to_string(i % 10)});
+  }
+  BOOST_CHECK_EQUAL(parser.text(), "nop\nld a, 9\ninc a\n");
+  BOOST_CHECK(parser.root() == root);
+  BOOST_CHECK_LT(root->arena().size(), 2000);
+  checkSameAsFull(parser);
+}
+
+BOOST_AUTO_TEST_CASE(incremental_parser_test_errors) {
+  IncrementalParser parser{"nop\nld a, b\ninc a\n"};
+  auto before = describe(*parser.root());
+
+  // Errors refer to the edited text, which is not kept
+  try {
+    parser.apply(Edit{10, 0, ", )"});
+    BOOST_FAIL("Expected a ParserException");
+  } catch (ParserException& e) {
+    BOOST_CHECK_EQUAL(e.offset(), 12);
+  }
+  try {
+    parser.apply(Edit{11, 0, "\n#"});
+    BOOST_FAIL("Expected a TokenizerException");
+  } catch (TokenizerException& e) {
+    BOOST_CHECK_EQUAL(e.line(), 2);
+    BOOST_CHECK_EQUAL(e.column(), 0);
+  }
+  BOOST_CHECK_EQUAL(parser.text(), "nop\nld a, b\ninc a\n");
+  BOOST_CHECK_EQUAL(describe(*parser.root()), before);
+  checkSameAsFull(parser);
+
+  BOOST_CHECK_THROW(parser.apply(Edit{17, 2, ""}), ParserException);
+  BOOST_CHECK_THROW(parser.apply(Edit{19, 0, "nop"}), ParserException);
+}
+
+BOOST_AUTO_TEST_SUITE_END();
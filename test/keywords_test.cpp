@@ -0,0 +1,69 @@
+
+#define BOOST_TEST_DYN_LINK
+#include <boost/test/unit_test.hpp>
+
+#include "keywords.hpp"
+#include "tokenizer.hpp"
+
+BOOST_AUTO_TEST_SUITE(keywords_test);
+
+using namespace GBAS;
+
+BOOST_AUTO_TEST_CASE(keywords_test_findKeyword) {
+  for (size_t i = 0; i < instructions.size(); i++) {
+    auto keyword = findKeyword(instructions[i].lexeme);
+    BOOST_CHECK(keyword.kind == KeywordKind::INSTRUCTION);
+    BOOST_CHECK_EQUAL(keyword.index, i);
+  }
+  for (size_t i = 0; i < directives.size(); i++) {
+    auto keyword = findKeyword(directives[i].lexeme);
+    BOOST_CHECK(keyword.kind == KeywordKind::DIRECTIVE);
+    BOOST_CHECK_EQUAL(keyword.index, i);
+  }
+  for (size_t i = 0; i < registers.size(); i++) {
+    auto keyword = findKeyword(registers[i]);
+    BOOST_CHECK(keyword.kind == KeywordKind::REGISTER);
+    BOOST_CHECK_EQUAL(keyword.index, i);
+  }
+  for (size_t i = 0; i < doubleRegisters.size(); i++) {
+    auto keyword = findKeyword(doubleRegisters[i]);
+    BOOST_CHECK(keyword.kind == KeywordKind::DREGISTER);
+    BOOST_CHECK_EQUAL(keyword.index, i);
+  }
+  for (size_t i = 0; i < conditions.size(); i++) {
+    auto keyword = findKeyword(conditions[i]);
+    BOOST_CHECK(keyword.kind == KeywordKind::CONDITION);
+    BOOST_CHECK_EQUAL(keyword.index, i);
+  }
+
+  // Near misses
+  for (auto tok : {"", "ad", "addd", "ADD", "Add", "aDd", "rlcb", "r", "hll",
+                   ".sect", ".sectiom", "section", "x", "label", "1", ","}) {
+    BOOST_TEST_CONTEXT(tok) {
+      BOOST_CHECK(findKeyword(tok).kind == KeywordKind::NONE);
+    }
+  }
+}
+
+BOOST_AUTO_TEST_CASE(keywords_test_classify) {
+  auto tok = Tokenizer::classify("swap", 0);
+  BOOST_CHECK(tok.kind == TokenKind::IDENTIFIER);
+  BOOST_CHECK(tok.keyword.kind == KeywordKind::INSTRUCTION);
+  BOOST_CHECK(instructions[tok.keyword.index].type ==
+              AST::InstructionType::SWAP);
+
+  tok = Tokenizer::classify("sp", 0);
+  BOOST_CHECK(tok.keyword.kind == KeywordKind::DREGISTER);
+  BOOST_CHECK_EQUAL(doubleRegisters[tok.keyword.index], "sp");
+
+  tok = Tokenizer::classify("swap_table", 0);
+  BOOST_CHECK(tok.kind == TokenKind::IDENTIFIER);
+  BOOST_CHECK(tok.keyword.kind == KeywordKind::NONE);
+
+  // Only identifiers are keywords
+  tok = Tokenizer::classify("\"add\"", 0);
+  BOOST_CHECK(tok.kind == TokenKind::STRING);
+  BOOST_CHECK(tok.keyword.kind == KeywordKind::NONE);
+}
+
+BOOST_AUTO_TEST_SUITE_END();
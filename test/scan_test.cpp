@@ -0,0 +1,121 @@
+
+#define BOOST_TEST_DYN_LINK
+#include <boost/test/unit_test.hpp>
+
+#include <string>
+#include <vector>
+
+#include "scan.hpp"
+
+BOOST_AUTO_TEST_SUITE(scan_test);
+
+namespace {
+
+std::vector<Scan::Isa> supportedIsas() {
+  std::vector<Scan::Isa> isas{Scan::Isa::SCALAR};
+  auto best = Scan::detect();
+  if (best == Scan::Isa::SSE2 || best == Scan::Isa::AVX2) {
+    isas.push_back(Scan::Isa::SSE2);
+  }
+  if (best == Scan::Isa::AVX2) {
+    isas.push_back(Scan::Isa::AVX2);
+  }
+  return isas;
+}
+
+/**
+ * Selects an instruction set for the lifetime of the object.
+ */
+struct ScopedIsa {
+  ScopedIsa(Scan::Isa isa) : mPrevious{Scan::selected()} { Scan::select(isa); }
+
+  ~ScopedIsa() { Scan::select(mPrevious); }
+
+  Scan::Isa mPrevious;
+};
+
+}  // namespace
+
+BOOST_AUTO_TEST_CASE(scan_test_findNewline) {
+  for (auto isa : supportedIsas()) {
+    ScopedIsa scoped{isa};
+    BOOST_TEST_CONTEXT("isa " << Scan::name(isa)) {
+      std::string empty{};
+      BOOST_CHECK_EQUAL(Scan::findNewline(empty.data(), 0, 0), 0);
+      std::string text{"add a, 32\nld b, c"};
+      BOOST_CHECK_EQUAL(Scan::findNewline(text.data(), 0, text.size()), 9);
+      BOOST_CHECK_EQUAL(Scan::findNewline(text.data(), 10, text.size()),
+                        text.size());
+      // Each position on either side of a vector boundary
+      for (size_t i = 0; i < 70; i++) {
+        std::string line(80, 'x');
+        line[i] = '\n';
+        BOOST_CHECK_EQUAL(Scan::findNewline(line.data(), 0, line.size()), i);
+        // Nothing past size is considered
+        BOOST_CHECK_EQUAL(Scan::findNewline(line.data(), 0, i), i);
+      }
+    }
+  }
+}
+
+BOOST_AUTO_TEST_CASE(scan_test_skipSpaces) {
+  for (auto isa : supportedIsas()) {
+    ScopedIsa scoped{isa};
+    BOOST_TEST_CONTEXT("isa " << Scan::name(isa)) {
+      std::string text{"    ld"};
+      BOOST_CHECK_EQUAL(Scan::skipSpaces(text.data(), 0, text.size()), 4);
+      BOOST_CHECK_EQUAL(Scan::skipSpaces(text.data(), 4, text.size()), 4);
+      // Tabs are not whitespace to the tokenizer
+      std::string tab{"  \t"};
+      BOOST_CHECK_EQUAL(Scan::skipSpaces(tab.data(), 0, tab.size()), 2);
+      for (size_t i = 0; i < 70; i++) {
+        std::string line(i, ' ');
+        BOOST_CHECK_EQUAL(Scan::skipSpaces(line.data(), 0, line.size()), i);
+        line += ";";
+        line.append(40, ' ');
+        BOOST_CHECK_EQUAL(Scan::skipSpaces(line.data(), 0, line.size()), i);
+      }
+    }
+  }
+}
+
+BOOST_AUTO_TEST_CASE(scan_test_identifierEnd) {
+  for (auto isa : supportedIsas()) {
+    ScopedIsa scoped{isa};
+    BOOST_TEST_CONTEXT("isa " << Scan::name(isa)) {
+      std::string text{".section_1\\AZaz09,"};
+      BOOST_CHECK_EQUAL(Scan::identifierEnd(text.data(), 0, text.size()),
+                        text.size() - 1);
+      // Every character outside the identifier class ends the run, including
+      // those either side of the letter and digit ranges and non-ASCII bytes.
+      std::string stops{" ,;:()+-*/\"@[`{/:\t\x80\xff"};
+      for (auto stop : stops) {
+        for (size_t i = 0; i < 70; i += 7) {
+          std::string line(80, 'a');
+          line[i] = stop;
+          BOOST_CHECK_EQUAL(Scan::identifierEnd(line.data(), 0, line.size()),
+                            i);
+        }
+      }
+      std::string digits(100, '7');
+      BOOST_CHECK_EQUAL(Scan::identifierEnd(digits.data(), 3, digits.size()),
+                        digits.size());
+    }
+  }
+}
+
+BOOST_AUTO_TEST_CASE(scan_test_stringEnd) {
+  for (auto isa : supportedIsas()) {
+    ScopedIsa scoped{isa};
+    BOOST_TEST_CONTEXT("isa " << Scan::name(isa)) {
+      std::string text{"\"hello, world; (x)\" "};
+      BOOST_CHECK_EQUAL(Scan::stringEnd(text.data(), 1, text.size()), 18);
+      std::string unterminated(50, 'x');
+      BOOST_CHECK_EQUAL(
+          Scan::stringEnd(unterminated.data(), 0, unterminated.size()),
+          unterminated.size());
+    }
+  }
+}
+
+BOOST_AUTO_TEST_SUITE_END();
@@ -0,0 +1,97 @@
+
+#define BOOST_TEST_DYN_LINK
+#include <boost/test/unit_test.hpp>
+
+#include <sstream>
+#include <string>
+
+#include "token_stream.hpp"
+
+BOOST_AUTO_TEST_SUITE(token_stream_test);
+
+BOOST_AUTO_TEST_CASE(token_stream_test_source) {
+  SourceBuffer source{"add a, 32\n\nld b, c"};
+  SourceTokenStream tokens{source};
+
+  BOOST_CHECK_EQUAL(tokens.text(tokens.peek()), "add");
+  BOOST_CHECK_EQUAL(tokens.text(tokens.peekNext()), "a");
+  BOOST_CHECK_EQUAL(tokens.text(tokens.next()), "add");
+  BOOST_CHECK_EQUAL(tokens.text(tokens.next()), "a");
+  BOOST_CHECK_EQUAL(tokens.next().value, ',');
+  auto number = tokens.next();
+  BOOST_CHECK(number.kind == TokenKind::NUMBER);
+  BOOST_CHECK_EQUAL(number.value, 32);
+  // Looking ahead crosses into the next line
+  BOOST_CHECK(tokens.peek().kind == TokenKind::NEWLINE);
+  BOOST_CHECK(tokens.peekNext().kind == TokenKind::NEWLINE);
+  tokens.next();
+  tokens.next();
+  BOOST_CHECK_EQUAL(tokens.text(tokens.next()), "ld");
+  BOOST_CHECK_EQUAL(tokens.text(tokens.next()), "b");
+  tokens.next();
+  BOOST_CHECK_EQUAL(tokens.text(tokens.next()), "c");
+  BOOST_CHECK(tokens.next().kind == TokenKind::NEWLINE);
+  BOOST_CHECK(tokens.peekNext().kind == TokenKind::END);
+
+  // END is sticky
+  for (int i = 0; i < 3; i++) {
+    auto end = tokens.next();
+    BOOST_CHECK(end.kind == TokenKind::END);
+    BOOST_CHECK_EQUAL(end.offset, source.size());
+  }
+}
+
+BOOST_AUTO_TEST_CASE(token_stream_test_input) {
+  std::istringstream input{"  inc a ; comment\n.section \"text\"\n"};
+  InputTokenStream tokens{input};
+
+  auto inc = tokens.next();
+  BOOST_CHECK_EQUAL(inc.offset, 2);
+  BOOST_CHECK_EQUAL(tokens.text(inc), "inc");
+  BOOST_CHECK_EQUAL(tokens.text(tokens.next()), "a");
+  // Only the first line has been read so far
+  BOOST_CHECK(tokens.next().kind == TokenKind::NEWLINE);
+  BOOST_CHECK_EQUAL(input.tellg(), 18);
+
+  auto section = tokens.next();
+  BOOST_CHECK_EQUAL(section.offset, 18);
+  BOOST_CHECK_EQUAL(tokens.text(section), ".section");
+  auto name = tokens.next();
+  BOOST_CHECK(name.kind == TokenKind::STRING);
+  BOOST_CHECK_EQUAL(tokens.text(name), "\"text\"");
+  BOOST_CHECK(tokens.next().kind == TokenKind::NEWLINE);
+  BOOST_CHECK(tokens.next().kind == TokenKind::END);
+}
+
+BOOST_AUTO_TEST_CASE(token_stream_test_input_errors) {
+  std::istringstream input{"nop\nadd a, #3\n"};
+  InputTokenStream tokens{input};
+  BOOST_CHECK_EQUAL(tokens.text(tokens.next()), "nop");
+  // The error is only found once the second line is pulled
+  BOOST_CHECK_THROW(tokens.peekNext(), TokenizerException);
+}
+
+BOOST_AUTO_TEST_CASE(token_stream_test_token_list) {
+  {
+    TokenList list{"ld", "a", ",", "b", "EOL", "EOF"};
+    TokenListStream tokens{list};
+    BOOST_CHECK_EQUAL(tokens.text(tokens.next()), "ld");
+    BOOST_CHECK_EQUAL(tokens.text(tokens.next()), "a");
+    BOOST_CHECK_EQUAL(tokens.next().value, ',');
+    BOOST_CHECK_EQUAL(tokens.text(tokens.next()), "b");
+    BOOST_CHECK(tokens.next().kind == TokenKind::NEWLINE);
+    BOOST_CHECK(tokens.next().kind == TokenKind::END);
+    BOOST_CHECK(tokens.next().kind == TokenKind::END);
+  }
+
+  {  // Lists built by hand may stop short of EOF
+    TokenList list{"1", "+", "2"};
+    TokenListStream tokens{list};
+    BOOST_CHECK_EQUAL(tokens.next().value, 1);
+    BOOST_CHECK_EQUAL(tokens.next().value, '+');
+    BOOST_CHECK_EQUAL(tokens.next().value, 2);
+    BOOST_CHECK(tokens.next().kind == TokenKind::END);
+  }
+}
+
+BOOST_AUTO_TEST_SUITE_END();
@@ -1,10 +1,13 @@
 
+#include <algorithm>
 #include <fstream>
+#include <sstream>
 #include <string>
 #define BOOST_TEST_MAIN
 #define BOOST_TEST_DYN_LINK
 #include <boost/test/unit_test.hpp>
 
+#include "token_stream.hpp"
 #include "tokenizer.hpp"
 
 BOOST_AUTO_TEST_CASE(tokenizer_test_isReserved) {
@@ -29,6 +32,225 @@ BOOST_AUTO_TEST_CASE(tokenizer_test_tokenize0) {
   BOOST_REQUIRE_EQUAL(tokens.at(5), Token("EOF"));
 }
 
+BOOST_AUTO_TEST_CASE(tokenizer_test_tokenize_buffer) {
+  auto tokenizer = Tokenizer{};
+  SourceBuffer source{"add a, 32\n  ; comment\nld (hl), b"};
+  auto views = tokenizer.tokenize(source);
+  BOOST_REQUIRE_EQUAL(views.size(), 14);
+  BOOST_CHECK_EQUAL(Tokenizer::text(source, views.at(0)), "add");
+  BOOST_CHECK_EQUAL(views.at(0).offset, 0);
+  BOOST_CHECK_EQUAL(Tokenizer::text(source, views.at(1)), "a");
+  BOOST_CHECK_EQUAL(views.at(1).offset, 4);
+  BOOST_CHECK(views.at(1).kind == TokenKind::IDENTIFIER);
+  BOOST_CHECK_EQUAL(Tokenizer::text(source, views.at(2)), ",");
+  BOOST_CHECK(views.at(2).kind == TokenKind::PUNCTUATION);
+  BOOST_CHECK_EQUAL(views.at(2).value, ',');
+  BOOST_CHECK_EQUAL(Tokenizer::text(source, views.at(3)), "32");
+  BOOST_CHECK(views.at(3).kind == TokenKind::NUMBER);
+  BOOST_CHECK_EQUAL(views.at(3).value, 32);
+  BOOST_CHECK(views.at(4).kind == TokenKind::NEWLINE);
+  BOOST_CHECK_EQUAL(Tokenizer::text(source, views.at(4)), "EOL");
+  BOOST_CHECK(views.at(5).kind == TokenKind::NEWLINE);
+  BOOST_CHECK_EQUAL(Tokenizer::text(source, views.at(6)), "ld");
+  BOOST_CHECK_EQUAL(views.at(6).offset, 22);
+  BOOST_CHECK_EQUAL(Tokenizer::text(source, views.at(7)), "(");
+  BOOST_CHECK_EQUAL(Tokenizer::text(source, views.at(8)), "hl");
+  BOOST_CHECK_EQUAL(Tokenizer::text(source, views.at(9)), ")");
+  BOOST_CHECK_EQUAL(Tokenizer::text(source, views.at(10)), ",");
+  BOOST_CHECK_EQUAL(Tokenizer::text(source, views.at(11)), "b");
+  // The last line has no newline but still ends with EOL
+  BOOST_CHECK(views.at(12).kind == TokenKind::NEWLINE);
+  BOOST_CHECK(views.at(13).kind == TokenKind::END);
+  BOOST_CHECK_EQUAL(views.at(13).offset, source.size());
+
+  // The adapter matches the stream tokenizer exactly
+  std::stringstream stream{std::string{source.text()}};
+  BOOST_CHECK(Tokenizer::toTokenList(source, views) ==
+              tokenizer.tokenize(stream));
+}
+
+BOOST_AUTO_TEST_CASE(tokenizer_test_tokenize_buffer_errors) {
+  auto tokenizer = Tokenizer{};
+  {
+    SourceBuffer source{""};
+    auto views = tokenizer.tokenize(source);
+    BOOST_REQUIRE_EQUAL(views.size(), 1);
+    BOOST_CHECK(views.at(0).kind == TokenKind::END);
+  }
+  {
+    SourceBuffer source{".ascii \"unterminated\n"};
+    BOOST_CHECK_THROW(tokenizer.tokenize(source), TokenizerException);
+  }
+  {
+    SourceBuffer source{"add a, #3"};
+    BOOST_CHECK_THROW(tokenizer.tokenize(source), TokenizerException);
+  }
+  BOOST_CHECK_THROW(SourceBuffer::map("../test/data/does_not_exist.asm"),
+                    SourceBufferException);
+}
+
+BOOST_AUTO_TEST_CASE(tokenizer_test_recover) {
+  std::ostringstream log{};
+  Tokenizer tokenizer{log};
+  DiagnosticList diagnostics{};
+  tokenizer.setDiagnostics(&diagnostics);
+  SourceBuffer source{"add a, #3\nnop\n.ascii \"unterminated\ninc a\n"};
+  auto tokens = tokenizer.tokenize(source);
+
+  // Invalid lines are left with only their NEWLINE
+  auto text = Tokenizer::toTokenList(source, tokens);
+  TokenList expected{"EOL", "nop", "EOL", "EOL", "inc", "a", "EOL", "EOF"};
+  BOOST_CHECK_EQUAL_COLLECTIONS(text.begin(), text.end(), expected.begin(),
+                                expected.end());
+  BOOST_REQUIRE_EQUAL(diagnostics.size(), 2);
+  BOOST_CHECK_EQUAL(diagnostics[0].offset, 7);
+  BOOST_CHECK_EQUAL(diagnostics[0].message, "Invalid token");
+  BOOST_CHECK_EQUAL(diagnostics[1].offset, 34);
+  BOOST_CHECK_EQUAL(diagnostics[1].message, "Unterminated string");
+  BOOST_CHECK(log.str().empty());
+
+  // So are those of an input stream
+  diagnostics.clear();
+  std::istringstream input{"nop\nld a, #3\n"};
+  auto list = tokenizer.tokenize(input);
+  TokenList expectedList{"nop", "EOL", "EOL", "EOF"};
+  BOOST_CHECK_EQUAL_COLLECTIONS(list.begin(), list.end(),
+                                expectedList.begin(), expectedList.end());
+  BOOST_REQUIRE_EQUAL(diagnostics.size(), 1);
+  BOOST_CHECK_EQUAL(diagnostics[0].offset, 10);
+}
+
+BOOST_AUTO_TEST_CASE(tokenizer_test_number_literals) {
+  auto tokenizer = Tokenizer{};
+  SourceBuffer source{
+      "42 $FF40 0xff %1010 'A' ' ' $123456789 0 $ 0x 12a %102 'ab'"};
+  auto tokens = tokenizer.tokenize(source);
+  BOOST_REQUIRE_EQUAL(tokens.size(), 15);
+  std::vector<uint32_t> values{42, 0xff40, 0xff, 10, 'A', ' ', 0x23456789, 0};
+  for (size_t i = 0; i < values.size(); i++) {
+    BOOST_TEST_CONTEXT(Tokenizer::text(source, tokens.at(i))) {
+      BOOST_CHECK(tokens.at(i).kind == TokenKind::NUMBER);
+      BOOST_CHECK_EQUAL(tokens.at(i).value, values.at(i));
+    }
+  }
+  // Malformed numbers are not numbers, nor keywords
+  for (size_t i = values.size(); i < 13; i++) {
+    BOOST_TEST_CONTEXT(Tokenizer::text(source, tokens.at(i))) {
+      BOOST_CHECK(tokens.at(i).kind == TokenKind::IDENTIFIER);
+      BOOST_CHECK(tokens.at(i).keyword.kind == KeywordKind::NONE);
+    }
+  }
+
+  // Literals end at the same characters as other tokens
+  SourceBuffer expr{"$10+%11*'x'"};
+  auto exprTokens = tokenizer.tokenize(expr);
+  BOOST_REQUIRE_EQUAL(exprTokens.size(), 7);
+  BOOST_CHECK_EQUAL(exprTokens.at(0).value, 16);
+  BOOST_CHECK_EQUAL(exprTokens.at(1).value, '+');
+  BOOST_CHECK_EQUAL(exprTokens.at(2).value, 3);
+  BOOST_CHECK_EQUAL(exprTokens.at(4).value, 'x');
+
+  std::ostringstream log{};
+  Tokenizer quiet{log};
+  for (auto bad : {"ld a, 'A", "ld a, b$", "ld a, 1'"}) {
+    BOOST_TEST_CONTEXT(bad) {
+      SourceBuffer badSource{bad};
+      BOOST_CHECK_THROW(quiet.tokenize(badSource), TokenizerException);
+    }
+  }
+}
+
+BOOST_AUTO_TEST_CASE(tokenizer_test_operators) {
+  // Operators are single characters; the parser joins adjacent ones. % is an
+  // operator right after another token, and starts a binary number otherwise
+  auto tokenizer = Tokenizer{};
+  SourceBuffer source{"x<<2 >= %101%3 && !~(y)"};
+  auto tokens = tokenizer.tokenize(source);
+  std::vector<std::string> expected{"x", "<", "<", "2", ">", "=", "%101",
+                                    "%", "3", "&", "&", "!", "~", "(",
+                                    "y", ")"};
+  BOOST_REQUIRE_EQUAL(tokens.size(), expected.size() + 2);
+  for (size_t i = 0; i < expected.size(); i++) {
+    BOOST_CHECK_EQUAL(Tokenizer::text(source, tokens.at(i)), expected.at(i));
+  }
+  BOOST_CHECK(tokens.at(6).kind == TokenKind::NUMBER);
+  BOOST_CHECK_EQUAL(tokens.at(6).value, 5);
+  for (size_t i : {1, 2, 4, 5, 7, 9, 10, 11, 12}) {
+    BOOST_CHECK(tokens.at(i).kind == TokenKind::PUNCTUATION);
+  }
+}
+
+BOOST_AUTO_TEST_CASE(tokenizer_test_source_locate) {
+  SourceBuffer source{"nop\n\n  add a, 32\nld b"};
+  auto location = source.locate(0);
+  BOOST_CHECK_EQUAL(location.line, 1);
+  BOOST_CHECK_EQUAL(location.column, 1);
+  location = source.locate(3);
+  BOOST_CHECK_EQUAL(location.line, 1);
+  BOOST_CHECK_EQUAL(location.column, 4);
+  location = source.locate(4);
+  BOOST_CHECK_EQUAL(location.line, 2);
+  BOOST_CHECK_EQUAL(location.column, 1);
+
+  Tokenizer tokenizer{};
+  auto tokens = tokenizer.tokenize(source);
+  // "32"
+  location = source.locate(tokens.at(6).offset);
+  BOOST_CHECK_EQUAL(location.line, 3);
+  BOOST_CHECK_EQUAL(location.column, 10);
+  // END
+  location = source.locate(tokens.back().offset);
+  BOOST_CHECK_EQUAL(location.line, 4);
+  BOOST_CHECK_EQUAL(location.column, 5);
+}
+
+BOOST_AUTO_TEST_CASE(tokenizer_test_tokenize_parallel) {
+  // Big enough to be split into several chunks
+  std::string text{};
+  for (int i = 0; text.size() < 6 * Tokenizer::MIN_CHUNK_SIZE; i++) {
+    text += "  .byte 1, 22, 33  ; row " + std::to_string(i) + "\n";
+    text += "\n";
+    text += "label_" + std::to_string(i) + " ld (hl), \"str\"\n";
+  }
+  text += "nop";
+  SourceBuffer source{text};
+
+  Tokenizer tokenizer{};
+  auto expected = tokenizer.tokenize(source);
+  for (unsigned threads : {1u, 2u, 3u, 4u, 8u}) {
+    auto tokens = tokenizer.tokenize(source, threads);
+    BOOST_REQUIRE_EQUAL(tokens.size(), expected.size());
+    for (size_t i = 0; i < tokens.size(); i++) {
+      BOOST_REQUIRE(tokens[i].kind == expected[i].kind);
+      BOOST_REQUIRE_EQUAL(tokens[i].offset, expected[i].offset);
+      BOOST_REQUIRE_EQUAL(tokens[i].length, expected[i].length);
+      BOOST_REQUIRE_EQUAL(tokens[i].value, expected[i].value);
+    }
+  }
+
+  // Errors in several chunks report the first one, with its line number
+  auto half = text.size() / 2;
+  auto firstBad = text.find('\n', text.size() / 3) + 1;
+  auto secondBad = text.find('\n', half) + 1;
+  text[firstBad] = '#';
+  text[secondBad] = '#';
+  auto line = std::count(text.begin(), text.begin() + firstBad, '\n');
+  SourceBuffer bad{text};
+  std::ostringstream log{};
+  Tokenizer quiet{log};
+  try {
+    quiet.tokenize(bad, 4);
+    BOOST_FAIL("Expected a TokenizerException");
+  } catch (TokenizerException& e) {
+    BOOST_CHECK_EQUAL(e.line(), line);
+    BOOST_CHECK_EQUAL(e.column(), 0);
+  }
+  // Only the reported error is logged
+  auto logged = log.str();
+  BOOST_CHECK_EQUAL(logged.find("Line " + std::to_string(line) + ":"), 0);
+  BOOST_CHECK_EQUAL(std::count(logged.begin(), logged.end(), '^'), 1);
+}
+
 class TokenizerTestFile {
  public:
   explicit TokenizerTestFile(std::string filename, std::string expectedFilename)
@@ -61,6 +283,20 @@ class TokenizerTestFile {
     if (token != tokens.end()) {
       BOOST_FAIL("token != tokens.end()");
     }
+
+    // The memory-mapped tokenizer has to agree with the stream tokenizer
+    auto source = SourceBuffer::map(std::string{"../test/data/"} + filename);
+    auto records = tokenizer.tokenize(source);
+    BOOST_CHECK(Tokenizer::toTokenList(source, records) == tokens);
+
+    // And so does pulling the tokens one at a time
+    SourceTokenStream pulled{source};
+    for (auto& record : records) {
+      auto tok = pulled.next();
+      BOOST_REQUIRE(tok.kind == record.kind);
+      BOOST_REQUIRE_EQUAL(tok.offset, record.offset);
+      BOOST_REQUIRE_EQUAL(tok.length, record.length);
+    }
   }
 
   static const int MAX_LINELEN = 256;